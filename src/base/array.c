@@ -48,9 +48,8 @@ Void uarray_ensure_count (UArray *array, U64 esize, U64 n, Bool zeroed) {
 
 Void *uarray_push (UArray *array, U64 esize) {
     if (array->count == array->capacity) {
-        U64 new_cap = array->capacity ? cast(U64, 1.8 * array->capacity) : 2;
-        assert_always(new_cap > array->capacity);
-        uarray_increase_capacity(array, esize, new_cap);
+        U64 new_cap = array->capacity ? max(array->capacity + 1, cast(U64, 1.8 * array->capacity)) : 2;
+        uarray_increase_capacity(array, esize, new_cap - array->capacity);
     }
     Void *r = &array->data[esize * array->count];
     array->count++;
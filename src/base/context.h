@@ -13,6 +13,8 @@
 //     OS_LINUX
 //     OS_WINDOWS
 //
+//     ARCH_X86_64
+//
 //     IF_BUILD_DEBUG
 //     IF_BUILD_RELEASE
 //
@@ -41,6 +43,10 @@
     #error "Unsupported compiler."
 #endif
 
+#if defined(__x86_64__)
+    #define ARCH_X86_64 1
+#endif
+
 // =============================================================================
 // Short form IF_BUILD() macros:
 // =============================================================================
@@ -67,3 +73,6 @@
 #if !defined(OS_LINUX)
     #define OS_LINUX 0
 #endif
+#if !defined(ARCH_X86_64)
+    #define ARCH_X86_64 0
+#endif
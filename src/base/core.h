@@ -51,10 +51,24 @@ typedef va_list   VaList;
 #define MB        (1024u*KB)
 #define GB        (1024u*MB)
 #define MAX_ALIGN (alignof(max_align_t))
+#define CACHE_LINE (64u)
 
 #define JOIN_(A, B) A ## B
 #define JOIN(A, B)  JOIN_(A, B)
 
+// Expands to M(X, A) for each variadic arg A:
+//
+//     FOR_EACH(M, x, a, b, c)  ->  M(x, a) M(x, b) M(x, c)
+//
+#define FOR_EACH(M, X, ...)      __VA_OPT__(FOR_EACH_EVAL(FOR_EACH_(M, X, __VA_ARGS__)))
+#define FOR_EACH_(M, X, A, ...)  M(X, A) __VA_OPT__(FOR_EACH_AGAIN FOR_EACH_PARENS (M, X, __VA_ARGS__))
+#define FOR_EACH_AGAIN()         FOR_EACH_
+#define FOR_EACH_PARENS          ()
+#define FOR_EACH_EVAL(...)       FOR_EACH_EVAL1(FOR_EACH_EVAL1(FOR_EACH_EVAL1(FOR_EACH_EVAL1(__VA_ARGS__))))
+#define FOR_EACH_EVAL1(...)      FOR_EACH_EVAL2(FOR_EACH_EVAL2(FOR_EACH_EVAL2(FOR_EACH_EVAL2(__VA_ARGS__))))
+#define FOR_EACH_EVAL2(...)      FOR_EACH_EVAL3(FOR_EACH_EVAL3(FOR_EACH_EVAL3(FOR_EACH_EVAL3(__VA_ARGS__))))
+#define FOR_EACH_EVAL3(...)      __VA_ARGS__
+
 #if BUILD_DEBUG
     #define assert_dbg(...) ({ if (!(__VA_ARGS__)) panic(); })
 #else
@@ -131,16 +145,54 @@ typedef va_list   VaList;
 #define let1(...) for (U8 _(I)=1; _(I);) def1_(let_, __VA_ARGS__) for (; _(I); _(I)=0)
 #define let2(...) for (U8 _(I)=1; _(I);) def2_(let_, __VA_ARGS__) for (; _(I); _(I)=0)
 
+// The atomic_cmp_exchange macro returns the value that was
+// in X before the op, so it succeeded if that equals E.
+//
+// The plain macros are sequentially consistent. The ones with
+// an explicit order suffix are for lock-free code that pairs a
+// release store/rmw in one thread with an acquire load/rmw in
+// another. Relaxed is only for counters and hints which don't
+// publish any other memory.
+//
+// The cpu_relax macro goes into spin-wait loops. It tells the
+// cpu to back off a bit, which saves power and frees execution
+// resources for the sibling hyperthread.
 #if COMPILER_CLANG || COMPILER_GCC
-    #define atomic_load(X)               __atomic_load(X, __ATOMIC_SEQ_CST)
-    #define atomic_inc_load(X)           (__atomic_fetch_add(X, 1, __ATOMIC_SEQ_CST) + 1)
-    #define atomic_dec_load(X)           (__atomic_fetch_add(X, 1, __ATOMIC_SEQ_CST) - 1)
+    #define atomic_load(X)               __atomic_load_n(X, __ATOMIC_SEQ_CST)
+    #define atomic_store(X, V)           __atomic_store_n(X, V, __ATOMIC_SEQ_CST)
+    #define atomic_inc_load(X)           __atomic_add_fetch(X, 1, __ATOMIC_SEQ_CST)
+    #define atomic_dec_load(X)           __atomic_sub_fetch(X, 1, __ATOMIC_SEQ_CST)
+    #define atomic_add_load(X, N)        __atomic_add_fetch(X, N, __ATOMIC_SEQ_CST)
+    #define atomic_sub_load(X, N)        __atomic_sub_fetch(X, N, __ATOMIC_SEQ_CST)
     #define atomic_exchange(X, C)        __atomic_exchange_n(X, C, __ATOMIC_SEQ_CST)
     #define atomic_cmp_exchange(X, E, D) ({ def3(x, e, d, X, E, D); __atomic_compare_exchange_n(x, &e, d, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); e; })
+    #define atomic_fence()               __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+    #define atomic_load_relaxed(X)                __atomic_load_n(X, __ATOMIC_RELAXED)
+    #define atomic_load_acquire(X)                __atomic_load_n(X, __ATOMIC_ACQUIRE)
+    #define atomic_store_relaxed(X, V)            __atomic_store_n(X, V, __ATOMIC_RELAXED)
+    #define atomic_store_release(X, V)            __atomic_store_n(X, V, __ATOMIC_RELEASE)
+    #define atomic_add_load_relaxed(X, N)         __atomic_add_fetch(X, N, __ATOMIC_RELAXED)
+    #define atomic_add_load_acq_rel(X, N)         __atomic_add_fetch(X, N, __ATOMIC_ACQ_REL)
+    #define atomic_sub_load_acq_rel(X, N)         __atomic_sub_fetch(X, N, __ATOMIC_ACQ_REL)
+    #define atomic_exchange_acquire(X, C)         __atomic_exchange_n(X, C, __ATOMIC_ACQUIRE)
+    #define atomic_exchange_release(X, C)         __atomic_exchange_n(X, C, __ATOMIC_RELEASE)
+    #define atomic_cmp_exchange_relaxed(X, E, D)  ({ def3(x, e, d, X, E, D); __atomic_compare_exchange_n(x, &e, d, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED); e; })
+    #define atomic_cmp_exchange_acquire(X, E, D)  ({ def3(x, e, d, X, E, D); __atomic_compare_exchange_n(x, &e, d, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED); e; })
+    #define atomic_cmp_exchange_release(X, E, D)  ({ def3(x, e, d, X, E, D); __atomic_compare_exchange_n(x, &e, d, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED); e; })
+    #define atomic_cmp_exchange_acq_rel(X, E, D)  ({ def3(x, e, d, X, E, D); __atomic_compare_exchange_n(x, &e, d, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE); e; })
+    #define atomic_fence_acquire()                __atomic_thread_fence(__ATOMIC_ACQUIRE)
+    #define atomic_fence_release()                __atomic_thread_fence(__ATOMIC_RELEASE)
 #else
     #error "No atomics."
 #endif
 
+#if ARCH_X86_64
+    #define cpu_relax() __builtin_ia32_pause()
+#else
+    #define cpu_relax() atomic_fence_acquire()
+#endif
+
 // Use the reach/reached macros to mark a position in
 // code that must be reached before exiting a scope:
 //
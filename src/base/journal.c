@@ -0,0 +1,168 @@
+#include "base/journal.h"
+
+// The text of the entry is the slice [offset, offset+count)
+// of Journal.text. Entries are appended in order, so their
+// text spans are laid out in the same order.
+istruct (JournalEntry) {
+    JournalEditTag tag;
+    Bool group_start;
+    U64 idx;
+    U64 offset;
+    U64 count;
+    JournalPos pos;
+};
+
+array_typedef(JournalEntry, JournalEntry);
+
+istruct (Journal) {
+    Mem *mem;
+    AString text;
+    ArrayJournalEntry entries;
+    U64 cursor; // Number of applied entries; the rest are redoable.
+    Bool sealed;
+    JournalPos pos_counter;
+};
+
+Journal *journal_new (Mem *mem) {
+    Auto j = mem_new(mem, Journal);
+    j->mem = mem;
+    j->text = astr_new(mem);
+    array_init(&j->entries, mem);
+    return j;
+}
+
+Void journal_destroy (Journal *j) {
+    array_free(&j->text);
+    array_free(&j->entries);
+    mem_free(j->mem, .old_ptr=j, .old_size=sizeof(Journal));
+}
+
+Void journal_seal (Journal *j) {
+    j->sealed = true;
+}
+
+JournalPos journal_pos (Journal *j) {
+    return j->cursor ? array_get(&j->entries, j->cursor - 1).pos : 0;
+}
+
+static Bool can_join_group (Journal *j, JournalEditTag tag, String text, U64 idx) {
+    if (j->sealed || !j->cursor) return false;
+    if (str_index_of_first(text, '\n') != ARRAY_NIL_IDX) return false;
+
+    JournalEntry *last = array_ref(&j->entries, j->cursor - 1);
+    if (last->tag != tag) return false;
+
+    switch (tag) {
+    case JOURNAL_INSERT: return idx == (last->idx + last->count);
+    case JOURNAL_DELETE: return (idx == last->idx) || ((idx + text.count) == last->idx);
+    }
+
+    return false;
+}
+
+static Void record (Journal *j, JournalEditTag tag, String text, U64 idx) {
+    if (! text.count) return;
+
+    // Drop the redo history.
+    if (j->cursor < j->entries.count) {
+        j->text.count = array_get(&j->entries, j->cursor).offset;
+        j->entries.count = j->cursor;
+        j->sealed = true;
+    }
+
+    Bool join = can_join_group(j, tag, text, idx);
+    JournalEntry *last = join ? array_ref(&j->entries, j->cursor - 1) : 0;
+
+    // Typing forward and forward deleting just extend the
+    // text of the last entry. Backspacing needs new entries
+    // since the deleted text comes before the previous one.
+    if (join && (idx == (tag == JOURNAL_INSERT ? last->idx + last->count : last->idx))) {
+        astr_push_str(&j->text, text);
+        last->count += text.count;
+        last->pos = ++j->pos_counter;
+    } else {
+        array_push_lit(&j->entries,
+            .tag         = tag,
+            .group_start = !join,
+            .idx         = idx,
+            .offset      = j->text.count,
+            .count       = text.count,
+            .pos         = ++j->pos_counter,
+        );
+
+        astr_push_str(&j->text, text);
+        j->cursor++;
+    }
+
+    j->sealed = false;
+}
+
+Void journal_insert (Journal *j, String text, U64 idx)         { record(j, JOURNAL_INSERT, text, idx); }
+Void journal_delete (Journal *j, String deleted_text, U64 idx) { record(j, JOURNAL_DELETE, deleted_text, idx); }
+
+// Writes into the out param the edit that reverts the most
+// recent edit. The group_end flag marks the last edit of
+// an undo group. Returns false if there is nothing to undo.
+Bool journal_undo_step (Journal *j, JournalEdit *out) {
+    if (! j->cursor) return false;
+
+    JournalEntry *e = array_ref(&j->entries, --j->cursor);
+    out->tag        = (e->tag == JOURNAL_INSERT) ? JOURNAL_DELETE : JOURNAL_INSERT;
+    out->group_end  = e->group_start;
+    out->idx        = e->idx;
+    out->text       = str_slice(astr_to_str(&j->text), e->offset, e->count);
+    j->sealed       = true;
+    return true;
+}
+
+Bool journal_redo_step (Journal *j, JournalEdit *out) {
+    if (j->cursor == j->entries.count) return false;
+
+    JournalEntry *e = array_ref(&j->entries, j->cursor++);
+    out->tag        = e->tag;
+    out->group_end  = (j->cursor == j->entries.count) || array_get(&j->entries, j->cursor).group_start;
+    out->idx        = e->idx;
+    out->text       = str_slice(astr_to_str(&j->text), e->offset, e->count);
+    j->sealed       = true;
+    return true;
+}
+
+// =============================================================================
+// GapBuf adapters:
+// =============================================================================
+static Void apply_to_gb (GapBuf *gb, JournalEdit *e) {
+    switch (e->tag) {
+    case JOURNAL_INSERT: gb_insert(gb, e->text, e->idx); break;
+    case JOURNAL_DELETE: gb_delete(gb, e->text.count, e->idx); break;
+    }
+}
+
+Void journal_gb_insert (Journal *j, GapBuf *gb, String text, U64 idx) {
+    idx = min(idx, gb_count(gb));
+    journal_insert(j, text, idx);
+    gb_insert(gb, text, idx);
+}
+
+Void journal_gb_delete (Journal *j, GapBuf *gb, U64 count, U64 idx) {
+    tmem_new(tm);
+    idx = min(idx, gb_count(gb));
+    journal_delete(j, gb_slice(gb, tm, idx, count), idx);
+    gb_delete(gb, count, idx);
+}
+
+// Reverts the most recent group of edits.
+Bool journal_gb_undo (Journal *j, GapBuf *gb) {
+    JournalEdit e;
+    if (! journal_undo_step(j, &e)) return false;
+    apply_to_gb(gb, &e);
+    while (!e.group_end && journal_undo_step(j, &e)) apply_to_gb(gb, &e);
+    return true;
+}
+
+Bool journal_gb_redo (Journal *j, GapBuf *gb) {
+    JournalEdit e;
+    if (! journal_redo_step(j, &e)) return false;
+    apply_to_gb(gb, &e);
+    while (!e.group_end && journal_redo_step(j, &e)) apply_to_gb(gb, &e);
+    return true;
+}
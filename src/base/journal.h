@@ -0,0 +1,88 @@
+#pragma once
+
+// =============================================================================
+// Overview:
+// ---------
+//
+// An append-only log of text edits that implements undo/redo
+// for GapBuf (or any other text container via the step API).
+//
+// Inserted text and deleted text are both appended into one
+// buffer owned by the journal, while each edit is a small
+// entry that refers to a span of that buffer. This way the
+// history costs memory proportional to the edits, and not
+// to the size of the document.
+//
+// Edits are grouped so that a single undo reverts a run of
+// keystrokes. A new edit joins the current group if it has
+// the same type and is adjacent to the previous edit (typing
+// forward, backspacing, or forward deleting). Call the
+// journal_seal() function to force a new group (on cursor
+// jumps, focus changes, timers, ...).
+//
+// The journal_pos() function is an O(1) checkpoint. If it
+// returns the same value at two points in time, then the
+// text is the same. This is useful for a "modified" flag.
+//
+// Usage example:
+// --------------
+//
+//     GapBuf *gb  = gb_new(tm, 0);
+//     Journal *j  = journal_new(tm);
+//     JournalPos saved = journal_pos(j);
+//
+//     journal_gb_insert(j, gb, str("Hello"), 0);
+//     journal_gb_insert(j, gb, str(" world"), 5); // Joins the first group.
+//     journal_seal(j);
+//     journal_gb_delete(j, gb, 6, 5);
+//
+//     journal_gb_undo(j, gb); // "Hello world"
+//     journal_gb_undo(j, gb); // ""
+//     journal_gb_redo(j, gb); // "Hello world"
+//
+//     Bool modified = (journal_pos(j) != saved); // true
+//
+// Use the step functions to drive a different container:
+//
+//     JournalEdit e;
+//     while (journal_undo_step(j, &e)) {
+//         if (e.tag == JOURNAL_INSERT) my_insert(e.text, e.idx);
+//         else                         my_delete(e.text.count, e.idx);
+//         if (e.group_end) break;
+//     }
+//
+// =============================================================================
+#include "base/core.h"
+#include "base/mem.h"
+#include "base/string.h"
+
+ienum (JournalEditTag, U8) {
+    JOURNAL_INSERT,
+    JOURNAL_DELETE,
+};
+
+// The text points into the journal and is valid until
+// the next call to a function that records an edit.
+istruct (JournalEdit) {
+    JournalEditTag tag;
+    Bool group_end;
+    U64 idx;
+    String text;
+};
+
+typedef U64 JournalPos;
+
+istruct (Journal);
+
+Journal   *journal_new       (Mem *);
+Void       journal_destroy   (Journal *);
+Void       journal_insert    (Journal *, String text, U64 idx);
+Void       journal_delete    (Journal *, String deleted_text, U64 idx);
+Void       journal_seal      (Journal *);
+JournalPos journal_pos       (Journal *);
+Bool       journal_undo_step (Journal *, JournalEdit *);
+Bool       journal_redo_step (Journal *, JournalEdit *);
+Void       journal_gb_insert (Journal *, GapBuf *, String text, U64 idx);
+Void       journal_gb_delete (Journal *, GapBuf *, U64 count, U64 idx);
+Bool       journal_gb_undo   (Journal *, GapBuf *);
+Bool       journal_gb_redo   (Journal *, GapBuf *);
@@ -1,5 +1,10 @@
 #include "base/log.h"
 #include "base/map.h"
+#include "base/spsc.h"
+#include "base/sync.h"
+#include "os/fs.h"
+#include "os/time.h"
+#include "os/threads.h"
 
 // =============================================================================
 // Stack Trace:
@@ -77,10 +82,13 @@ Void print_stack_trace_fmt Fmt(1, 2) (CString fmt, ...) {
 // =============================================================================
 tls Log *log_data;
 
+static Void sink_write (String a, String b);
+static Void sink_stamp (AString *);
+
 assert_static(LOG_PLAIN == 0);
 
 CString log_tag_str [LOG_TAG_COUNT] = {
-    #define X(_, __, STR) STR,
+    #define X(_, __, STR, ...) STR,
         EACH_LOG_MSG(X)
     #undef X
 };
@@ -97,6 +105,12 @@ Void log_setup (Mem *mem, U64 min_block_size) {
     log_data->arena = arena;
 }
 
+Void log_teardown () {
+    while (log_data->scope) log_scope_end(0);
+    arena_destroy(log_data->arena);
+    log_data = 0;
+}
+
 LogScope *log_scope_start (Bool flush_iterables_on_exit) {
     assert_dbg(!log_data->scope || !log_data->open_msg_data);
     Arena *arena      = log_data->arena;
@@ -114,14 +128,22 @@ LogScope *log_scope_start (Bool flush_iterables_on_exit) {
 Void log_scope_end (LogScope **) {
     LogScope *scope = log_data->scope;
     if (log_data->open_msg_data) log_msg_end(0);
-    if (scope->flush_iter) astr_print(&scope->iterable_data);
-    astr_print(&scope->raw_data);
+    sink_write(scope->flush_iter ? scope->iterable_data.as_slice : (String){}, scope->raw_data.as_slice);
     log_data->scope = scope->prev;
     arena_pop_to(log_data->arena, scope->arena_pos);
 }
 
 Void log_scope_end_all () {
     while (log_data->scope) log_scope_end(0);
+    log_sink_flush();
+}
+
+// Also used by the binary log decoder.
+static Void push_msg_header (AString *a, LogMsgTag tag, String user_tag) {
+    if (tag == LOG_PLAIN) return;
+    astr_push_2cstr(a, log_tag_ansi[tag], log_tag_str[tag]);
+    if (user_tag.count) { astr_push_byte(a, '('); astr_push_str(a, user_tag); astr_push_byte(a, ')'); }
+    astr_push_cstr(a, TERM_END ": ");
 }
 
 AString *log_msg_start (LogMsgTag tag, CString user_tag, Bool iterable) {
@@ -135,9 +157,8 @@ AString *log_msg_start (LogMsgTag tag, CString user_tag, Bool iterable) {
     log_data->open_msg_data = data;
 
     if (tag != LOG_PLAIN) {
-        astr_push_2cstr(data, log_tag_ansi[tag], log_tag_str[tag]);
-        if (*user_tag) { astr_push_byte(data, '('); astr_push_2cstr(data, user_tag, ")"); }
-        astr_push_cstr(data, TERM_END ": ");
+        sink_stamp(data);
+        push_msg_header(data, tag, str(user_tag));
     }
 
     if (iterable) array_push_lit(
@@ -167,6 +188,689 @@ Void log_msg_end (AString **) {
     log_data->open_msg_data = 0;
 }
 
+// The first caller that sees an expired period starts the next
+// one and takes over the suppressed count of the old one.
+Bool log_limit (LogLimit *limit, U32 *out_suppressed) {
+    U64 now   = os_time_ms();
+    U64 start = atomic_load_relaxed(&limit->period_start);
+    *out_suppressed = 0;
+
+    if (now - start >= LOG_LIMIT_PERIOD_MS && atomic_cmp_exchange(&limit->period_start, start, now) == start) {
+        atomic_store(&limit->count, 0);
+        *out_suppressed = atomic_exchange(&limit->suppressed, 0);
+    }
+
+    if (atomic_inc_load(&limit->count) <= LOG_LIMIT_BURST) return true;
+
+    atomic_inc_load(&limit->suppressed);
+    return false;
+}
+
+// =============================================================================
+// Log Sink:
+// =============================================================================
+#define SINK_BUF_SIZE (256*KB) // The most the writer moves per writev batch.
+
+// There is a sink for text and one for the binary log, and each
+// thread has a ring per sink.
+ienum (SinkKind, U8) {
+    SINK_TEXT,
+    SINK_BINARY,
+    SINK_KIND_COUNT,
+};
+
+istruct (LogRing) {
+    LogRing *next;
+    USpsc bytes;
+    U32 thread_idx;
+    Bool detached; // The thread is gone; freed by the writer once drained.
+};
+
+istruct (LogSink) {
+    Mem *mem;
+    U64 id; // Unique per sink_new, so a thread can tell that its cached ring is stale.
+    SinkKind kind;
+    LogSinkConfig config;
+    Int fd;
+    OsThread *thread;
+    U64 start_ns;
+    Mutex lock; // For the ring list and thread_count.
+    LogRing *rings;
+    LogRing *resume; // Cut short by the last pass; drained first by the next.
+    U32 thread_count;
+    U64 dropped;
+    U32 wake_seq;    // Bumped to wake the writer.
+    U32 written_seq; // Bumped by the writer after each pass.
+    U32 flushers;    // Threads waiting on written_seq.
+    Bool writer_sleeping;
+    Bool stop;
+};
+
+static LogSink *sinks[SINK_KIND_COUNT];
+static U64 sink_next_id;
+static tls LogRing *thread_rings[SINK_KIND_COUNT];
+static tls U64 thread_ring_sinks[SINK_KIND_COUNT]; // The LogSink.id each ring belongs to.
+
+static Void blog_push_dropped (LogSink *, ArrayString *, U64 bytes);
+
+// The rings are freed when their sink is destroyed, so the ring
+// cached by a thread is only valid if it belongs to the current
+// sink. A stale pointer is never dereferenced.
+static LogRing *ring_cached (LogSink *s) {
+    if (!s || thread_ring_sinks[s->kind] != s->id) return 0;
+    return thread_rings[s->kind];
+}
+
+static LogRing *ring_get (LogSink *s) {
+    LogRing *cached = ring_cached(s);
+    if (cached) return cached;
+
+    Auto r = mem_new(s->mem, LogRing);
+    uspsc_init(&r->bytes, s->mem, s->config.ring_size, 1);
+
+    mutex_scoped_lock(&s->lock);
+    r->thread_idx = s->thread_count++;
+    r->next       = s->rings;
+    s->rings      = r;
+    thread_rings[s->kind]      = r;
+    thread_ring_sinks[s->kind] = s->id;
+    return r;
+}
+
+static Void ring_free (LogSink *s, LogRing *r) {
+    uspsc_destroy(&r->bytes);
+    mem_free(s->mem, .old_ptr=r, .old_size=sizeof(LogRing));
+}
+
+static Void wake_writer (LogSink *s, Bool force) {
+    if (force || atomic_load(&s->writer_sleeping)) {
+        atomic_inc_load(&s->wake_seq);
+        os_futex_wake_one(&s->wake_seq);
+    }
+}
+
+static Void push_stamp (AString *a, U64 ns, U32 thread_idx) {
+    astr_push_fmt(a, "[%3lu.%06lu T%u] ", ns / 1000000000, (ns / 1000) % 1000000, thread_idx);
+}
+
+static Void sink_stamp (AString *a) {
+    LogSink *s = atomic_load(&sinks[SINK_TEXT]);
+    if (!s || s->config.no_stamp) return;
+    push_stamp(a, os_time_ns() - s->start_ns, ring_get(s)->thread_idx);
+}
+
+// Pushes the data as one piece so that the writer never splits
+// it. Text bigger than the ring is pushed in ring sized pieces,
+// while binary records that don't fit are dropped.
+static Void ring_push (LogSink *s, LogRing *r, String data, Bool block) {
+    U64 cap = r->bytes.mask + 1;
+
+    if (s->kind == SINK_BINARY && data.count > cap) {
+        atomic_add_load(&s->dropped, data.count);
+        return;
+    }
+
+    for (U64 i = 0; i < data.count; i += cap) {
+        U64 n = min(cap, data.count - i);
+
+        if (block) {
+            uspsc_push_all_wait(&r->bytes, data.data + i, n);
+        } else if (! uspsc_push_all(&r->bytes, data.data + i, n)) {
+            atomic_add_load(&s->dropped, data.count - i);
+            break;
+        }
+    }
+
+    wake_writer(s, false);
+}
+
+static Void sink_write (String a, String b) {
+    LogSink *s = atomic_load(&sinks[SINK_TEXT]);
+
+    if (! s) {
+        if (a.count) printf("%.*s", STR(a));
+        if (b.count) printf("%.*s", STR(b));
+        return;
+    }
+
+    if (a.count && b.count) {
+        tmem_new(tm);
+        ring_push(s, ring_get(s), str_cat(tm, a, b), s->config.block);
+    } else if (a.count || b.count) {
+        ring_push(s, ring_get(s), a.count ? a : b, s->config.block);
+    }
+}
+
+// A ring that fills the buffer may have been cut in the middle
+// of a message or record. It becomes the resume ring, and the
+// pass ends there.
+static U64 ring_drain (LogSink *s, LogRing *r, U8 *buf, U64 used, ArrayString *chunks) {
+    U64 n = uspsc_pop_n(&r->bytes, buf + used, SINK_BUF_SIZE - used);
+    if (n) array_push(chunks, ((String){ .data=cast(Char*, buf + used), .count=n }));
+    if (used + n == SINK_BUF_SIZE) s->resume = r;
+    return n;
+}
+
+// Moves what's in the rings into the buffer and writes it out
+// with one writev. Returns the count of bytes written. Drained
+// rings of exited threads are freed.
+//
+// If the last pass cut a ring, this one starts with the rest of
+// that ring so that nothing gets written into the middle of the
+// cut message. For the same reason drops are only reported by a
+// pass that didn't cut anything.
+static U64 sink_pass (LogSink *s, U8 *buf, U64 *reported_drops) {
+    tmem_new(tm);
+    ArrayString chunks;
+    array_init(&chunks, tm);
+    U64 used = 0;
+
+    {
+        mutex_scoped_lock(&s->lock);
+
+        LogRing *resume = s->resume;
+        s->resume = 0;
+        if (resume) used += ring_drain(s, resume, buf, used, &chunks);
+
+        for (LogRing **p = &s->rings; *p;) {
+            LogRing *r    = *p;
+            Bool detached = atomic_load(&r->detached);
+
+            if ((r != resume) && (used < SINK_BUF_SIZE)) used += ring_drain(s, r, buf, used, &chunks);
+
+            if (detached && (r != s->resume) && !uspsc_count(&r->bytes)) {
+                *p = r->next;
+                ring_free(s, r);
+            } else {
+                p = &r->next;
+            }
+        }
+    }
+
+    U64 dropped = atomic_load(&s->dropped);
+    if (dropped != *reported_drops && !s->resume) {
+        if (s->kind == SINK_TEXT) array_push(&chunks, astr_fmt(tm, "[log] Dropped %lu bytes of output.\n", dropped - *reported_drops));
+        else blog_push_dropped(s, &chunks, dropped - *reported_drops);
+        *reported_drops = dropped;
+    }
+
+    if (chunks.count) fs_write_chunks(s->fd, chunks.as_slice);
+    return used;
+}
+
+static Bool sink_has_data (LogSink *s) {
+    mutex_scoped_lock(&s->lock);
+    for (LogRing *r = s->rings; r; r = r->next) if (uspsc_count(&r->bytes)) return true;
+    return false;
+}
+
+// The sleeping protocol is the one from spsc.c: the writer sets
+// its flag and then rechecks the rings, while a producer pushes
+// and then checks the flag, so one of them sees the other.
+static Void sink_run (Void *arg) {
+    LogSink *s = arg;
+    U8 *buf    = mem_alloc(s->mem, U8, .size=SINK_BUF_SIZE);
+    U64 drops  = 0;
+
+    while (true) {
+        U32 seq = atomic_load(&s->wake_seq);
+        U64 n   = sink_pass(s, buf, &drops);
+
+        atomic_inc_load(&s->written_seq);
+        if (atomic_load(&s->flushers)) os_futex_wake_all(&s->written_seq);
+
+        if (n) continue;
+        if (atomic_load(&s->stop)) break;
+
+        atomic_store(&s->writer_sleeping, true);
+        if (! sink_has_data(s)) os_futex_wait(&s->wake_seq, seq);
+        atomic_store(&s->writer_sleeping, false);
+    }
+
+    mem_free(s->mem, .old_ptr=buf, .old_size=SINK_BUF_SIZE);
+}
+
+static LogSink *sink_new (Mem *mem, SinkKind kind, Int fd, LogSinkConfig *config) {
+    assert_always(! atomic_load(&sinks[kind]));
+
+    Auto s      = mem_new(mem, LogSink);
+    s->mem      = mem;
+    s->id       = atomic_inc_load(&sink_next_id);
+    s->kind     = kind;
+    s->config   = *config;
+    s->fd       = fd;
+    s->start_ns = os_time_ns();
+    if (! s->config.ring_size) s->config.ring_size = 64*KB;
+
+    s->thread = os_thread_new(mem, sink_run, s);
+    assert_always(s->thread);
+    atomic_store(&sinks[kind], s);
+    return s;
+}
+
+// Other threads must be done logging by now.
+static Void sink_destroy (SinkKind kind) {
+    LogSink *s = atomic_load(&sinks[kind]);
+    if (! s) return;
+
+    atomic_store(&s->stop, true);
+    wake_writer(s, true);
+    os_thread_join(s->thread);
+    os_thread_destroy(s->thread, s->mem);
+    atomic_store(&sinks[kind], 0);
+
+    for (LogRing *r = s->rings; r;) {
+        LogRing *next = r->next;
+        ring_free(s, r);
+        r = next;
+    }
+
+    if (s->fd != FS_STDOUT) fs_close(s->fd);
+    mem_free(s->mem, .old_ptr=s, .old_size=sizeof(LogSink));
+    thread_rings[kind] = 0;
+}
+
+// Once the ring is empty, the writer pass that may hold the last
+// of our output finishes and bumps written_seq.
+static Void sink_flush (SinkKind kind) {
+    LogSink *s = atomic_load(&sinks[kind]);
+    LogRing *r = ring_cached(s);
+    if (! r) return;
+
+    atomic_inc_load(&s->flushers);
+
+    while (true) {
+        U32 seq    = atomic_load(&s->written_seq);
+        Bool empty = ! uspsc_count(&r->bytes);
+        wake_writer(s, true);
+        while (atomic_load(&s->written_seq) == seq) os_futex_wait(&s->written_seq, seq);
+        if (empty) break;
+    }
+
+    atomic_dec_load(&s->flushers);
+}
+
+Bool log_sink_start_cfg (Mem *mem, LogSinkConfig *config) {
+    Int fd = config->path.count ? fs_open_append(config->path) : FS_STDOUT;
+    if (fd < 0) return false;
+    fflush(stdout); // Output printed so far comes first.
+    sink_new(mem, SINK_TEXT, fd, config);
+    return true;
+}
+
+Void log_sink_stop () {
+    sink_destroy(SINK_TEXT);
+}
+
+Void log_sink_flush () {
+    for (SinkKind k = 0; k < SINK_KIND_COUNT; ++k) sink_flush(k);
+}
+
+Void log_sink_detach () {
+    for (SinkKind k = 0; k < SINK_KIND_COUNT; ++k) {
+        LogRing *r = ring_cached(atomic_load(&sinks[k]));
+        if (r) atomic_store(&r->detached, true);
+        thread_rings[k] = 0;
+    }
+}
+
+U64 log_sink_dropped () {
+    LogSink *s = atomic_load(&sinks[SINK_TEXT]);
+    return s ? atomic_load(&s->dropped) : 0;
+}
+
+// =============================================================================
+// Binary Log:
+// =============================================================================
+U32 blog_session;
+static U32 blog_last_session;
+static U32 blog_next_id;
+static Mutex blog_lock;
+
+// The records are packed, so they are read and written with
+// memcpy. Site records are pushed in blocking mode since the
+// events that refer to them can't be decoded without them.
+ienum (BlogRecordKind, U8) {
+    BLOG_EVENT,   // Payload: the args.
+    BLOG_SITE,    // Payload: tag, arg_count, arg_types, line, user_tag, file, fmt.
+    BLOG_DROPPED, // Payload: U64 count of dropped bytes.
+};
+
+istruct (BlogRecord) {
+    U32 size; // Including this header.
+    U32 site;
+    U64 time; // Nanoseconds since blog_start_cfg.
+    U32 thread;
+    U8  kind; // BlogRecordKind.
+    U8  pad[3];
+};
+
+istruct (BlogFileHeader) {
+    U8  magic[8];
+    U32 version;
+    U32 pad;
+};
+
+static U8 *put (U8 *p, Void *data, U64 count) {
+    memcpy(p, data, count);
+    return p + count;
+}
+
+static U8 *put_str (U8 *p, String s) {
+    U32 count = s.count;
+    p = put(p, &count, sizeof(U32));
+    return put(p, s.data, count);
+}
+
+static Void blog_register (LogSink *s, BlogSite *site, U32 session) {
+    mutex_scoped_lock(&blog_lock);
+    if (atomic_load(&site->session) == session) return;
+
+    tmem_new(tm);
+    String user_tag = str(site->user_tag);
+    String file     = str(site->file);
+    String fmt      = str(site->fmt);
+    U64 size        = sizeof(BlogRecord) + 2 + site->arg_count + 4 + 12 + user_tag.count + file.count + fmt.count;
+    U8 *buf         = mem_alloc(tm, U8, .size=size);
+    LogRing *r      = ring_get(s);
+
+    site->id = blog_next_id++;
+    BlogRecord h = { .size=size, .site=site->id, .time=(os_time_ns() - s->start_ns), .thread=r->thread_idx, .kind=BLOG_SITE };
+
+    U8 *p = put(buf, &h, sizeof(h));
+    *p++  = site->tag;
+    *p++  = site->arg_count;
+    p     = put(p, site->arg_types, site->arg_count);
+    p     = put(p, &site->line, sizeof(U32));
+    p     = put_str(p, user_tag);
+    p     = put_str(p, file);
+    p     = put_str(p, fmt);
+
+    ring_push(s, r, (String){ .data=cast(Char*, buf), .count=size }, true);
+    atomic_store(&site->session, session);
+}
+
+Void blog_write (BlogSite *site, BlogArg *args) {
+    LogSink *s = atomic_load(&sinks[SINK_BINARY]);
+    if (! s) return;
+
+    U32 session = atomic_load_relaxed(&blog_session);
+    if (! session) return;
+    if (atomic_load_acquire(&site->session) != session) blog_register(s, site, session);
+
+    U64 size = sizeof(BlogRecord);
+    for (U32 i = 0; i < site->arg_count; ++i) size += (site->arg_types[i] == BLOG_STR) ? (4 + args[i].b) : 8;
+
+    U8 small[256];
+    tmem_new(tm);
+    U8 *buf    = (size <= sizeof(small)) ? small : mem_alloc(tm, U8, .size=size);
+    LogRing *r = ring_get(s);
+
+    BlogRecord h = { .size=size, .site=site->id, .time=(os_time_ns() - s->start_ns), .thread=r->thread_idx, .kind=BLOG_EVENT };
+    U8 *p = put(buf, &h, sizeof(h));
+
+    for (U32 i = 0; i < site->arg_count; ++i) {
+        if (site->arg_types[i] == BLOG_STR) p = put_str(p, (String){ .data=cast(Char*, args[i].a), .count=args[i].b });
+        else p = put(p, &args[i].a, 8);
+    }
+
+    ring_push(s, r, (String){ .data=cast(Char*, buf), .count=size }, s->config.block);
+}
+
+// Called on the writer thread, so the record is appended to the
+// chunks directly instead of going through a ring.
+static Void blog_push_dropped (LogSink *s, ArrayString *chunks, U64 bytes) {
+    U64 size = sizeof(BlogRecord) + sizeof(U64);
+    U8 *buf  = mem_alloc(chunks->mem, U8, .size=size);
+    BlogRecord h = { .size=size, .time=(os_time_ns() - s->start_ns), .kind=BLOG_DROPPED };
+    put(put(buf, &h, sizeof(h)), &bytes, sizeof(U64));
+    array_push(chunks, ((String){ .data=cast(Char*, buf), .count=size }));
+}
+
+Bool blog_start_cfg (Mem *mem, LogSinkConfig *config) {
+    Int fd = fs_open_new(config->path);
+    if (fd < 0) return false;
+
+    BlogFileHeader header = { .version=BLOG_VERSION };
+    memcpy(header.magic, BLOG_MAGIC, 8);
+    String chunk = { .data=cast(Char*, &header), .count=sizeof(header) };
+
+    if (! fs_write_chunks(fd, (SliceString){ .data=&chunk, .count=1 })) {
+        fs_close(fd);
+        return false;
+    }
+
+    // Each session gets a new number so that the sites register
+    // again and their records make it into the new file.
+    blog_next_id = 0;
+    if (! ++blog_last_session) blog_last_session = 1;
+
+    sink_new(mem, SINK_BINARY, fd, config);
+    atomic_store(&blog_session, blog_last_session);
+    return true;
+}
+
+// Other threads must be done logging by now.
+Void blog_stop () {
+    atomic_store(&blog_session, 0);
+    sink_destroy(SINK_BINARY);
+}
+
+// =============================================================================
+// Binary Log Decoder:
+// =============================================================================
+istruct (BlogReader) {
+    U8 *p;
+    U8 *end;
+    Bool error;
+};
+
+istruct (BlogDecodedSite) {
+    Bool defined;
+    LogMsgTag tag;
+    U8 arg_count;
+    U8 arg_types[BLOG_MAX_ARGS];
+    U32 line;
+    String user_tag;
+    String file;
+    String fmt;
+};
+
+istruct (BlogDecodedEvent) {
+    BlogRecord header;
+    U8 *payload;
+    U8 *end;
+};
+
+array_typedef(BlogDecodedSite, BlogDecodedSite);
+array_typedef(BlogDecodedEvent, BlogDecodedEvent);
+
+static Void get (BlogReader *r, Void *out, U64 count) {
+    if (r->error || count > cast(U64, r->end - r->p)) { r->error = true; memset(out, 0, count); return; }
+    memcpy(out, r->p, count);
+    r->p += count;
+}
+
+static String get_str (BlogReader *r) {
+    U32 count = 0;
+    get(r, &count, sizeof(U32));
+    if (r->error || count > cast(U64, r->end - r->p)) { r->error = true; return (String){}; }
+    String s = { .data=cast(Char*, r->p), .count=count };
+    r->p += count;
+    return s;
+}
+
+static Int cmp_events (Void *a, Void *b) {
+    BlogDecodedEvent *x = a;
+    BlogDecodedEvent *y = b;
+    if (x->header.time != y->header.time) return (x->header.time < y->header.time) ? -1 : 1;
+    return (x->payload < y->payload) ? -1 : (x->payload > y->payload) ? 1 : 0;
+}
+
+// Formats one event with the format of its site. Each conversion
+// is handed to printf on its own, with the length modifier of the
+// site replaced by one that matches the 64 bit arg.
+static Void format_event (AString *out, BlogDecodedSite *site, BlogReader *r) {
+    String fmt = site->fmt;
+    U32 arg    = 0;
+
+    for (U64 i = 0; i < fmt.count;) {
+        Char c = array_get(&fmt, i++);
+
+        if (c != '%') { astr_push_byte(out, c); continue; }
+        if (i < fmt.count && array_get(&fmt, i) == '%') { astr_push_byte(out, '%'); i++; continue; }
+
+        // The flags and width are kept as they are. The precision
+        // is parsed out since a %s gets its own from the string.
+        Char spec[48] = "%";
+        U32 n         = 1;
+        Int precision = -1;
+
+        while (i < fmt.count && n < 24 && strchr("-+ #0123456789", array_get(&fmt, i))) spec[n++] = array_get(&fmt, i++);
+
+        if (i < fmt.count && array_get(&fmt, i) == '.') {
+            precision = 0;
+            for (i++; i < fmt.count && array_get(&fmt, i) >= '0' && array_get(&fmt, i) <= '9'; i++) {
+                precision = min(10*precision + (array_get(&fmt, i) - '0'), 9999);
+            }
+        }
+
+        while (i < fmt.count && strchr("hljztL", array_get(&fmt, i))) i++;
+        Char conv = (i < fmt.count) ? array_get(&fmt, i++) : 0;
+
+        if (!conv || arg >= site->arg_count) { astr_push_cstr(out, "<?>"); continue; }
+        BlogArgType type = site->arg_types[arg++];
+
+        if (type == BLOG_STR) {
+            String s  = get_str(r);
+            Int count = cast(Int, (precision >= 0) ? min(cast(U64, precision), s.count) : s.count);
+            if (conv == 's') { memcpy(spec + n, ".*s", 4); astr_push_fmt(out, spec, count, s.data); }
+            else astr_push_fmt(out, "%.*s", STR(s));
+            continue;
+        }
+
+        if (precision >= 0) n += snprintf(spec + n, sizeof(spec) - n, ".%i", precision);
+
+        U64 v = 0;
+        get(r, &v, 8);
+        F64 f = (type == BLOG_F64) ? *cast(F64*, &v) : (type == BLOG_I64) ? cast(F64, cast(I64, v)) : cast(F64, v);
+        I64 iv = (type == BLOG_F64) ? cast(I64, f) : cast(I64, v);
+
+        switch (conv) {
+        case 'd': case 'i':
+            spec[n++] = 'l'; spec[n++] = conv;
+            astr_push_fmt(out, spec, iv);
+            break;
+        case 'u': case 'x': case 'X': case 'o':
+            spec[n++] = 'l'; spec[n++] = conv;
+            astr_push_fmt(out, spec, cast(U64, iv));
+            break;
+        case 'c':
+            spec[n++] = conv;
+            astr_push_fmt(out, spec, cast(Int, iv));
+            break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+            spec[n++] = conv;
+            astr_push_fmt(out, spec, f);
+            break;
+        case 'p':
+            astr_push_fmt(out, "0x%lx", v);
+            break;
+        default:
+            astr_push_cstr(out, "<?>");
+            break;
+        }
+    }
+
+    if (r->error) astr_push_cstr(out, " <corrupt>");
+}
+
+// Events are merged by timestamp since the writer appends the
+// rings of the threads in whatever order it drains them. Sites
+// are collected first since an event can be written before the
+// site record from another thread.
+Bool blog_decode (String path, AString *out) {
+    tmem_new(tm);
+
+    String file = fs_map_file(path, FS_ACCESS_SEQUENTIAL, FS_MAP_PREFETCH);
+    if (! file.data) return false;
+
+    BlogReader r = { .p=cast(U8*, file.data), .end=cast(U8*, file.data + file.count) };
+    BlogFileHeader header;
+    get(&r, &header, sizeof(header));
+
+    if (r.error || memcmp(header.magic, BLOG_MAGIC, 8) || header.version != BLOG_VERSION) {
+        fs_unmap_file(file);
+        return false;
+    }
+
+    ArrayBlogDecodedSite sites;
+    ArrayBlogDecodedEvent events;
+    array_init(&sites, tm);
+    array_init(&events, tm);
+
+    while (r.p < r.end) {
+        BlogRecord h;
+        U8 *start = r.p;
+        get(&r, &h, sizeof(h));
+        if (r.error || h.size < sizeof(h) || h.size > cast(U64, r.end - start)) break;
+
+        BlogReader payload = { .p=r.p, .end=(start + h.size) };
+        r.p = start + h.size;
+
+        if (h.kind == BLOG_SITE) {
+            BlogDecodedSite site = { .defined=true };
+            U8 tag = 0;
+            get(&payload, &tag, 1);
+            get(&payload, &site.arg_count, 1);
+            site.tag = tag;
+            if (tag >= LOG_TAG_COUNT || site.arg_count > BLOG_MAX_ARGS) continue;
+            get(&payload, site.arg_types, site.arg_count);
+            get(&payload, &site.line, sizeof(U32));
+            site.user_tag = get_str(&payload);
+            site.file     = get_str(&payload);
+            site.fmt      = get_str(&payload);
+            if (payload.error) continue;
+
+            // Site ids are dense, so an id can't be bigger than the
+            // count of site records that fit into the file.
+            if (h.site >= file.count / sizeof(BlogRecord)) continue;
+            if (h.site >= sites.count) array_ensure_count(&sites, h.site + 1, true);
+            array_set(&sites, h.site, site);
+        } else {
+            array_push_lit(&events, .header=h, .payload=payload.p, .end=payload.end);
+        }
+    }
+
+    array_sort_cmp(&events, cmp_events);
+
+    array_iter (e, &events, *) {
+        BlogReader payload = { .p=e->payload, .end=e->end };
+        push_stamp(out, e->header.time, e->header.thread);
+
+        if (e->header.kind == BLOG_DROPPED) {
+            U64 bytes = 0;
+            get(&payload, &bytes, sizeof(U64));
+            astr_push_fmt(out, "[log] Dropped %lu bytes of output.\n", bytes);
+            continue;
+        }
+
+        BlogDecodedSite *site = (e->header.site < sites.count) ? array_ref(&sites, e->header.site) : 0;
+
+        if (!site || !site->defined) {
+            astr_push_fmt(out, "<unknown site %u>\n", e->header.site);
+            continue;
+        }
+
+        push_msg_header(out, site->tag, site->user_tag);
+        format_event(out, site, &payload);
+        astr_push_byte(out, '\n');
+    }
+
+    fs_unmap_file(file);
+    return true;
+}
+
 // =============================================================================
 // SrcLog:
 // =============================================================================
@@ -179,13 +883,6 @@ SrcLogConfig *slog_default_config = &(SrcLogConfig){
     .marked_text_ansi            = TERM_START_RED,
 };
 
-istruct (LineIter) {
-    Char *eof;
-    String src;
-    String line;
-    U64 line_num;
-};
-
 // If (pos.length == 0), it is normal text, else it
 // is highlighted and belongs to the given position.
 istruct (LineSegment) {
@@ -201,17 +898,27 @@ istruct (Line) {
     Array(LineSegment) segments;
 };
 
-// Array of non-overlapping SrcPos in the same Src.
-// We keep it sorted by SrcPos.offset.
+// Array of non-overlapping SrcPos in the same Src
+// sorted by SrcPos.offset.
 istruct (PosGroup) {
     Array(SrcPos) positions;
 };
 
+// The positions are added in any order and only grouped
+// at flush time when they can be sorted in one go.
 istruct (Src) {
     String header;
     String content;
     Bool has_eol_mark;
+    Array(SrcPos) positions;
     Array(PosGroup*) groups;
+    Array(U64) line_starts; // Offset of each line. Built on the first flush.
+};
+
+istruct (LineIter) {
+    Src *src;
+    String line;
+    U64 line_num;
 };
 
 istruct (SrcLog) {
@@ -221,46 +928,54 @@ istruct (SrcLog) {
     Map(SrcId, Src*) sources;
 };
 
-static Char *get_line_start (Char *cursor, Char *stop_at) {
-    while ((cursor != stop_at) && (*(cursor - 1) != '\n')) cursor--;
-    return cursor;
+// Scanning for newlines with memchr uses the vectorized
+// routine of the libc, so this is one fast pass per source.
+// A source that ends with a newline gets an empty last line
+// which is only shown if a position points at it.
+static Void build_line_table (Src *src) {
+    String content = src->content;
+    Char *end      = content.data + content.count;
+
+    array_push(&src->line_starts, 0);
+    for (Char *p = content.data; (p < end) && (p = memchr(p, '\n', end - p)); p++) {
+        array_push(&src->line_starts, cast(U64, p + 1 - content.data));
+    }
+}
+
+// Returns the 0-indexed line that contains the offset.
+static U64 line_of_offset (Src *src, U64 offset) {
+    U64 lo = 0;
+    U64 hi = src->line_starts.count;
+
+    while (lo < hi) {
+        U64 mid = lo + (hi - lo)/2;
+        if (array_get(&src->line_starts, mid) <= offset) lo = mid + 1;
+        else hi = mid;
+    }
+
+    return lo - 1;
 }
 
-static Char *get_line_end (Char *cursor, Char *stop_at) {
-    while ((cursor != stop_at) && (*cursor++ != '\n'));
-    return cursor;
+// Line numbers are 1-indexed.
+static LineIter line_iter_new (Src *src, U64 line_num) {
+    U64 start = array_get(&src->line_starts, line_num - 1);
+    U64 end   = (line_num < src->line_starts.count) ? array_get(&src->line_starts, line_num) : src->content.count;
+    return (LineIter){ .src=src, .line_num=line_num, .line=str_slice(src->content, start, end - start) };
 }
 
 static Bool lit_next (LineIter *lit) {
-    Char *start = lit->line.data + lit->line.count;
-    if (start == lit->eof) return false;
-    lit->line.data = start;
-    lit->line.count = get_line_end(start, lit->eof) - start;
-    lit->line_num++;
+    if (lit->line_num >= lit->src->line_starts.count) return false;
+    if (array_get(&lit->src->line_starts, lit->line_num) == lit->src->content.count) return false;
+    *lit = line_iter_new(lit->src, lit->line_num + 1);
     return true;
 }
 
 static Bool lit_prev (LineIter *lit) {
-    Char *cursor = lit->line.data;
-    if (cursor == lit->src.data) return false;
-    cursor = get_line_start(cursor - 1, lit->src.data);
-    lit->line.count = lit->line.data - cursor;
-    lit->line.data = cursor;
-    lit->line_num--;
+    if (lit->line_num == 1) return false;
+    *lit = line_iter_new(lit->src, lit->line_num - 1);
     return true;
 }
 
-static LineIter line_iter_new (String src, SrcPos pos) {
-    LineIter lit     = {};
-    Char *first_byte = src.data + pos.offset;
-    lit.src          = src;
-    lit.eof          = src.data + src.count;
-    lit.line_num     = pos.first_line;
-    lit.line.data    = get_line_start(first_byte, src.data);
-    lit.line.count   = get_line_end(first_byte, lit.eof) - lit.line.data;
-    return lit;
-}
-
 SrcLog *slog_new (Mem *mem, SrcLogConfig *config) {
     SrcLog *log = mem_new(mem, SrcLog);
     log->mem    = mem;
@@ -275,7 +990,9 @@ Void slog_add_src (SrcLog *log, SrcId id, String header, String content) {
         Src *src = mem_new(log->mem, Src);
         src->header = header;
         src->content = content;
+        array_init(&src->positions, log->mem);
         array_init(&src->groups, log->mem);
+        array_init(&src->line_starts, log->mem);
         map_add(&log->sources, id, src);
     }
 }
@@ -305,7 +1022,7 @@ static Void parse_lines (SrcLog *log, Src *src, PosGroup *group) {
     log->lines.count = 0;
 
     SrcPos first_pos = array_get(&group->positions, 0);
-    LineIter lit = line_iter_new(src->content, first_pos);
+    LineIter lit = line_iter_new(src, first_pos.first_line);
 
     for (U64 i = 0; i < log->config.max_lines_above_first_pos; ++i) {
         if (! lit_prev(&lit)) break;
@@ -321,7 +1038,7 @@ static Void parse_lines (SrcLog *log, Src *src, PosGroup *group) {
 
         if ((pos.first_line - lit.line_num) > log->config.max_lines_between_positions) {
             add_line(log, &lit)->ends_with_ellipsis = true;
-            while ((lit.line_num < pos.first_line) && lit_next(&lit));
+            lit = line_iter_new(src, pos.first_line);
         } else {
             while (lit.line_num < pos.first_line) {
                 add_line(log, &lit);
@@ -352,7 +1069,7 @@ static Void parse_lines (SrcLog *log, Src *src, PosGroup *group) {
             }
 
             Line *last_line = add_line(log, &lit);
-            Char *last_byte = lit.src.data + pos.offset + pos.length;
+            Char *last_byte = src->content.data + pos.offset + pos.length;
             add_segment(pos, last_line, 0, last_byte - lit.line.data);
         }
     }
@@ -377,35 +1094,66 @@ static Void parse_lines (SrcLog *log, Src *src, PosGroup *group) {
 
 Void slog_add_pos (SrcLog *log, SrcId id, SrcPos new_pos) {
     Src *src = map_get_assert(&log->sources, id);
-    U64 new_pos_end = new_pos.offset + new_pos.length - 1;
-
     assert_dbg(new_pos.offset <= src->content.count);
     assert_dbg(new_pos.length > 0 || new_pos.offset == src->content.count);
+    array_push(&src->positions, new_pos);
+}
+
+static Int cmp_positions (Void *a, Void *b) {
+    SrcPos *x = a;
+    SrcPos *y = b;
+    if (x->offset != y->offset) return (x->offset < y->offset) ? -1 : 1;
+    return (x->length < y->length) ? -1 : (x->length > y->length) ? 1 : 0;
+}
+
+// Sorts the positions by offset and puts each one into the
+// first group where it doesn't overlap the previous position.
+// Since the positions are sorted, it's enough to keep the end
+// of the last position of each group.
+static Void group_positions (SrcLog *log, Src *src) {
+    tmem_new(tm);
+
+    if (! src->line_starts.count) build_line_table(src);
+
+    array_iter (pos, &src->positions, *) {
+        if (pos->first_line) continue;
+        U64 last_byte   = pos->length ? (pos->offset + pos->length - 1) : pos->offset;
+        pos->first_line = line_of_offset(src, pos->offset) + 1;
+        pos->last_line  = line_of_offset(src, last_byte) + 1;
+    }
+
+    array_sort_cmp(&src->positions, cmp_positions);
+
+    Array(U64) ends; // Of the last position in each group.
+    array_init(&ends, tm);
+    array_iter (group, &src->groups) group->positions.count = 0;
+
+    array_iter (pos, &src->positions) {
+        U64 idx = array_find(&ends, IT <= pos.offset);
 
-    array_iter (group, &src->groups) {
-        array_iter (old_pos, &group->positions) {
-            U64 old_pos_end = old_pos.offset + old_pos.length - 1;
-            if (old_pos_end < new_pos.offset) continue;
-            if (old_pos.offset <= new_pos_end) goto continue_outer;
-            array_insert(&group->positions, new_pos, ARRAY_IDX);
-            return;
+        if (idx == ARRAY_NIL_IDX) {
+            idx = ends.count;
+            array_push(&ends, 0);
+
+            if (idx == src->groups.count) {
+                PosGroup *group = mem_new(log->mem, PosGroup);
+                array_init(&group->positions, log->mem);
+                array_push(&src->groups, group);
+            }
         }
 
-        array_push(&group->positions, new_pos);
-        return;
-        continue_outer:;
+        array_set(&ends, idx, pos.offset + pos.length);
+        array_push(&array_get(&src->groups, idx)->positions, pos);
     }
 
-    PosGroup *group = mem_new(log->mem, PosGroup);
-    array_init(&group->positions, log->mem);
-    array_push(&group->positions, new_pos);
-    array_push(&src->groups, group);
+    src->groups.count = ends.count;
 }
 
 Void slog_flush (SrcLog *log, AString *astr) {
     map_iter (entry, &log->sources) {
         Src *src = entry->val;
-        if (src->groups.count == 0) continue;
+        if (src->positions.count == 0) continue;
+        group_positions(log, src);
 
         astr_push_fmt(astr, "%*s%sFILE" TERM_END ": %.*s\n\n", cast(Int,log->config.left_margin), "", log->config.marked_text_ansi, STR(src->header));
 
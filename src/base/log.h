@@ -35,7 +35,9 @@
 // When pushing a message you can choose whether you want
 // to be able to iterate over the parsed form later on.
 //
-// Init the log system per thread via log_setup().
+// Init the log system per thread via log_setup(). The state is
+// reached through the thread local log_data pointer, so a fiber
+// scheduler can give each fiber its own log (see tpool.c).
 //
 // Usage example:
 // --------------
@@ -70,10 +72,10 @@
 //
 // =============================================================================
 #define EACH_LOG_MSG(X)\
-    X(LOG_PLAIN, BLACK, "")\
-    X(LOG_NOTE, GREEN, "NOTE")\
-    X(LOG_ERROR, RED, "ERROR")\
-    X(LOG_WARNING, YELLOW, "WARNING")
+    X(LOG_PLAIN, BLACK, "", LOG_LEVEL_ERROR)\
+    X(LOG_NOTE, GREEN, "NOTE", LOG_LEVEL_NOTE)\
+    X(LOG_ERROR, RED, "ERROR", LOG_LEVEL_ERROR)\
+    X(LOG_WARNING, YELLOW, "WARNING", LOG_LEVEL_WARNING)
 
 ienum (LogMsgTag, U8) {
     #define X(TAG, ...) TAG,
@@ -82,6 +84,41 @@ ienum (LogMsgTag, U8) {
     LOG_TAG_COUNT,
 };
 
+// Messages below LOG_MIN_LEVEL are compiled out of the
+// macros log_msg_fmt, log_msg_fmt_limited and blog. The
+// arguments of such a message are not evaluated. Plain
+// messages count as errors so they are always kept.
+//
+// The level can be set for the whole build with -D or for
+// one module by redefining it after the includes:
+//
+//     #undef  LOG_MIN_LEVEL
+//     #define LOG_MIN_LEVEL LOG_LEVEL_WARNING
+//
+// Note that compiled out messages are not counted in
+// LogScope.count either.
+ienum (LogLevel, U8) {
+    LOG_LEVEL_NOTE,
+    LOG_LEVEL_WARNING,
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_NONE,
+};
+
+#ifndef LOG_MIN_LEVEL
+    #define LOG_MIN_LEVEL LOG_LEVEL_NOTE
+#endif
+
+inl LogLevel log_tag_level (LogMsgTag tag) {
+    switch (tag) {
+    #define X(TAG, _, __, LEVEL) case TAG: return LEVEL;
+        EACH_LOG_MSG(X)
+    #undef X
+    default: return LOG_LEVEL_ERROR;
+    }
+}
+
+#define log_enabled(T) (log_tag_level(T) >= LOG_MIN_LEVEL)
+
 istruct (LogMsg) {
     LogMsgTag tag;
     U64 data_offset;
@@ -113,15 +150,205 @@ extern CString  log_tag_ansi [LOG_TAG_COUNT];
 
 #define log_scope(N, F)           cleanup(log_scope_end) LogScope *N = log_scope_start(F);
 #define log_msg(N, T, U, I)       cleanup(log_msg_end)   AString  *N = log_msg_start(T, U, I);
-#define log_msg_fmt(T, U, I, ...) ({ log_msg(_(N), T, U, I); astr_push_fmt(_(N), __VA_ARGS__); astr_push_byte(_(N), '\n'); })
+#define log_msg_fmt(T, U, I, ...) ({ if (log_enabled(T)) { log_msg(_(N), T, U, I); astr_push_fmt(_(N), __VA_ARGS__); astr_push_byte(_(N), '\n'); } })
 
 Void      log_setup         (Mem *, U64);
+Void      log_teardown      ();
 LogScope *log_scope_start   (Bool);
 Void      log_scope_end     (LogScope **);
 Void      log_scope_end_all ();
 AString  *log_msg_start     (LogMsgTag, CString, Bool);
 Void      log_msg_end       (AString **);
 
+// For messages on hot paths that can fire over and over, like
+// a glyph that fails to render on each frame. Each call site
+// lets through LOG_LIMIT_BURST messages per LOG_LIMIT_PERIOD_MS
+// and drops the rest. The count of dropped messages is appended
+// to the next message that gets through. The limit is shared by
+// all threads and only approximate under contention.
+#define LOG_LIMIT_BURST     4
+#define LOG_LIMIT_PERIOD_MS 1000
+
+istruct (LogLimit) {
+    U64 period_start; // In ms.
+    U32 count;        // In the current period.
+    U32 suppressed;
+};
+
+Bool log_limit (LogLimit *, U32 *out_suppressed); // Returns false if the message should be dropped.
+
+#define log_msg_fmt_limited(T, U, I, ...) ({\
+    if (log_enabled(T)) {\
+        static LogLimit _(limit);\
+        U32 _(suppressed);\
+        if (log_limit(&_(limit), &_(suppressed))) {\
+            log_msg(_(N), T, U, I);\
+            astr_push_fmt(_(N), __VA_ARGS__);\
+            if (_(suppressed)) astr_push_fmt(_(N), " [%u similar messages suppressed]", _(suppressed));\
+            astr_push_byte(_(N), '\n');\
+        }\
+    }\
+})
+
+// =============================================================================
+// Log Sink:
+// ---------
+//
+// Without a sink, a closing scope prints its messages to stdout
+// on the calling thread. After log_sink_start_ex the output goes
+// into a lock-free byte ring (base/spsc.h) owned by the calling
+// os thread instead, and a writer thread drains the rings of all
+// threads into stdout or a file with batched writev calls. So a
+// thread that logs never waits on the terminal, and the output of
+// one scope is never interleaved with the output of other threads.
+//
+// Tagged messages get a prefix with the time since the sink was
+// started and the index of the thread that logged them:
+//
+//     [  1.204518 T3] ERROR(Glyph cache): Couldn't read font file.
+//
+// If a ring is full the output is either dropped (the writer then
+// reports how many bytes were lost) or the thread waits for the
+// writer, depending on LogSinkConfig.block. The ring belongs to
+// the os thread, so fibers running on a worker share its ring.
+//
+// Threads created with os_thread_new detach from the sink when
+// they exit. log_scope_end_all waits until the output of the
+// calling thread is written, since it's used on fatal paths.
+//
+// Usage example:
+// --------------
+//
+//     log_sink_start_ex(mem_root, .path=str("mykron.log"), .block=true);
+//     ...
+//     log_sink_stop(); // Writes everything that's left.
+//
+// =============================================================================
+istruct (LogSinkConfig) {
+    String path;    // Appended to. Empty means stdout.
+    U64 ring_size;  // Per thread. 0 means 64*KB.
+    Bool block;     // Wait instead of dropping output when the ring is full.
+    Bool no_stamp;  // Don't prefix messages with the time and thread.
+};
+
+#define log_sink_start_ex(MEM, ...) log_sink_start_cfg(MEM, &(LogSinkConfig){ __VA_ARGS__ })
+
+Bool log_sink_start_cfg (Mem *, LogSinkConfig *); // Returns false if the file can't be opened. Mem must be thread safe.
+Void log_sink_stop      ();
+Void log_sink_flush     (); // Waits until the output of the calling thread is written.
+Void log_sink_detach    (); // Called by a thread before it exits.
+U64  log_sink_dropped   (); // Bytes dropped so far.
+
+// =============================================================================
+// Binary Log:
+// -----------
+//
+// A log for tracing hot code like the frame loop. The blog macro
+// doesn't format anything. Each call site owns a static BlogSite
+// with the format string, file, line and argument types, and it
+// is written to the log once per session. After that, an event is
+// a small header (site id, time, thread) plus the raw arguments,
+// memcpy'd into the byte ring of the calling thread. The rings
+// are drained by a writer thread the same way as the text sink.
+//
+// Formatting happens offline with the decoder which merges the
+// events of all threads by their timestamp:
+//
+//     mykron.bin -blog-decode mykron.blog
+//
+// While the binary log is stopped, blog costs one relaxed load.
+//
+// The format string is the printf one with a few limits:
+//
+//     - Integer arguments are widened to 64 bits, so the length
+//       modifiers in the format are ignored.
+//     - A %s takes a String or a CString (not STR(x)). Only the
+//       bytes of the string are copied into the log.
+//     - There are no '*' widths and precisions.
+//     - At most BLOG_MAX_ARGS arguments.
+//
+// Usage example:
+// --------------
+//
+//     blog_start_ex(mem_root, .path=str("mykron.blog"));
+//     blog(LOG_NOTE, "Frame", "frame=%lu dt=%.3f font=%s", frame, dt, font_name);
+//     blog_stop();
+//
+// =============================================================================
+#define BLOG_MAGIC    "MYKBLOG\0"
+#define BLOG_VERSION  1
+#define BLOG_MAX_ARGS 16
+
+ienum (BlogArgType, U8) {
+    BLOG_I64,
+    BLOG_U64,
+    BLOG_F64,
+    BLOG_STR,
+};
+
+istruct (BlogArg) {
+    U64 a; // The value or the string data pointer.
+    U64 b; // The string count.
+};
+
+istruct (BlogSite) {
+    CString fmt;
+    CString file;
+    CString user_tag;
+    U32 line;
+    LogMsgTag tag;
+    U8 arg_count;
+    U8 arg_types[BLOG_MAX_ARGS];
+    U32 id;      // Assigned when the site is written to the log.
+    U32 session; // The blog_session in which the site was written.
+};
+
+extern U32 blog_session; // 0 while the binary log is stopped.
+
+inl BlogArg blog_arg_i64  (I64 v)     { return (BlogArg){ .a=cast(U64, v) }; }
+inl BlogArg blog_arg_u64  (U64 v)     { return (BlogArg){ .a=v }; }
+inl BlogArg blog_arg_f64  (F64 v)     { BlogArg a = {}; memcpy(&a.a, &v, sizeof(F64)); return a; }
+inl BlogArg blog_arg_str  (String v)  { return (BlogArg){ .a=cast(U64, v.data), .b=v.count }; }
+inl BlogArg blog_arg_cstr (CString v) { return (BlogArg){ .a=cast(U64, v), .b=(v ? strlen(v) : 0) }; }
+
+#define blog_type_(_, X) _Generic((X),\
+    I8: BLOG_I64, I16: BLOG_I64, I32: BLOG_I64, I64: BLOG_I64,\
+    U8: BLOG_U64, U16: BLOG_U64, U32: BLOG_U64, U64: BLOG_U64, Bool: BLOG_U64,\
+    F32: BLOG_F64, F64: BLOG_F64,\
+    String: BLOG_STR, CString: BLOG_STR\
+),
+
+#define blog_arg_(_, X) _Generic((X),\
+    I8: blog_arg_i64, I16: blog_arg_i64, I32: blog_arg_i64, I64: blog_arg_i64,\
+    U8: blog_arg_u64, U16: blog_arg_u64, U32: blog_arg_u64, U64: blog_arg_u64, Bool: blog_arg_u64,\
+    F32: blog_arg_f64, F64: blog_arg_f64,\
+    String: blog_arg_str, CString: blog_arg_cstr\
+)(X),
+
+#define blog(TAG, USER_TAG, FMT, ...) ({\
+    static BlogSite _(site) = {\
+        .fmt       = FMT,\
+        .file      = __FILE__,\
+        .user_tag  = USER_TAG,\
+        .line      = __LINE__,\
+        .tag       = TAG,\
+        .arg_count = sizeof((U8[]){ 0, FOR_EACH(blog_type_, , __VA_ARGS__) }) - 1,\
+        .arg_types = { FOR_EACH(blog_type_, , __VA_ARGS__) },\
+    };\
+    static_assert(sizeof((U8[]){ 0, FOR_EACH(blog_type_, , __VA_ARGS__) }) - 1 <= BLOG_MAX_ARGS);\
+    if (log_enabled(TAG) && atomic_load_relaxed(&blog_session)) {\
+        BlogArg _(args)[] = { {}, FOR_EACH(blog_arg_, , __VA_ARGS__) };\
+        blog_write(&_(site), _(args) + 1);\
+    }\
+})
+
+#define blog_start_ex(MEM, ...) blog_start_cfg(MEM, &(LogSinkConfig){ __VA_ARGS__ })
+
+Bool blog_start_cfg (Mem *, LogSinkConfig *); // The path is required and the file is truncated. Returns false if it can't be opened.
+Void blog_stop      ();
+Void blog_write     (BlogSite *, BlogArg *);
+Bool blog_decode    (String path, AString *out); // Returns false if the file is missing or not a binary log.
+
 // =============================================================================
 // SrcLog:
 // -------
@@ -130,6 +357,12 @@ Void      log_msg_end       (AString **);
 // source code. It is organized into sources which contain
 // positions (or slices) into that source.
 //
+// Positions can be added in any order. On flush, each source
+// gets a table of line starts (built once), the positions are
+// sorted and split into groups of non-overlapping positions,
+// and lines are looked up in the table with a binary search.
+// So reporting many positions against a big file is cheap.
+//
 // Usage example:
 // --------------
 //
@@ -163,7 +396,7 @@ istruct (SrcLog);
 istruct (SrcPos) {
     U64 offset;     // In bytes.
     U64 length;     // In bytes.
-    U64 first_line; // 1-indexed.
+    U64 first_line; // 1-indexed. If 0, both lines are computed from the offset.
     U64 last_line;  // 1-indexed.
 };
 
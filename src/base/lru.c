@@ -0,0 +1,204 @@
+#include "base/lru.h"
+
+#define SENTINEL(L) ((L)->schema.max_entries)
+
+static ULruEntry *entry_of (ULru *lru, U32 n) { return &lru->entries[n * lru->schema.entry_size]; }
+static UMapKey   *key_of   (ULru *lru, U32 n) { return cast(U8*, entry_of(lru, n)) + lru->schema.key_offset; }
+
+// Returns the index slot that holds the key or the
+// empty slot where the key would be inserted.
+static U32 *find (ULru *lru, UMapKey *key, UMapHash hash) {
+    U64 idx = hash & lru->index_mask;
+
+    while (true) {
+        U32 *slot = &lru->index[idx];
+        if (*slot == 0) return slot;
+        if ((lru->nodes[*slot - 1].hash == hash) && lru->schema.cmp(key, key_of(lru, *slot - 1))) return slot;
+        idx = (idx + 1) & lru->index_mask;
+    }
+}
+
+// Backward shift deletion: move later entries of the probe
+// sequence into the hole so that no tombstones are needed.
+static Void index_remove (ULru *lru, U32 *slot) {
+    U64 mask = lru->index_mask;
+    U64 hole = slot - lru->index;
+    U64 idx  = hole;
+
+    while (true) {
+        idx = (idx + 1) & mask;
+        U32 n = lru->index[idx];
+        if (n == 0) break;
+
+        U64 home = lru->nodes[n - 1].hash & mask;
+        Bool stays = (hole <= idx) ? ((hole < home) && (home <= idx)) : ((hole < home) || (home <= idx));
+        if (stays) continue;
+
+        lru->index[hole] = n;
+        hole = idx;
+    }
+
+    lru->index[hole] = 0;
+}
+
+static Void list_unlink (ULru *lru, U32 n) {
+    ULruNode *node = &lru->nodes[n];
+    lru->nodes[node->prev].next = node->next;
+    lru->nodes[node->next].prev = node->prev;
+}
+
+static Void list_push_front (ULru *lru, U32 n) {
+    ULruNode *node     = &lru->nodes[n];
+    ULruNode *sentinel = &lru->nodes[SENTINEL(lru)];
+    node->prev = SENTINEL(lru);
+    node->next = sentinel->next;
+    lru->nodes[sentinel->next].prev = n;
+    sentinel->next = n;
+}
+
+static Void touch (ULru *lru, U32 n) {
+    if (lru->nodes[n].pins) return;
+    list_unlink(lru, n);
+    list_push_front(lru, n);
+}
+
+static Void remove_node (ULru *lru, U32 n) {
+    ULruNode *node = &lru->nodes[n];
+    if (lru->schema.on_evict) lru->schema.on_evict(entry_of(lru, n), lru->schema.ctx);
+    index_remove(lru, find(lru, key_of(lru, n), node->hash));
+    if (! node->pins) list_unlink(lru, n);
+    lru->bytes -= node->bytes;
+    lru->count--;
+    node->next = lru->free_list;
+    lru->free_list = n;
+}
+
+Void ulru_clear (ULru *lru) {
+    for (U64 i = 0; i <= lru->index_mask; ++i) {
+        U32 n = lru->index[i];
+        if (n && lru->schema.on_evict) lru->schema.on_evict(entry_of(lru, n - 1), lru->schema.ctx);
+    }
+
+    U32 max = lru->schema.max_entries;
+    memset(lru->index, 0, (lru->index_mask + 1) * sizeof(U32));
+    for (U32 i = 0; i < max; ++i) lru->nodes[i].next = i + 1;
+    lru->nodes[max].next = max;
+    lru->nodes[max].prev = max;
+    lru->free_list = 0;
+    lru->count = 0;
+    lru->bytes = 0;
+}
+
+ULruEntry *ulru_get (ULru *lru, UMapKey *key) {
+    U32 *slot = find(lru, key, lru->schema.hasher(key));
+
+    if (! *slot) {
+        lru->stats.misses++;
+        return 0;
+    }
+
+    lru->stats.hits++;
+    touch(lru, *slot - 1);
+    return entry_of(lru, *slot - 1);
+}
+
+// If the key is not found, the new entry is zeroed and the
+// caller must set the value. This will evict entries if the
+// count or byte limits would be exceeded. Returns 0 if the
+// cache is full and all entries are pinned.
+ULruEntry *ulru_add (ULru *lru, UMapKey *key, U64 bytes, Bool *out_found) {
+    UMapHash hash = lru->schema.hasher(key);
+    U32 *slot = find(lru, key, hash);
+    Bool found = *slot;
+    if (out_found) *out_found = found;
+
+    if (found) {
+        lru->stats.hits++;
+        touch(lru, *slot - 1);
+        return entry_of(lru, *slot - 1);
+    }
+
+    lru->stats.misses++;
+
+    U64 max_bytes = lru->schema.max_bytes;
+    while ((lru->count == lru->schema.max_entries) || (max_bytes && ((lru->bytes + bytes) > max_bytes))) {
+        U32 n = lru->nodes[SENTINEL(lru)].prev;
+        if (n == SENTINEL(lru)) break;
+        lru->stats.evictions++;
+        remove_node(lru, n);
+    }
+
+    if (lru->count == lru->schema.max_entries) return 0;
+
+    U32 n = lru->free_list;
+    lru->free_list = lru->nodes[n].next;
+    lru->nodes[n] = (ULruNode){ .hash=hash, .bytes=bytes };
+    list_push_front(lru, n);
+    lru->count++;
+    lru->bytes += bytes;
+
+    ULruEntry *entry = entry_of(lru, n);
+    memset(entry, 0, lru->schema.entry_size);
+    memcpy(key_of(lru, n), key, lru->schema.key_size);
+    *find(lru, key, hash) = n + 1; // Evictions could have shifted the slot.
+    return entry;
+}
+
+Bool ulru_remove (ULru *lru, UMapKey *key) {
+    U32 *slot = find(lru, key, lru->schema.hasher(key));
+    if (! *slot) return false;
+    remove_node(lru, *slot - 1);
+    return true;
+}
+
+// The matches are collected first since removing entries
+// shifts the index under the loop.
+U32 ulru_remove_if (ULru *lru, ULruPred pred, Void *ctx) {
+    tmem_new(tm);
+    ArrayU32 matches;
+    array_init(&matches, tm);
+
+    for (U64 i = 0; i <= lru->index_mask; ++i) {
+        U32 n = lru->index[i];
+        if (n && pred(entry_of(lru, n - 1), ctx)) array_push(&matches, n - 1);
+    }
+
+    array_iter (n, &matches) remove_node(lru, n);
+    return matches.count;
+}
+
+U32 ulru_idx (ULru *lru, ULruEntry *entry) {
+    return (cast(U8*, entry) - lru->entries) / lru->schema.entry_size;
+}
+
+Void ulru_pin (ULru *lru, ULruEntry *entry) {
+    U32 n = ulru_idx(lru, entry);
+    if (lru->nodes[n].pins++ == 0) list_unlink(lru, n);
+}
+
+Void ulru_unpin (ULru *lru, ULruEntry *entry) {
+    U32 n = ulru_idx(lru, entry);
+    assert_dbg(lru->nodes[n].pins);
+    if (--lru->nodes[n].pins == 0) list_push_front(lru, n);
+}
+
+Void ulru_init (ULru *lru, Mem *mem, ULruSchema schema) {
+    assert_always(schema.max_entries && (schema.max_entries < UINT32_MAX));
+    U64 index_cap   = next_pow2(2 * cast(U64, schema.max_entries));
+    lru->mem        = mem;
+    lru->schema     = schema;
+    lru->stats      = (ULruStats){};
+    lru->index_mask = index_cap - 1;
+    lru->index      = mem_alloc(mem, U32, .zeroed=true, .size=(index_cap * sizeof(U32)));
+    lru->entries    = mem_alloc(mem, U8, .size=(schema.max_entries * schema.entry_size));
+    lru->nodes      = mem_alloc(mem, ULruNode, .zeroed=true, .size=((schema.max_entries + 1) * sizeof(ULruNode)));
+    ulru_clear(lru);
+}
+
+Void ulru_destroy (ULru *lru) {
+    ulru_clear(lru);
+    U64 max = lru->schema.max_entries;
+    mem_free(lru->mem, .old_ptr=lru->index, .old_size=((lru->index_mask + 1) * sizeof(U32)));
+    mem_free(lru->mem, .old_ptr=lru->entries, .old_size=(max * lru->schema.entry_size));
+    mem_free(lru->mem, .old_ptr=lru->nodes, .old_size=((max + 1) * sizeof(ULruNode)));
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+// =============================================================================
+// Overview:
+// ---------
+//
+// A least-recently-used cache in the form of a low-level untyped
+// data structure (ULru) and a type-safe macro wrapper (Lru).
+//
+// All entries are allocated up front, so pointers to entries are
+// stable until the entry gets evicted. The ulru_idx() function
+// maps an entry to a stable index in [0, max_entries) which can
+// be used to address external resources (like atlas slots).
+//
+// Lookups go through an open addressing index (linear probing
+// with backward shift deletion, load factor <= 50%), and the
+// recency order is an intrusive doubly linked list. All ops are
+// O(1) except ulru_clear() and ulru_remove_if().
+//
+// The capacity is limited by entry count and optionally by the
+// sum of per entry byte costs. When adding an entry would exceed
+// a limit, the least recently used entries get evicted. Pinned
+// entries are never evicted. If everything is pinned and the
+// cache is full, then ulru_add() returns 0.
+//
+// The on_evict callback is called whenever an entry leaves the
+// cache (eviction, ulru_remove, ulru_clear, ulru_destroy).
+//
+// Usage example:
+// --------------
+//
+//     Lru(U64, Texture) textures;
+//     lru_init(&textures, mem, 256, .max_bytes=(64*MB), .on_evict=free_texture);
+//
+//     Bool found;
+//     Texture *tex = lru_add(&textures, id, width*height*4, &found);
+//     if (! found) load_texture(tex, id);
+//
+//     lru_pin(&textures, tex); // Won't be evicted while in use.
+//     lru_unpin(&textures, tex);
+//
+//     printf("hits=%lu misses=%lu\n", textures.ulru.stats.hits, textures.ulru.stats.misses);
+//
+// =============================================================================
+#include "base/core.h"
+#include "base/mem.h"
+#include "base/map.h"
+
+typedef Void ULruEntry;
+typedef Void (*ULruEvict) (ULruEntry *, Void *ctx);
+typedef Bool (*ULruPred)  (ULruEntry *, Void *ctx);
+
+istruct (ULruSchema) {
+    U16 entry_size;
+    U16 key_offset;
+    U16 key_size;
+    UMapCmp cmp;
+    UMapHasher hasher;
+    U32 max_entries;
+    U64 max_bytes; // 0 means no limit.
+    ULruEvict on_evict;
+    Void *ctx;
+};
+
+istruct (ULruStats) {
+    U64 hits;
+    U64 misses;
+    U64 evictions;
+};
+
+// Private.
+istruct (ULruNode) {
+    UMapHash hash;
+    U64 bytes;
+    U32 prev;
+    U32 next;
+    U32 pins;
+};
+
+istruct (ULru) {
+    Mem *mem;
+    U32 count;
+    U32 free_list;
+    U64 bytes;
+    U64 index_mask;
+    U32 *index; // 0 marks empty slots; otherwise node idx + 1.
+    U8 *entries;
+    ULruNode *nodes; // The node at idx max_entries is the list sentinel.
+    ULruStats stats;
+    ULruSchema schema;
+};
+
+Void       ulru_init      (ULru *, Mem *, ULruSchema);
+Void       ulru_destroy   (ULru *);
+Void       ulru_clear     (ULru *);
+ULruEntry *ulru_get       (ULru *, UMapKey *); // Returns 0 if not found.
+ULruEntry *ulru_add       (ULru *, UMapKey *, U64 bytes, Bool *out_found); // Caller sets value.
+Bool       ulru_remove    (ULru *, UMapKey *);
+U32        ulru_remove_if (ULru *, ULruPred, Void *ctx); // Returns the count removed. O(max_entries).
+Void       ulru_pin       (ULru *, ULruEntry *);
+Void       ulru_unpin     (ULru *, ULruEntry *);
+U32        ulru_idx       (ULru *, ULruEntry *);
+
+// =============================================================================
+// Type-safe wrapper around ULru:
+// ------------------------------
+//
+// Like with Map, the lru_init macro hardcodes some key types.
+// Use ulru_init directly for custom key types. The lru_get and
+// lru_add macros return pointers to values (or 0).
+//
+// =============================================================================
+#define Lru(K, V) union {\
+    ULru ulru;\
+    struct { K key; V val; } *E;\
+}
+
+#define LruEntry(L) Type(*(L)->E)
+#define LruKey(L)   Type((L)->E->key)
+#define LruVal(L)   Type((L)->E->val)
+
+#define lru_init(L, MEM, MAX_ENTRIES, ...)\
+    ulru_init(&(L)->ulru, mem_base(MEM), ((ULruSchema){\
+        .entry_size  = sizeof(LruEntry(L)),\
+        .key_size    = sizeof(LruKey(L)),\
+        .key_offset  = offsetof(LruEntry(L), key),\
+        .cmp         = typematch(LruKey(L), U32:map_cmp_u32,  U64:map_cmp_u64,  String:map_cmp_str,  CString:map_cmp_cstr,  IString*:map_cmp_istr),\
+        .hasher      = typematch(LruKey(L), U32:map_hash_u32, U64:map_hash_u64, String:map_hash_str, CString:map_hash_cstr, IString*:map_hash_istr),\
+        .max_entries = MAX_ENTRIES,\
+        __VA_ARGS__\
+    }))
+
+#define lru_val_(L, X)         ({ Auto _(e) = cast(LruEntry(L)*, X); _(e) ? &_(e)->val : 0; })
+#define lru_entry_(L, V)       cast(ULruEntry*, cast(U8*, V) - offsetof(LruEntry(L), val))
+#define lru_destroy(L)         ulru_destroy(&(L)->ulru)
+#define lru_clear(L)           ulru_clear(&(L)->ulru)
+#define lru_get(L, K)          ({ def2(l, k, L, acast(LruKey(L), K)); lru_val_(l, ulru_get(&l->ulru, &k)); })
+#define lru_add(L, K, B, O)    ({ def2(l, k, L, acast(LruKey(L), K)); lru_val_(l, ulru_add(&l->ulru, &k, B, O)); })
+#define lru_remove(L, K)       ({ def2(l, k, L, acast(LruKey(L), K)); ulru_remove(&l->ulru, &k); })
+#define lru_remove_if(L, P, C) ulru_remove_if(&(L)->ulru, P, C) // P gets a pointer to LruEntry(L).
+#define lru_pin(L, V)          ({ def1(l, L); ulru_pin(&l->ulru, lru_entry_(l, V)); })
+#define lru_unpin(L, V)        ({ def1(l, L); ulru_unpin(&l->ulru, lru_entry_(l, V)); })
+#define lru_idx(L, V)          ({ def1(l, L); ulru_idx(&l->ulru, lru_entry_(l, V)); })
+#define lru_key(L, V)          ({ def1(l, L); cast(LruEntry(l)*, lru_entry_(l, V))->key; })
@@ -184,12 +184,12 @@ Void *arena_op (Void *arena, MemOp op) {
 // =============================================================================
 // TMem:
 // =============================================================================
-tls TMemRing tmem_ring;
+tls TMemRing *tmem_ring;
 
 Void *tmem_op (Void *t, MemOp op) {
     assert_dbg(cast(TMem*, t)->slot_idx < 8);
     Auto tm        = cast(TMem*, t);
-    Arena *a       = &tmem_ring.slots[tm->slot_idx];
+    Arena *a       = &tmem_ring->slots[tm->slot_idx];
     U64 prev_count = a->total_count;
     Void *result   = arena_op(a, op);
     if (a->total_count > prev_count) tm->count += a->total_count - prev_count;
@@ -197,12 +197,26 @@ Void *tmem_op (Void *t, MemOp op) {
 }
 
 Void tmem_setup (Mem *mem, U64 min_size) {
-    tmem_ring.slot_idx = 7;
-    for (U64 i = 0; i < 8; ++i) arena_init(&tmem_ring.slots[i], mem, min_size / 8);
+    tmem_ring = mem_new(mem, TMemRing);
+    tmem_ring->slot_idx = 7;
+    for (U64 i = 0; i < 8; ++i) arena_init(&tmem_ring->slots[i], mem, min_size / 8);
+}
+
+Void tmem_teardown () {
+    Mem *mem = tmem_ring->slots[0].parent;
+
+    for (U64 i = 0; i < 8; ++i) {
+        Arena *a = &tmem_ring->slots[i];
+        arena_pop_all(a);
+        mem_free(a->parent, .old_ptr=a->block, .old_size=a->block->capacity);
+    }
+
+    mem_free(mem, .old_ptr=tmem_ring, .old_size=sizeof(TMemRing));
+    tmem_ring = 0;
 }
 
 Void tmem_start (TMem *tm) {
-    TMemRing *r = &tmem_ring;
+    TMemRing *r = tmem_ring;
     U8 slot_idx = ({ // Next unpinned slot or idx+1 if all slots pinned.
         U8 i = r->slot_idx + 1;
         U8 p = leading_one_bits(rotl8(r->pin_flags, i));
@@ -216,7 +230,7 @@ Void tmem_start (TMem *tm) {
 
 Void tmem_destroy (TMem *tm) {
     assert_dbg(tm->slot_idx < 8);
-    TMemRing *r  = &tmem_ring;
+    TMemRing *r  = tmem_ring;
     Arena *arena = &r->slots[tm->slot_idx];
     r->slot_idx  = (tm->slot_idx - 1) & 7;
     Bool on_top  = (tm->arena_pos + tm->count) == arena->total_count;
@@ -225,11 +239,11 @@ Void tmem_destroy (TMem *tm) {
 }
 
 U8 tmem_pin_push (Mem *m, Bool exclusive) {
-    U8 prev_pins = tmem_ring.pin_flags;
-    if (m->op == tmem_op) tmem_ring.pin_flags = (exclusive ? 0 : prev_pins) | (0x80 >> cast(TMem*, m)->slot_idx);
+    U8 prev_pins = tmem_ring->pin_flags;
+    if (m->op == tmem_op) tmem_ring->pin_flags = (exclusive ? 0 : prev_pins) | (0x80 >> cast(TMem*, m)->slot_idx);
     return prev_pins;
 }
 
 Void tmem_pin_pop (U8 *prev_flags) {
-    tmem_ring.pin_flags = *prev_flags;
+    tmem_ring->pin_flags = *prev_flags;
 }
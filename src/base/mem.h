@@ -113,7 +113,8 @@ Void   arena_pop_all (Arena *);
 //         printf("%.*s", STR(s));
 //     }
 //
-// Init the TMem system per thread using tmem_setup().
+// Init the TMem system per thread using tmem_setup() and
+// free it with tmem_teardown().
 //
 // Arena fragmentation, ring buffer and pinning:
 // ---------------------------------------------
@@ -149,6 +150,14 @@ Void   arena_pop_all (Arena *);
 //                           // Pins get reset at scope exit.
 //     }
 //
+// Fibers:
+// -------
+//
+// The ring is reached through the thread local tmem_ring pointer
+// rather than being a thread local itself. A fiber that can move
+// between threads owns a ring of its own, and the scheduler points
+// tmem_ring at it while the fiber runs (see tpool.c).
+//
 // =============================================================================
 istruct (TMem) {
     Mem base;
@@ -163,13 +172,14 @@ istruct (TMemRing) {
     Arena slots[8];
 };
 
-extern tls TMemRing tmem_ring;
+extern tls TMemRing *tmem_ring;
 
 #define tmem_new(N)      cleanup(tmem_destroy) TMem _##N; tmem_start(&_##N); Mem *N = cast(Mem*, &_##N);
 #define tmem_pin(M, ...) cleanup(tmem_pin_pop) U8 JOIN(_, __LINE__) = tmem_pin_push(M, __VA_ARGS__);
 
 Void *tmem_op       (Void *tmem, MemOp);
 Void  tmem_setup    (Mem *, U64 min_total_size);
+Void  tmem_teardown ();
 Void  tmem_start    (TMem *);
 Void  tmem_destroy  (TMem *);
 U8    tmem_pin_push (Mem *, Bool exclusive);
@@ -0,0 +1,79 @@
+#include "base/mpmc.h"
+
+// A cell is a sequence number followed by the element. A cell
+// at ring position p is ready to be written when seq == pos,
+// and ready to be read when seq == pos + 1, where pos is the
+// unbounded cursor value that maps to p.
+//
+// The element is published by the release store of the seq and
+// picked up by the acquire load of it. The cursor CAS stays
+// seq_cst since the tpool wake protocol relies on the order of
+// a push relative to its later sleepers check.
+static U64 *cell_seq  (UMpmc *q, U64 pos) { return cast(U64*, q->cells + (pos & q->mask) * q->cell_size); }
+static Void *cell_elem (UMpmc *q, U64 pos) { return cast(U8*, cell_seq(q, pos)) + sizeof(U64); }
+
+Void umpmc_init (UMpmc *q, Mem *mem, U64 capacity, U64 elem_size) {
+    U64 cap      = next_pow2(max(capacity, 2u));
+    q->mem       = mem;
+    q->mask      = cap - 1;
+    q->elem_size = elem_size;
+    q->cell_size = sizeof(U64) + elem_size + padding_to_align(elem_size, alignof(U64));
+    q->cells     = mem_alloc(mem, U8, .align=CACHE_LINE, .size=(cap * q->cell_size));
+    for (U64 i = 0; i < cap; ++i) *cell_seq(q, i) = i;
+    atomic_store(&q->enqueue_pos, 0);
+    atomic_store(&q->dequeue_pos, 0);
+}
+
+Void umpmc_destroy (UMpmc *q) {
+    mem_free(q->mem, .old_ptr=q->cells, .old_size=((q->mask + 1) * q->cell_size));
+}
+
+Bool umpmc_push (UMpmc *q, Void *elem) {
+    U64 pos = atomic_load_relaxed(&q->enqueue_pos);
+
+    while (true) {
+        I64 dif = cast(I64, atomic_load_acquire(cell_seq(q, pos)) - pos);
+
+        if (dif == 0) {
+            U64 old = atomic_cmp_exchange(&q->enqueue_pos, pos, pos + 1);
+            if (old == pos) break;
+            pos = old;
+        } else if (dif < 0) {
+            return false;
+        } else {
+            pos = atomic_load_relaxed(&q->enqueue_pos);
+        }
+    }
+
+    memcpy(cell_elem(q, pos), elem, q->elem_size);
+    atomic_store_release(cell_seq(q, pos), pos + 1);
+    return true;
+}
+
+Bool umpmc_pop (UMpmc *q, Void *out) {
+    U64 pos = atomic_load_relaxed(&q->dequeue_pos);
+
+    while (true) {
+        I64 dif = cast(I64, atomic_load_acquire(cell_seq(q, pos)) - (pos + 1));
+
+        if (dif == 0) {
+            U64 old = atomic_cmp_exchange(&q->dequeue_pos, pos, pos + 1);
+            if (old == pos) break;
+            pos = old;
+        } else if (dif < 0) {
+            return false;
+        } else {
+            pos = atomic_load_relaxed(&q->dequeue_pos);
+        }
+    }
+
+    memcpy(out, cell_elem(q, pos), q->elem_size);
+    atomic_store_release(cell_seq(q, pos), pos + q->mask + 1);
+    return true;
+}
+
+U64 umpmc_count (UMpmc *q) {
+    U64 d = atomic_load(&q->dequeue_pos);
+    U64 e = atomic_load(&q->enqueue_pos);
+    return (e > d) ? (e - d) : 0;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+// =============================================================================
+// Overview:
+// ---------
+//
+// A bounded lock-free multi-producer multi-consumer queue in the
+// form of a low-level untyped data structure (UMpmc) and a type
+// safe macro wrapper (Mpmc). This is Dmitry Vyukov's design.
+//
+// Each cell of the ring holds a sequence number next to the
+// element. Producers and consumers claim a position with a CAS
+// on their cursor, and then use the sequence number of the cell
+// to hand the element over. There is exactly one atomic RMW per
+// push or pop in the uncontended case and no locks anywhere.
+//
+// The capacity is rounded up to a power of 2. Elements are
+// copied in and out by value, so keep them small.
+//
+// Usage example:
+// --------------
+//
+//     Mpmc(Task) q;
+//     mpmc_init(&q, mem, 1024);
+//
+//     if (! mpmc_push(&q, task)) printf("Full!\n");
+//
+//     Task t;
+//     while (mpmc_pop(&q, &t)) run(&t);
+//
+//     mpmc_destroy(&q);
+//
+// =============================================================================
+#include "base/core.h"
+#include "base/mem.h"
+
+istruct (UMpmc) {
+    alignas(CACHE_LINE) U64 enqueue_pos;
+    alignas(CACHE_LINE) U64 dequeue_pos;
+    alignas(CACHE_LINE) Mem *mem;
+    U64 mask;
+    U64 elem_size;
+    U64 cell_size;
+    U8 *cells;
+};
+
+Void umpmc_init    (UMpmc *, Mem *, U64 capacity, U64 elem_size);
+Void umpmc_destroy (UMpmc *);
+Bool umpmc_push    (UMpmc *, Void *elem); // Returns false if full.
+Bool umpmc_pop     (UMpmc *, Void *out);  // Returns false if empty.
+U64  umpmc_count   (UMpmc *);             // Approximate if there are concurrent ops.
+
+// =============================================================================
+// Type-safe wrapper around UMpmc:
+// =============================================================================
+#define Mpmc(T) union {\
+    UMpmc umpmc;\
+    T *E;\
+}
+
+#define MpmcElem(Q) Type(*(Q)->E)
+
+#define mpmc_init(Q, MEM, CAP) umpmc_init(&(Q)->umpmc, mem_base(MEM), CAP, sizeof(MpmcElem(Q)))
+#define mpmc_destroy(Q)        umpmc_destroy(&(Q)->umpmc)
+#define mpmc_count(Q)          umpmc_count(&(Q)->umpmc)
+#define mpmc_push(Q, V)        ({ def1(q, Q); MpmcElem(q) _(v) = V; umpmc_push(&q->umpmc, &_(v)); })
+#define mpmc_pop(Q, OUT)       ({ def1(q, Q); Type(q->E) _(o) = OUT; umpmc_pop(&q->umpmc, _(o)); })
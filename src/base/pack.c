@@ -0,0 +1,336 @@
+#include "base/pack.h"
+#include "base/log.h"
+#include "base/sync.h"
+#include "os/fs.h"
+#include "os/info.h"
+
+istruct (Pack) {
+    Mem *mem;
+    String file;
+    PackHeader *header;
+    PackEntry *entries;
+    Char *names;
+    Mutex lock;
+    U8 **decoded; // Per entry; the decompressed data or 0.
+};
+
+array_typedef(PackEntry, PackEntry);
+
+// =============================================================================
+// LZ4 block codec:
+//
+// A block is a run of sequences. Each sequence is a token byte
+// (4 bits of literal count, 4 bits of match length - 4), extra
+// literal count bytes, the literals, a 2 byte match offset and
+// extra match length bytes. A count of 15 in a token nibble is
+// continued with bytes that are added up until one isn't 255.
+// The last sequence has only literals.
+//
+// The compressor is the simple greedy one: a hash table of the
+// last position of each 4 byte prefix. The format requires the
+// last 5 bytes to be literals and the last match to start at
+// least 12 bytes before the end.
+// =============================================================================
+#define LZ_HASH_BITS 12
+#define LZ_MAX_OFFSET 65535
+
+static U64 lz_bound (U64 n) {
+    return n + n/255 + 16;
+}
+
+static U32 lz_hash (U32 v) {
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static U8 *lz_put_count (U8 *out, U64 count) {
+    for (; count >= 255; count -= 255) *out++ = 255;
+    *out++ = count;
+    return out;
+}
+
+static U8 *lz_put_sequence (U8 *out, U8 *literals, U64 literal_count, U64 offset, U64 match_count) {
+    U8 *token = out++;
+    *token = min(literal_count, 15u) << 4;
+    if (literal_count >= 15) out = lz_put_count(out, literal_count - 15);
+    memcpy(out, literals, literal_count);
+    out += literal_count;
+
+    if (match_count) {
+        *token |= min(match_count - 4, 15u);
+        *out++ = offset & 0xff;
+        *out++ = offset >> 8;
+        if (match_count - 4 >= 15) out = lz_put_count(out, match_count - 4 - 15);
+    }
+
+    return out;
+}
+
+// The dst must have room for lz_bound(src.count) bytes.
+static U64 lz_compress (String src, U8 *dst) {
+    U32 table[1 << LZ_HASH_BITS] = {};
+    U8 *s      = cast(U8*, src.data);
+    U8 *out    = dst;
+    U64 anchor = 0;
+    U64 limit  = (src.count > 12) ? src.count - 12 : 0;
+
+    for (U64 i = 0; i < limit;) {
+        U32 v; memcpy(&v, s + i, 4);
+        U32 h     = lz_hash(v);
+        U64 match = table[h];
+        table[h]  = i;
+
+        U32 m; memcpy(&m, s + match, 4);
+        if (match >= i || i - match > LZ_MAX_OFFSET || m != v) { i++; continue; }
+
+        U64 count = 4;
+        while (i + count < src.count - 5 && s[match + count] == s[i + count]) count++;
+
+        out    = lz_put_sequence(out, s + anchor, i - anchor, i - match, count);
+        i     += count;
+        anchor = i;
+    }
+
+    out = lz_put_sequence(out, s + anchor, src.count - anchor, 0, 0);
+    return out - dst;
+}
+
+static Bool lz_get_count (U8 **p, U8 *end, U64 *count) {
+    U8 b;
+    do {
+        if (*p >= end) return false;
+        b = *(*p)++;
+        *count += b;
+    } while (b == 255);
+    return true;
+}
+
+// Returns false if the block is corrupt or doesn't decompress
+// to exactly dst_count bytes.
+static Bool lz_decompress (String src, U8 *dst, U64 dst_count) {
+    U8 *in      = cast(U8*, src.data);
+    U8 *in_end  = in + src.count;
+    U8 *out     = dst;
+    U8 *out_end = dst + dst_count;
+
+    while (in < in_end) {
+        U8 token = *in++;
+
+        U64 literals = token >> 4;
+        if (literals == 15 && !lz_get_count(&in, in_end, &literals)) return false;
+        if (literals > cast(U64, in_end - in) || literals > cast(U64, out_end - out)) return false;
+        memcpy(out, in, literals);
+        out += literals;
+        in  += literals;
+
+        if (in == in_end) break;
+        if (in_end - in < 2) return false;
+
+        U64 offset = in[0] | (in[1] << 8);
+        in += 2;
+        if (offset == 0 || offset > cast(U64, out - dst)) return false;
+
+        U64 count = token & 15;
+        if (count == 15 && !lz_get_count(&in, in_end, &count)) return false;
+        count += 4;
+        if (count > cast(U64, out_end - out)) return false;
+
+        U8 *match = out - offset;
+        for (U64 i = 0; i < count; ++i) out[i] = match[i]; // May overlap.
+        out += count;
+    }
+
+    return out == out_end;
+}
+
+// =============================================================================
+// Builder:
+// =============================================================================
+static Int cmp_entries (Void *a, Void *b) {
+    U64 x = cast(PackEntry*, a)->hash;
+    U64 y = cast(PackEntry*, b)->hash;
+    return (x < y) ? -1 : (x > y) ? 1 : 0;
+}
+
+static Void append (AString *out, Void *data, U64 count, U64 align) {
+    U64 pad = align ? (align - out->count % align) % align : 0;
+    array_increase_count(out, pad + count, true);
+    if (count) memcpy(out->data + out->count - count, data, count);
+}
+
+Bool pack_build (String path, SlicePackInput inputs) {
+    tmem_new(tm);
+
+    AString out   = astr_new(tm);
+    AString names = astr_new(tm);
+    ArrayPackEntry entries;
+    array_init(&entries, tm);
+
+    PackHeader header = { .version=PACK_VERSION };
+    memcpy(header.magic, PACK_MAGIC, 8);
+    append(&out, &header, sizeof(PackHeader), 0);
+
+    array_iter (input, &inputs, *) {
+        String data = fs_read_entire_file(tm, input->path, 0);
+
+        if (! data.data) {
+            log_msg_fmt(LOG_ERROR, "Pack", 0, "Couldn't read [%.*s].", STR(input->path));
+            return false;
+        }
+
+        PackEntry e = {
+            .hash        = str_hash(input->path),
+            .size        = data.count,
+            .raw_size    = data.count,
+            .name_offset = names.count,
+            .name_count  = input->path.count,
+        };
+
+        if (input->compress && data.count) {
+            U8 *buf = mem_alloc(tm, U8, .size=lz_bound(data.count));
+            U64 count = lz_compress(data, buf);
+
+            if (count <= data.count - data.count/8) {
+                e.compression = PACK_LZ4;
+                e.size        = count;
+                data          = (String){ .data=cast(Char*, buf), .count=count };
+            }
+        }
+
+        append(&out, 0, 0, (e.size >= PACK_PAGE_ALIGN_MIN) ? os_get_page_size() : PACK_ALIGN);
+        e.offset = out.count;
+        append(&out, data.data, data.count, 0);
+        astr_push_str(&names, input->path);
+        array_push(&entries, e);
+    }
+
+    array_sort_cmp(&entries, cmp_entries);
+
+    array_iter (e, &entries, *) {
+        if (ARRAY_IDX == 0 || e->hash != array_get(&entries, ARRAY_IDX-1).hash) continue;
+        log_msg_fmt(LOG_ERROR, "Pack", 0, "Name collision or duplicate entry [%.*s].", cast(Int, e->name_count), names.data + e->name_offset);
+        return false;
+    }
+
+    append(&out, 0, 0, alignof(PackEntry));
+    U64 index_offset = out.count;
+    append(&out, entries.data, entries.count * sizeof(PackEntry), 0);
+    U64 names_offset = out.count;
+    append(&out, names.data, names.count, 0);
+
+    Auto h          = cast(PackHeader*, out.data);
+    h->entry_count  = entries.count;
+    h->index_offset = index_offset;
+    h->names_offset = names_offset;
+    h->file_size    = out.count;
+
+    return fs_write_entire_file(path, out.as_slice);
+}
+
+// =============================================================================
+// Runtime:
+// =============================================================================
+static Bool pack_is_valid (String file) {
+    if (file.count < sizeof(PackHeader)) return false;
+
+    Auto h = cast(PackHeader*, file.data);
+    if (memcmp(h->magic, PACK_MAGIC, 8) || h->version != PACK_VERSION) return false;
+    if (h->file_size != file.count) return false;
+    if (h->index_offset % alignof(PackEntry)) return false;
+    if (h->index_offset > file.count || h->entry_count > (file.count - h->index_offset) / sizeof(PackEntry)) return false;
+    if (h->names_offset > file.count) return false;
+
+    Auto entries = cast(PackEntry*, file.data + h->index_offset);
+    U64 names_count = file.count - h->names_offset;
+
+    for (U32 i = 0; i < h->entry_count; ++i) {
+        PackEntry *e = &entries[i];
+        if (e->offset > file.count || e->size > file.count - e->offset) return false;
+        if (e->name_offset > names_count || e->name_count > names_count - e->name_offset) return false;
+        if (e->compression > PACK_LZ4) return false;
+        if (e->compression == PACK_RAW && e->size != e->raw_size) return false;
+        if (i && entries[i-1].hash > e->hash) return false;
+    }
+
+    return true;
+}
+
+// The whole pack is prefetched since it only holds
+// what the program needs at startup.
+Pack *pack_open (Mem *mem, String path) {
+    String file = fs_map_file(path, FS_ACCESS_RANDOM, FS_MAP_PREFETCH);
+    if (! file.data) return 0;
+
+    if (! pack_is_valid(file)) {
+        log_msg_fmt(LOG_ERROR, "Pack", 0, "Corrupt asset pack [%.*s].", STR(path));
+        fs_unmap_file(file);
+        return 0;
+    }
+
+    Auto pack     = mem_new(mem, Pack);
+    pack->mem     = mem;
+    pack->file    = file;
+    pack->header  = cast(PackHeader*, file.data);
+    pack->entries = cast(PackEntry*, file.data + pack->header->index_offset);
+    pack->names   = file.data + pack->header->names_offset;
+
+    U32 n = pack->header->entry_count;
+    if (n) pack->decoded = mem_alloc(mem, U8*, .zeroed=true, .size=(n * sizeof(U8*)));
+
+    return pack;
+}
+
+Void pack_close (Pack *pack) {
+    U32 n = pack->header->entry_count;
+
+    for (U32 i = 0; i < n; ++i) {
+        if (pack->decoded[i]) mem_free(pack->mem, .old_ptr=pack->decoded[i], .old_size=pack->entries[i].raw_size);
+    }
+
+    if (n) mem_free(pack->mem, .old_ptr=pack->decoded, .old_size=(n * sizeof(U8*)));
+    fs_unmap_file(pack->file);
+    mem_free(pack->mem, .old_ptr=pack, .old_size=sizeof(Pack));
+}
+
+static PackEntry *pack_find (Pack *pack, String name) {
+    U64 hash = str_hash(name);
+    U64 lo   = 0;
+    U64 hi   = pack->header->entry_count;
+
+    while (lo < hi) {
+        U64 mid = lo + (hi - lo)/2;
+        if (pack->entries[mid].hash < hash) lo = mid + 1;
+        else hi = mid;
+    }
+
+    for (; lo < pack->header->entry_count && pack->entries[lo].hash == hash; ++lo) {
+        PackEntry *e = &pack->entries[lo];
+        if (str_match(name, (String){ .data=(pack->names + e->name_offset), .count=e->name_count })) return e;
+    }
+
+    return 0;
+}
+
+String pack_get (Pack *pack, String name) {
+    PackEntry *e = pack_find(pack, name);
+    if (! e) return (String){};
+
+    String data = { .data=(pack->file.data + e->offset), .count=e->size };
+    if (e->compression == PACK_RAW) return data;
+
+    U64 idx = e - pack->entries;
+    mutex_scoped_lock(&pack->lock);
+
+    if (! pack->decoded[idx]) {
+        U8 *buf = mem_alloc(pack->mem, U8, .size=e->raw_size);
+
+        if (! lz_decompress(data, buf, e->raw_size)) {
+            log_msg_fmt(LOG_ERROR, "Pack", 0, "Corrupt entry [%.*s].", STR(name));
+            mem_free(pack->mem, .old_ptr=buf, .old_size=e->raw_size);
+            return (String){};
+        }
+
+        pack->decoded[idx] = buf;
+    }
+
+    return (String){ .data=cast(Char*, pack->decoded[idx]), .count=e->raw_size };
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+// =============================================================================
+// Overview:
+// ---------
+//
+// A single-file archive for the assets the program needs at run
+// time (fonts, shaders, images). Opening a pack is one open and
+// one mmap, and the entries are handed out as String views into
+// the mapping, so nothing is read until it's touched.
+//
+// Entries are looked up by name (usually the relative path they
+// were packed from). The index is sorted by the xxhash of the
+// name, so a lookup is a binary search over the index followed
+// by a name compare.
+//
+// An entry can be compressed with an LZ4 compatible block codec.
+// That's worth it for text like shaders but not for fonts, since
+// a compressed entry is decompressed into heap memory on first
+// access (once; later calls return the same view) and so loses
+// the benefit of being mapped. The builder only keeps compressed
+// data if it saves at least 1/8 of the size.
+//
+// Layout of the file (numbers are in native byte order):
+//
+//     PackHeader
+//     entry data     Each aligned to PACK_ALIGN, or to the page
+//                    size if it's at least PACK_PAGE_ALIGN_MIN.
+//     PackEntry[]    Sorted by hash.
+//     names          Not 0-terminated.
+//
+// A pack is built with "make pack" which runs the program with
+// the -pack command line option (see main.c).
+//
+// Usage example:
+// --------------
+//
+//     Pack *pack = pack_open(mem, str("data/assets.pack"));
+//     String font = pack_get(pack, str("data/fonts/NotoSans-Regular.ttf"));
+//     if (! font.data) ...; // Not in the pack.
+//     pack_close(pack); // The views are invalid after this.
+//
+// =============================================================================
+#include "base/core.h"
+#include "base/mem.h"
+#include "base/string.h"
+
+#define PACK_MAGIC          "MYKPACK\0"
+#define PACK_VERSION        1
+#define PACK_ALIGN          64
+#define PACK_PAGE_ALIGN_MIN (64*KB)
+
+ienum (PackCompression, U8) {
+    PACK_RAW,
+    PACK_LZ4,
+};
+
+istruct (PackHeader) {
+    U8  magic[8];
+    U32 version;
+    U32 entry_count;
+    U64 index_offset;
+    U64 names_offset;
+    U64 file_size;
+};
+
+istruct (PackEntry) {
+    U64 hash; // str_hash() of the name.
+    U64 offset;
+    U64 size; // Size in the file.
+    U64 raw_size;
+    U32 name_offset;
+    U32 name_count;
+    U8  compression; // PackCompression; a U8 so the layout is fixed.
+    U8  pad[7];
+};
+
+istruct (PackInput) {
+    String path; // Also the name of the entry.
+    Bool compress;
+};
+
+array_typedef(PackInput, PackInput);
+
+istruct (Pack);
+
+Pack  *pack_open  (Mem *, String path); // Returns 0 if missing or corrupt.
+Void   pack_close (Pack *);
+String pack_get   (Pack *, String name); // Returns an empty String if not found. Thread safe.
+Bool   pack_build (String path, SlicePackInput);
@@ -0,0 +1,162 @@
+#include "base/spsc.h"
+#include "base/sync.h"
+#include "os/threads.h"
+
+// The head and tail are unbounded counters; the ring index is
+// the counter masked by the capacity. The elements are published
+// by the store to the tail (or freed by the store to the head),
+// and picked up by the acquire load in the other thread.
+//
+// Those two stores are seq_cst, because they pair with the load
+// of the sleeping flag of the other side: a sleeper sets its flag
+// and then rechecks the index, while the other side stores the
+// index and then checks the flag, so one of them sees the other.
+// The waker clears the flag so that a burst of pushes into a
+// sleeping consumer (or pops from a full channel) does only one
+// syscall instead of one per op.
+
+Void uspsc_init (USpsc *q, Mem *mem, U64 capacity, U64 elem_size) {
+    U64 cap      = next_pow2(max(capacity, 2u));
+    *q           = (USpsc){};
+    q->mem       = mem;
+    q->mask      = cap - 1;
+    q->elem_size = elem_size;
+    q->elems     = mem_alloc(mem, U8, .align=CACHE_LINE, .size=(cap * elem_size));
+}
+
+Void uspsc_destroy (USpsc *q) {
+    mem_free(q->mem, .old_ptr=q->elems, .old_size=((q->mask + 1) * q->elem_size));
+}
+
+// Copies n elements between the ring and a flat buffer, in at
+// most two pieces since the ring can wrap around.
+static Void copy_in (USpsc *q, U64 pos, U8 *elems, U64 n) {
+    U64 idx   = pos & q->mask;
+    U64 first = min(n, q->mask + 1 - idx);
+    memcpy(q->elems + idx*q->elem_size, elems, first*q->elem_size);
+    memcpy(q->elems, elems + first*q->elem_size, (n - first)*q->elem_size);
+}
+
+static Void copy_out (USpsc *q, U64 pos, U8 *out, U64 n) {
+    U64 idx   = pos & q->mask;
+    U64 first = min(n, q->mask + 1 - idx);
+    memcpy(out, q->elems + idx*q->elem_size, first*q->elem_size);
+    memcpy(out + first*q->elem_size, q->elems, (n - first)*q->elem_size);
+}
+
+U64 uspsc_push_n (USpsc *q, Void *elems, U64 n) {
+    U64 cap  = q->mask + 1;
+    U64 tail = atomic_load_relaxed(&q->tail);
+    U64 room = cap - (tail - q->cached_head);
+
+    if (room < n) {
+        q->cached_head = atomic_load_acquire(&q->head);
+        room = cap - (tail - q->cached_head);
+    }
+
+    n = min(n, room);
+    if (! n) return 0;
+
+    copy_in(q, tail, elems, n);
+    atomic_store(&q->tail, tail + n);
+
+    if (atomic_load(&q->consumer_sleeping) && atomic_exchange(&q->consumer_sleeping, false)) {
+        atomic_inc_load(&q->data_seq);
+        os_futex_wake_one(&q->data_seq);
+    }
+
+    return n;
+}
+
+U64 uspsc_pop_n (USpsc *q, Void *out, U64 n) {
+    U64 head  = atomic_load_relaxed(&q->head);
+    U64 avail = q->cached_tail - head;
+
+    if (avail < n) {
+        q->cached_tail = atomic_load_acquire(&q->tail);
+        avail = q->cached_tail - head;
+    }
+
+    n = min(n, avail);
+    if (! n) return 0;
+
+    copy_out(q, head, out, n);
+    atomic_store(&q->head, head + n);
+
+    if (atomic_load(&q->producer_sleeping) && atomic_exchange(&q->producer_sleeping, false)) {
+        atomic_inc_load(&q->space_seq);
+        os_futex_wake_one(&q->space_seq);
+    }
+
+    return n;
+}
+
+Bool uspsc_push_all (USpsc *q, Void *elems, U64 n) {
+    U64 cap  = q->mask + 1;
+    U64 tail = atomic_load_relaxed(&q->tail);
+
+    if (cap - (tail - q->cached_head) < n) {
+        q->cached_head = atomic_load_acquire(&q->head);
+        if (cap - (tail - q->cached_head) < n) return false;
+    }
+
+    return uspsc_push_n(q, elems, n) == n;
+}
+
+Void uspsc_push_all_wait (USpsc *q, Void *elems, U64 n) {
+    assert_dbg(n <= q->mask + 1);
+    U32 limit = sync_spin_limit();
+
+    for (U32 spins = 0;; ++spins) {
+        if (uspsc_push_all(q, elems, n)) return;
+        if (spins < limit) { cpu_relax(); continue; }
+
+        U32 seq = atomic_load(&q->space_seq);
+        atomic_store(&q->producer_sleeping, true);
+        U64 room = q->mask + 1 - (atomic_load(&q->tail) - atomic_load(&q->head));
+        if (room < n) os_futex_wait(&q->space_seq, seq);
+        atomic_store(&q->producer_sleeping, false);
+    }
+}
+
+Void uspsc_push_wait_n (USpsc *q, Void *elems, U64 n) {
+    U8 *cursor = elems;
+    U32 spins  = 0;
+    U32 limit  = sync_spin_limit();
+
+    while (n) {
+        U64 pushed = uspsc_push_n(q, cursor, n);
+        cursor += pushed * q->elem_size;
+        n -= pushed;
+
+        if (pushed || !n) { spins = 0; continue; }
+        if (spins++ < limit) { cpu_relax(); continue; }
+
+        U32 seq = atomic_load(&q->space_seq);
+        atomic_store(&q->producer_sleeping, true);
+        U64 full = (atomic_load(&q->tail) - atomic_load(&q->head)) > q->mask;
+        if (full) os_futex_wait(&q->space_seq, seq);
+        atomic_store(&q->producer_sleeping, false);
+    }
+}
+
+U64 uspsc_pop_wait_n (USpsc *q, Void *out, U64 n) {
+    U32 limit = sync_spin_limit();
+
+    for (U32 spins = 0;; ++spins) {
+        U64 popped = uspsc_pop_n(q, out, n);
+        if (popped) return popped;
+        if (spins < limit) { cpu_relax(); continue; }
+
+        U32 seq = atomic_load(&q->data_seq);
+        atomic_store(&q->consumer_sleeping, true);
+        if (atomic_load(&q->tail) == atomic_load(&q->head)) os_futex_wait(&q->data_seq, seq);
+        atomic_store(&q->consumer_sleeping, false);
+    }
+}
+
+U64 uspsc_count (USpsc *q) {
+    U64 h = atomic_load(&q->head);
+    U64 t = atomic_load(&q->tail);
+    return (t > h) ? (t - h) : 0;
+}
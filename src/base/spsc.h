@@ -0,0 +1,98 @@
+#pragma once
+
+// =============================================================================
+// Overview:
+// ---------
+//
+// A bounded wait-free single-producer single-consumer channel in
+// the form of a low-level untyped data structure (USpsc) and a type
+// safe macro wrapper (Spsc). Use it to hand work from one thread to
+// another, for example from the ui thread to a render thread.
+//
+// The producer only writes the tail and the consumer only writes
+// the head, and each keeps a cached copy of the other's index, so
+// in the common case neither touches the other's cache line. The
+// push and pop functions never block and never loop; they do one
+// store to their index, plus a check for a sleeping peer.
+//
+// Push and pop can move a batch of elements at once which costs
+// about as much as moving one. The batch versions may move fewer
+// elements than asked for, and return how many they moved. The
+// push_all versions move either all elements or none, so the
+// consumer never sees a partial batch (useful for byte streams
+// made of records, like log output).
+//
+// The wait versions spin for a bit and then sleep on a futex until
+// the other side makes progress. A side that never waits doesn't
+// pay for the futex except for checking a flag.
+//
+// The capacity is rounded up to a power of 2. Elements are
+// copied in and out by value.
+//
+// Usage example:
+// --------------
+//
+//     Spsc(DrawCmd) q;
+//     spsc_init(&q, mem, 1024);
+//
+//     // Producer thread:
+//     spsc_push_wait(&q, cmd);
+//
+//     // Consumer thread:
+//     DrawCmd cmds[64];
+//     U64 n = spsc_pop_wait_n(&q, cmds, 64); // At least 1.
+//
+//     spsc_destroy(&q);
+//
+// =============================================================================
+#include "base/core.h"
+#include "base/mem.h"
+
+istruct (USpsc) {
+    alignas(CACHE_LINE) U64 head; // Written by the consumer.
+    U64 cached_tail;
+    alignas(CACHE_LINE) U64 tail; // Written by the producer.
+    U64 cached_head;
+    alignas(CACHE_LINE) U32 data_seq;  // Bumped to wake the consumer.
+    U32 space_seq;                     // Bumped to wake the producer.
+    Bool consumer_sleeping;
+    Bool producer_sleeping;
+    alignas(CACHE_LINE) Mem *mem;
+    U64 mask;
+    U64 elem_size;
+    U8 *elems;
+};
+
+Void uspsc_init          (USpsc *, Mem *, U64 capacity, U64 elem_size);
+Void uspsc_destroy       (USpsc *);
+U64  uspsc_push_n        (USpsc *, Void *elems, U64 n);   // Returns the count pushed.
+U64  uspsc_pop_n         (USpsc *, Void *out, U64 n);     // Returns the count popped.
+Void uspsc_push_wait_n   (USpsc *, Void *elems, U64 n);   // Pushes all n.
+Bool uspsc_push_all      (USpsc *, Void *elems, U64 n);   // Returns false (and pushes nothing) if there's no room for all n.
+Void uspsc_push_all_wait (USpsc *, Void *elems, U64 n);   // Waits until all n fit. The n must not exceed the capacity.
+U64  uspsc_pop_wait_n    (USpsc *, Void *out, U64 n);     // Pops at least 1.
+U64  uspsc_count         (USpsc *);                       // Approximate if there are concurrent ops.
+
+// =============================================================================
+// Type-safe wrapper around USpsc:
+// =============================================================================
+#define Spsc(T) union {\
+    USpsc uspsc;\
+    T *E;\
+}
+
+#define SpscElem(Q) Type(*(Q)->E)
+
+#define spsc_init(Q, MEM, CAP)     uspsc_init(&(Q)->uspsc, mem_base(MEM), CAP, sizeof(SpscElem(Q)))
+#define spsc_destroy(Q)            uspsc_destroy(&(Q)->uspsc)
+#define spsc_count(Q)              uspsc_count(&(Q)->uspsc)
+#define spsc_push(Q, V)            ({ def1(q, Q); SpscElem(q) _(v) = V; uspsc_push_n(&q->uspsc, &_(v), 1) == 1; })
+#define spsc_pop(Q, OUT)           ({ def1(q, Q); Type(q->E) _(o) = OUT; uspsc_pop_n(&q->uspsc, _(o), 1) == 1; })
+#define spsc_push_n(Q, ELEMS, N)   ({ def1(q, Q); Type(q->E) _(e) = ELEMS; uspsc_push_n(&q->uspsc, _(e), N); })
+#define spsc_pop_n(Q, OUT, N)      ({ def1(q, Q); Type(q->E) _(o) = OUT; uspsc_pop_n(&q->uspsc, _(o), N); })
+#define spsc_push_wait(Q, V)       ({ def1(q, Q); SpscElem(q) _(v) = V; uspsc_push_wait_n(&q->uspsc, &_(v), 1); })
+#define spsc_pop_wait(Q, OUT)      ({ def1(q, Q); Type(q->E) _(o) = OUT; cast(Void, uspsc_pop_wait_n(&q->uspsc, _(o), 1)); })
+#define spsc_push_wait_n(Q, ELEMS, N) ({ def1(q, Q); Type(q->E) _(e) = ELEMS; uspsc_push_wait_n(&q->uspsc, _(e), N); })
+#define spsc_push_all(Q, ELEMS, N)    ({ def1(q, Q); Type(q->E) _(e) = ELEMS; uspsc_push_all(&q->uspsc, _(e), N); })
+#define spsc_push_all_wait(Q, ELEMS, N) ({ def1(q, Q); Type(q->E) _(e) = ELEMS; uspsc_push_all_wait(&q->uspsc, _(e), N); })
+#define spsc_pop_wait_n(Q, OUT, N) ({ def1(q, Q); Type(q->E) _(o) = OUT; uspsc_pop_wait_n(&q->uspsc, _(o), N); })
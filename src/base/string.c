@@ -1,16 +1,21 @@
 #include <errno.h>
+#include <math.h>
 #define XXH_STATIC_LINKING_ONLY
 #include "vendor/xxhash/xxhash.h"
 #include "base/string.h"
 #include "os/fs.h"
 
+#if ARCH_X86_64
+    #define XXH_DISPATCH_DISABLE_REPLACE
+    #include "vendor/xxhash/xxh_x86dispatch.h"
+#endif
+
 // =============================================================================
 // String:
 // =============================================================================
 Bool    is_whitespace (Char c)               { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
-CString cstr          (Mem *mem, String s)   { return astr_fmt(mem, "%.*s%c", STR(s), 0).data; }
+CString cstr          (Mem *mem, String s)   { AString a = astr_new_cap(mem, s.count + 1); astr_push_str(&a, s); return astr_to_cstr(&a); }
 String  str           (CString s)            { return (String){ .data=s, .count=cast(U64, strlen(s)) }; }
-U64     str_hash_seed (String str, U64 seed) { return XXH3_64bits_withSeed(str.data, str.count, seed); }
 U64     str_hash      (String str)           { return str_hash_seed(str, 5381); }
 Bool    str_match     (String s1, String s2) { return (s1.count == s2.count) && (! strncmp(s1.data, s2.data, s1.count)); }
 U64     istr_hash     (IString *i)           { return str_hash(*i); }
@@ -18,6 +23,17 @@ U64     cstr_hash     (CString s)            { return str_hash(str(s)); }
 Bool    cstr_match    (CString a, CString b) { return str_match(str(a), str(b)); }
 Void    str_clear     (String s, U8 b)       { memset(s.data, b, s.count); }
 
+// Inputs longer than 240 bytes take the XXH3 long path which
+// benefits from AVX2/AVX512. On x86-64 we use the dispatcher
+// to pick the best variant for the cpu at runtime since the
+// build only targets the baseline instruction set.
+U64 str_hash_seed (String str, U64 seed) {
+    #if ARCH_X86_64
+        if (str.count > 240) return XXH3_64bits_withSeed_dispatch(str.data, str.count, seed);
+    #endif
+    return XXH3_64bits_withSeed(str.data, str.count, seed);
+}
+
 Bool str_starts_with (String str, String prefix) {
     if (str.count < prefix.count) return false;
     str.count = prefix.count;
@@ -107,18 +123,118 @@ String str_suffix_from_first (String str, U8 byte) {
     return (String){};
 }
 
-Bool str_to_u64 (CString str, U64 *out, U64 base) {
-    errno = 0;
-    Char *endptr = 0;
-    *out = cast(U64, strtoul(str, &endptr, base));
-    return (errno == 0) && (endptr != str);
+Bool str_to_u64 (CString s, U64 *out, U64 base) { return str_parse_u64(str(s), out, base); }
+Bool str_to_f64 (CString s, F64 *out)           { return str_parse_f64(str(s), out); }
+
+// Exact powers of 10 representable as F64.
+static F64 pow10_f64[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+static U64 parse_digit (Char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    c |= 0x20;
+    if (c >= 'a' && c <= 'z') return c - 'a' + 10;
+    return UINT64_MAX;
+}
+
+// Unlike str_to_u64() the whole string must be a number
+// without whitespace or a sign. The base is in [2, 36], or
+// 0 to pick it from the prefix like strtoul() does ("0x" is
+// hex, a leading "0" is octal). Base 16 accepts a "0x" too.
+Bool str_parse_u64 (String str, U64 *out, U64 base) {
+    Bool hex_prefix = (str.count > 2) && (str.data[0] == '0') && ((str.data[1] | 0x20) == 'x');
+
+    if ((base == 0 || base == 16) && hex_prefix) {
+        str  = str_suffix_from(str, 2);
+        base = 16;
+    } else if (base == 0) {
+        base = (str.count > 1 && str.data[0] == '0') ? 8 : 10;
+    }
+
+    if (! str.count) return false;
+
+    U64 result = 0;
+
+    array_iter (c, &str) {
+        U64 digit = parse_digit(c);
+        if (digit >= base) return false;
+        if (ckd_mul(&result, result, base) || ckd_add(&result, result, digit)) return false;
+    }
+
+    *out = result;
+    return true;
+}
+
+Bool str_parse_i64 (String str, I64 *out, U64 base) {
+    Bool negative = str.count && (str.data[0] == '-');
+    if (str.count && (str.data[0] == '-' || str.data[0] == '+')) str = str_suffix_from(str, 1);
+
+    U64 magnitude;
+    if (! str_parse_u64(str, &magnitude, base)) return false;
+    if (magnitude > (negative ? cast(U64, INT64_MAX) + 1 : cast(U64, INT64_MAX))) return false;
+
+    *out = negative ? cast(I64, 0 - magnitude) : cast(I64, magnitude);
+    return true;
 }
 
-Bool str_to_f64 (CString str, F64 *out) {
-    errno = 0;
-    Char *endptr = 0;
-    *out = strtod(str, &endptr);
-    return (errno == 0) && (endptr != str);
+// The common case of a short decimal with a small exponent
+// is computed exactly without calling into libc: both the
+// mantissa and the power of 10 are exact F64 values, so a
+// single correctly rounded mul/div gives the right answer.
+// Everything else (long mantissas, huge exponents, inf and
+// nan) falls back to strtod().
+Bool str_parse_f64 (String str, F64 *out) {
+    U64 i         = 0;
+    U64 mantissa  = 0;
+    I64 exponent  = 0;
+    U64 n_digits  = 0;
+    Bool exact    = true;
+    Bool negative = false;
+
+    if (i < str.count && (str.data[i] == '-' || str.data[i] == '+')) negative = (str.data[i++] == '-');
+
+    for (; i < str.count && (parse_digit(str.data[i]) < 10); i++, n_digits++) {
+        if (mantissa < (1ull << 53) / 10) mantissa = 10*mantissa + parse_digit(str.data[i]);
+        else { exact = false; exponent++; }
+    }
+
+    if (i < str.count && str.data[i] == '.') {
+        for (i++; i < str.count && (parse_digit(str.data[i]) < 10); i++, n_digits++) {
+            if (mantissa < (1ull << 53) / 10) { mantissa = 10*mantissa + parse_digit(str.data[i]); exponent--; }
+            else if (str.data[i] != '0') exact = false;
+        }
+    }
+
+    if (! n_digits) goto slow_path;
+
+    if (i < str.count && (str.data[i] == 'e' || str.data[i] == 'E')) {
+        I64 e;
+        if (! str_parse_i64(str_suffix_from(str, i + 1), &e, 10)) goto slow_path;
+        if (e < -9999 || e > 9999) goto slow_path;
+        exponent += e;
+        i = str.count;
+    }
+
+    if (i != str.count) return false;
+
+    if (exact && exponent >= -22 && exponent <= 22) {
+        F64 r = cast(F64, mantissa);
+        r = (exponent < 0) ? (r / pow10_f64[-exponent]) : (r * pow10_f64[exponent]);
+        *out = negative ? -r : r;
+        return true;
+    }
+
+    slow_path: {
+        tmem_new(tm);
+        CString s = cstr(tm, str);
+        Char *end = 0;
+        errno = 0;
+        *out = strtod(s, &end);
+        Bool overflow = (errno == ERANGE) && isinf(*out);
+        return !overflow && (end == s + str.count) && str.count;
+    }
 }
 
 String str_copy (Mem *mem, String str) {
@@ -254,6 +370,88 @@ static U8 utf8_class [32] = {
     1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,0,0,0,0,0,0,0,0,2,2,2,2,3,3,4,5,
 };
 
+// Returns the end of the char class that starts at p (the
+// char after the closing bracket), or 0 if it's not closed.
+static Char *glob_class_end (Char *p, Char *end) {
+    Char *c = p + 1;
+    if (c < end && (*c == '!' || *c == '^')) c++;
+    if (c < end && *c == ']') c++; // A leading ']' is a literal.
+    while (c < end && *c != ']') c++;
+    return (c < end) ? c + 1 : 0;
+}
+
+static Bool glob_class_match (Char *p, Char *end, U8 ch) {
+    p++;
+    Bool negate = (*p == '!' || *p == '^');
+    if (negate) p++;
+
+    Bool found = false;
+    for (Char *c = p; c < end - 1; ++c) {
+        if (c + 2 < end - 1 && c[1] == '-') {
+            if (ch >= cast(U8, c[0]) && ch <= cast(U8, c[2])) found = true;
+            c += 2;
+        } else if (ch == cast(U8, *c)) {
+            found = true;
+        }
+    }
+
+    return found != negate;
+}
+
+static Bool glob_match (Char *p, Char *pend, Char *s, Char *send) {
+    while (p < pend) {
+        if (*p == '*' && p + 1 < pend && p[1] == '*') {
+            p += 2;
+            if (p < pend && *p == '/' && glob_match(p + 1, pend, s, send)) return true; // "**/" matching no dirs.
+            for (Char *t = s; t <= send; ++t) if (glob_match(p, pend, t, send)) return true;
+            return false;
+        }
+
+        if (*p == '*') {
+            p++;
+            for (Char *t = s;; ++t) {
+                if (glob_match(p, pend, t, send)) return true;
+                if (t == send || *t == '/') return false;
+            }
+        }
+
+        if (s == send) return false;
+
+        if (*p == '?') {
+            if (*s == '/') return false;
+        } else if (*p == '[' && glob_class_end(p, pend)) {
+            Char *end = glob_class_end(p, pend);
+            if (*s == '/' || !glob_class_match(p, end, *s)) return false;
+            p = end;
+            s++;
+            continue;
+        } else {
+            if (*p == '\\' && p + 1 < pend) p++;
+            if (*p != *s) return false;
+        }
+
+        p++;
+        s++;
+    }
+
+    return s == send;
+}
+
+// Matches the whole string against a shell style glob:
+//
+//     ?       Any char except '/'.
+//     *       Any run of chars except '/'.
+//     **      Any run of chars including '/'. A "**/" can
+//             also match nothing, so "**/*.c" matches "a.c".
+//     [a-z]   A char class; negate with [!a-z] or [^a-z].
+//     \*      Escapes the next char.
+//
+// For example "src/**/*.[ch]" matches "src/a.c" and also
+// "src/ui/font.h", but "src/*.c" doesn't match "src/ui/ui.c".
+Bool str_glob_match (String pattern, String str) {
+    return glob_match(pattern.data, pattern.data + pattern.count, str.data, str.data + str.count);
+}
+
 UtfDecode str_utf8_decode (String str) {
     UtfDecode result = {1, UINT32_MAX};
 
@@ -356,6 +554,96 @@ Void astr_push_fmt_va Fmt(2, 0) (AString *astr, CString fmt, VaList va) {
     va_end(va2);
 }
 
+static Char digit_pairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839404142434445464748495051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+
+// Writes the decimal digits of v into the buffer so that
+// they end at buf_end. Returns a pointer to the first one.
+static Char *u64_to_dec (Char *buf_end, U64 v) {
+    Char *p = buf_end;
+
+    while (v >= 100) {
+        p -= 2;
+        memcpy(p, &digit_pairs[2*(v % 100)], 2);
+        v /= 100;
+    }
+
+    if (v >= 10) { p -= 2; memcpy(p, &digit_pairs[2*v], 2); }
+    else         { *--p = '0' + v; }
+
+    return p;
+}
+
+Void astr_push_fmt_u64 (AString *astr, U64 v) {
+    Char buf[20];
+    Char *p = u64_to_dec(buf + sizeof(buf), v);
+    astr_push_str(astr, (String){ .data=p, .count=cast(U64, buf + sizeof(buf) - p) });
+}
+
+Void astr_push_fmt_i64 (AString *astr, I64 v) {
+    if (v < 0) astr_push_byte(astr, '-');
+    astr_push_fmt_u64(astr, (v < 0) ? (0 - cast(U64, v)) : cast(U64, v));
+}
+
+// This prints the shortest decimal that parses back into the
+// same float. The fast path looks for the fewest decimals k
+// such that the integer m = round(v * 10^k) is below 2^53.
+// Then m/10^k is a division of 2 exact values, so it's
+// correctly rounded just like strtod() would round "m.e-k",
+// and we can check that it gives back v. This covers most
+// numbers that show up in a UI. The rest go through libc.
+//
+// An F32 is checked with an F32 division (m below 2^24 and
+// k at most 10 so both are exact F32 values), since rounding
+// m/10^k to F64 first and then to F32 can round differently
+// than strtof() rounds the printed string.
+static Void push_float (AString *astr, F64 v, Bool is_f32) {
+    if (isnan(v)) { astr_push_cstr(astr, "nan"); return; }
+    if (signbit(v)) { astr_push_byte(astr, '-'); v = -v; }
+    if (isinf(v)) { astr_push_cstr(astr, "inf"); return; }
+    if (v == 0) { astr_push_byte(astr, '0'); return; }
+
+    U64 max_k = is_f32 ? 10 : 22;
+    F64 max_m = is_f32 ? 0x1p24 : 0x1p53;
+
+    for (U64 k = 0; k <= max_k; k++) {
+        F64 scaled = v * pow10_f64[k];
+        if (scaled >= max_m) break;
+
+        F64 m = round(scaled);
+        if (is_f32 ? (cast(F32, m) / cast(F32, pow10_f64[k]) != cast(F32, v)) : (m / pow10_f64[k] != v)) continue;
+
+        Char buf[20];
+        Char *p = u64_to_dec(buf + sizeof(buf), cast(U64, m));
+        U64 n   = cast(U64, buf + sizeof(buf) - p);
+
+        if (k == 0) {
+            astr_push_str(astr, (String){ .data=p, .count=n });
+        } else if (n > k) {
+            astr_push_str(astr, (String){ .data=p, .count=(n - k) });
+            astr_push_byte(astr, '.');
+            astr_push_str(astr, (String){ .data=(p + n - k), .count=k });
+        } else {
+            astr_push_2u8(astr, '0', '.');
+            astr_push_bytes(astr, '0', k - n);
+            astr_push_str(astr, (String){ .data=p, .count=n });
+        }
+
+        return;
+    }
+
+    Char buf[32];
+    for (Int precision = is_f32 ? 6 : 15;; precision++) {
+        snprintf(buf, sizeof(buf), "%.*g", precision, v);
+        if (is_f32 ? (strtof(buf, 0) == cast(F32, v)) : (strtod(buf, 0) == v)) break;
+    }
+
+    astr_push_cstr(astr, buf);
+}
+
+Void astr_push_fmt_f32 (AString *astr, F32 v) { push_float(astr, v, true); }
+Void astr_push_fmt_f64 (AString *astr, F64 v) { push_float(astr, v, false); }
+
 // Append the str argument wrapped in double quotes with
 // any double quotes within str escaped with a backslash:
 //
@@ -392,11 +680,27 @@ Void astr_push_str_quoted (AString *astr, String str) {
 // =============================================================================
 // Gap Buffer:
 // =============================================================================
+#define GB_PAGE_SIZE (4*KB) // Granularity at which lazy buffers copy text out of the mapping.
+
+// If the owned field is 0, then this piece is the slice
+// [map_offset, map_offset + count) of GapBuf.map.
+istruct (GbPiece) {
+    U64 count;
+    U64 map_offset;
+    GapBuf *owned;
+};
+
 istruct (GapBuf) {
+    Mem *mem;
     AString str;
     U64 gap_min;
     U64 gap_idx;
     U64 gap_count;
+
+    // Lazy mode only:
+    String map;
+    U64 lazy_count;
+    Array(GbPiece) pieces;
 };
 
 static Void print_state (GapBuf *gb) {
@@ -414,6 +718,145 @@ static Void print_state (GapBuf *gb) {
     );
 }
 
+static Bool is_lazy (GapBuf *gb) {
+    return gb->map.data != 0;
+}
+
+static String piece_str (GapBuf *gb, GbPiece *piece) {
+    return piece->owned ? gb_str(piece->owned) : str_slice(gb->map, piece->map_offset, piece->count);
+}
+
+// Returns the idx of the piece containing the char at
+// the given idx and rebases idx to that piece. The end
+// of the text maps to the end of the last piece.
+static U64 lazy_find_piece (GapBuf *gb, U64 *idx) {
+    array_iter (piece, &gb->pieces, *) {
+        if ((*idx < piece->count) || ARRAY_ITER_DONE) return ARRAY_IDX;
+        *idx -= piece->count;
+    }
+
+    return ARRAY_NIL_IDX;
+}
+
+// If the piece is a view into the mapping, copy the page
+// containing idx into an owned piece. The rest stays in
+// the mapping. Returns the idx of the owned piece and
+// rebases idx to it.
+static U64 lazy_own_page (GapBuf *gb, U64 piece_idx, U64 *idx) {
+    GbPiece piece = array_get(&gb->pieces, piece_idx);
+    if (piece.owned) return piece_idx;
+
+    U64 start = (*idx == piece.count) ? sat_sub64(piece.count, 1) : *idx;
+    start    -= start % GB_PAGE_SIZE;
+    U64 end   = min(piece.count, start + GB_PAGE_SIZE);
+
+    GapBuf *owned = gb_new(gb->mem, 0);
+    gb_insert(owned, str_slice(gb->map, piece.map_offset + start, end - start), 0);
+
+    array_remove(&gb->pieces, piece_idx);
+    if (end < piece.count) array_insert_lit(&gb->pieces, piece_idx, .count=(piece.count - end), .map_offset=(piece.map_offset + end));
+    array_insert_lit(&gb->pieces, piece_idx, .count=(end - start), .owned=owned);
+    if (start) array_insert_lit(&gb->pieces, piece_idx++, .count=start, .map_offset=piece.map_offset);
+
+    *idx -= start;
+    return piece_idx;
+}
+
+static Void lazy_insert (GapBuf *gb, String str, U64 idx) {
+    if (! str.count) return;
+
+    idx = min(idx, gb->lazy_count);
+    if (! gb->pieces.count) array_push_lit(&gb->pieces, .owned=gb_new(gb->mem, 0));
+
+    U64 piece_idx = lazy_find_piece(gb, &idx);
+
+    // Keep typing at the end of an owned page within that page.
+    if ((idx == 0) && piece_idx && array_get(&gb->pieces, piece_idx - 1).owned) {
+        piece_idx--;
+        idx = array_get(&gb->pieces, piece_idx).count;
+    }
+
+    piece_idx = lazy_own_page(gb, piece_idx, &idx);
+    GbPiece *piece = array_ref(&gb->pieces, piece_idx);
+    gb_insert(piece->owned, str, idx);
+    piece->count   += str.count;
+    gb->lazy_count += str.count;
+}
+
+// Deleting text from mapped pieces only trims or splits
+// them, so no text gets copied.
+static Void lazy_delete (GapBuf *gb, U64 count, U64 idx) {
+    idx   = min(idx, gb->lazy_count);
+    count = min(count, gb->lazy_count - idx);
+    gb->lazy_count -= count;
+
+    while (count) {
+        U64 local      = idx;
+        U64 piece_idx  = lazy_find_piece(gb, &local);
+        GbPiece *piece = array_ref(&gb->pieces, piece_idx);
+        U64 n          = min(count, piece->count - local);
+        count         -= n;
+
+        if (n == piece->count) {
+            if (piece->owned) gb_destroy(piece->owned);
+            array_remove(&gb->pieces, piece_idx);
+        } else if (piece->owned) {
+            gb_delete(piece->owned, n, local);
+            piece->count -= n;
+        } else if (local == 0) {
+            piece->map_offset += n;
+            piece->count      -= n;
+        } else if ((local + n) == piece->count) {
+            piece->count -= n;
+        } else {
+            GbPiece right = { .count=(piece->count - local - n), .map_offset=(piece->map_offset + local + n) };
+            piece->count = local;
+            array_insert(&gb->pieces, right, piece_idx + 1);
+        }
+    }
+}
+
+// Turns a lazy buffer into a normal one.
+static Void lazy_flatten (GapBuf *gb) {
+    fs_advise(gb->map, 0, gb->map.count, FS_ACCESS_SEQUENTIAL);
+
+    AString a = astr_new_cap(gb->mem, gb->lazy_count + gb->gap_min);
+    array_iter (piece, &gb->pieces, *) {
+        astr_push_str(&a, piece_str(gb, piece));
+        if (piece->owned) gb_destroy(piece->owned);
+    }
+
+    array_free(&gb->pieces);
+    fs_unmap_file(gb->map);
+
+    gb->map       = (String){};
+    gb->str       = a;
+    gb->gap_idx   = a.count;
+    gb->gap_count = 0;
+}
+
+static U64 lazy_line_to_offset (GapBuf *gb, U64 line) {
+    U64 result = 0;
+    U64 offset = 0;
+    U64 l      = 1;
+
+    fs_advise(gb->map, 0, gb->map.count, FS_ACCESS_SEQUENTIAL);
+
+    array_iter (piece, &gb->pieces, *) {
+        String s = piece_str(gb, piece);
+        Char *end = s.data + s.count;
+
+        for (Char *p = s.data; (p < end) && (p = memchr(p, '\n', end - p)); p++) {
+            if (++l == line) { result = offset + (p - s.data) + 1; goto done; }
+        }
+
+        offset += s.count;
+    } done:
+
+    fs_advise(gb->map, 0, gb->map.count, FS_ACCESS_RANDOM);
+    return result;
+}
+
 static Void move_gap (GapBuf *gb, U64 idx) {
     if (idx <= gb->gap_idx) {
         Auto p = gb->str.data + idx;
@@ -437,7 +880,10 @@ static Void move_gap_to_end (GapBuf *gb) {
 //
 // Note that calling gb_delete() after this function can
 // undo the effect of this function by shrinking the gap.
+//
+// Lazy buffers ignore this since they edit per page.
 Void gb_set_gap_size (GapBuf *gb, U64 cap) {
+    if (is_lazy(gb)) return;
     if (gb->gap_count >= cap) return;
     U64 inc = gb->gap_min + (cap - gb->gap_count);
     U64 to_move = gb->str.count - gb->gap_count - gb->gap_idx;
@@ -450,6 +896,7 @@ Void gb_set_gap_size (GapBuf *gb, U64 cap) {
 // The idx parameter does not include the gap region.
 // After the insert the first char of str is at idx.
 Void gb_insert (GapBuf *gb, String str, U64 idx) {
+    if (is_lazy(gb)) return lazy_insert(gb, str, idx);
     idx = min(idx, gb->str.count - gb->gap_count);
     gb_set_gap_size(gb, str.count);
     move_gap(gb, idx);
@@ -460,6 +907,7 @@ Void gb_insert (GapBuf *gb, String str, U64 idx) {
 
 // The idx parameter does not include the gap region.
 Void gb_delete (GapBuf *gb, U64 count, U64 idx) {
+    if (is_lazy(gb)) return lazy_delete(gb, count, idx);
     idx   = min(idx, gb->str.count - gb->gap_count);
     count = min(count, gb->str.count - gb->gap_count - idx);
     move_gap(gb, idx + count);
@@ -477,17 +925,60 @@ Void gb_delete (GapBuf *gb, U64 count, U64 idx) {
 }
 
 U64 gb_count (GapBuf *gb) {
-    return gb->str.count - gb->gap_count;
+    return is_lazy(gb) ? gb->lazy_count : (gb->str.count - gb->gap_count);
 }
 
+// A lazy buffer is turned into a normal one by this
+// unless it's unedited, in which case the returned
+// string points into the mapping.
 String gb_str (GapBuf *gb) {
+    if (is_lazy(gb)) {
+        if ((gb->pieces.count == 1) && !gb->pieces.data[0].owned) return piece_str(gb, &gb->pieces.data[0]);
+        lazy_flatten(gb);
+    }
+
     move_gap_to_end(gb);
     return (String){ .data=gb->str.data, .count=gb_count(gb) };
 }
 
+// Returns the text in range [idx, idx+count). If the range
+// is stored contiguously, the result points into the buffer
+// and is valid until the next edit. Otherwise the text gets
+// copied into mem.
+String gb_slice (GapBuf *gb, Mem *mem, U64 idx, U64 count) {
+    idx   = min(idx, gb_count(gb));
+    count = min(count, gb_count(gb) - idx);
+    if (! count) return (String){};
+
+    if (is_lazy(gb)) {
+        U64 piece_idx  = lazy_find_piece(gb, &idx);
+        GbPiece *piece = array_ref(&gb->pieces, piece_idx);
+        if ((idx + count) <= piece->count) return str_slice(piece_str(gb, piece), idx, count);
+
+        AString a = astr_new_cap(mem, count);
+        array_iter_from (piece, &gb->pieces, piece_idx, *) {
+            astr_push_str(&a, str_slice(piece_str(gb, piece), idx, count - a.count));
+            if (a.count == count) break;
+            idx = 0;
+        }
+
+        return astr_to_str(&a);
+    }
+
+    if ((idx + count) <= gb->gap_idx) return (String){ .data=(gb->str.data + idx), .count=count };
+    if (idx >= gb->gap_idx)           return (String){ .data=(gb->str.data + idx + gb->gap_count), .count=count };
+
+    U64 before_gap = gb->gap_idx - idx;
+    AString a = astr_new_cap(mem, count);
+    astr_push_str(&a, (String){ .data=(gb->str.data + idx), .count=before_gap });
+    astr_push_str(&a, (String){ .data=(gb->str.data + gb->gap_idx + gb->gap_count), .count=(count - before_gap) });
+    return astr_to_str(&a);
+}
+
 // The line is 1-indexed and the offset is 0-indexed.
 U64 gb_line_to_offset (GapBuf *gb, U64 line) {
     if (line == 1) return 0;
+    if (is_lazy(gb)) return lazy_line_to_offset(gb, line);
     String s = gb_str(gb);
     U64 l = 1;
     array_iter (c, &s) if ((c == '\n') && (++l == line)) return ARRAY_IDX + 1;
@@ -496,6 +987,7 @@ U64 gb_line_to_offset (GapBuf *gb, U64 line) {
 
 GapBuf *gb_new (Mem *mem, U64 gap_size) {
     Auto gb     = mem_new(mem, GapBuf);
+    gb->mem     = mem;
     gb->str     = astr_new(mem);
     gb->gap_min = max(1*KB, gap_size);
     return gb;
@@ -507,6 +999,7 @@ GapBuf *gb_new_from_file (Mem *mem, String filepath, U64 gap_size) {
     gap_size         = max(1*KB, gap_size);
     Auto gb          = mem_new(mem, GapBuf);
     String file      = fs_read_entire_file(mem, filepath, gap_size);
+    gb->mem          = mem;
     gb->str.mem      = mem;
     gb->str.data     = file.data;
     gb->str.count    = file.count + gap_size + 1;
@@ -516,3 +1009,29 @@ GapBuf *gb_new_from_file (Mem *mem, String filepath, U64 gap_size) {
     gb->gap_idx      = file.count;
     return gb;
 }
+
+// Like gb_new_from_file() but the file is mapped instead
+// of read. See the lazy mode section in the header. Falls
+// back to gb_new_from_file() if the file can't be mapped.
+GapBuf *gb_new_from_file_lazy (Mem *mem, String filepath) {
+    String map = fs_map_file(filepath, FS_ACCESS_RANDOM, 0);
+    if (! map.data) return gb_new_from_file(mem, filepath, 0);
+
+    Auto gb        = gb_new(mem, 0);
+    gb->map        = map;
+    gb->lazy_count = map.count;
+    array_init(&gb->pieces, mem);
+    array_push_lit(&gb->pieces, .count=map.count);
+    return gb;
+}
+
+Void gb_destroy (GapBuf *gb) {
+    if (is_lazy(gb)) {
+        array_iter (piece, &gb->pieces, *) if (piece->owned) gb_destroy(piece->owned);
+        array_free(&gb->pieces);
+        fs_unmap_file(gb->map);
+    }
+
+    array_free(&gb->str);
+    mem_free(gb->mem, .old_ptr=gb, .old_size=sizeof(GapBuf));
+}
@@ -54,8 +54,12 @@ String    str_suffix_from_last  (String, U8 byte);
 Void      str_clear             (String, U8 byte);
 Bool      str_to_u64            (CString, U64 *out, U64 base);
 Bool      str_to_f64            (CString, F64 *out);
+Bool      str_parse_u64         (String, U64 *out, U64 base);
+Bool      str_parse_i64         (String, I64 *out, U64 base);
+Bool      str_parse_f64         (String, F64 *out);
 Void      str_split             (String, String seps, Bool keep_seps, Bool keep_empties, ArrayString *);
 I64       str_fuzzy_search      (String needle, String haystack, ArrayString *);
+Bool      str_glob_match        (String pattern, String);
 String    str_copy              (Mem *, String);
 UtfDecode str_utf8_decode       (String str);
 UtfIter   str_utf8_iter_new     (String str);
@@ -71,6 +75,37 @@ typedef ArrayChar AString;
 #define astr_fmt(MEM, ...)        ({ AString astr = astr_new(MEM); astr_push_fmt(&astr, __VA_ARGS__); astr_to_str(&astr); })
 #define astr_push_fmt_vam(A, FMT) ({ def1(a, A); VaList va; va_start(va, FMT); astr_push_fmt_va(a, FMT, va); va_end(va); })
 
+// The astr_cat macro is a lightweight alternative to the
+// printf family. It's type checked at compile time and it
+// doesn't go through varargs or the libc locale machinery.
+// Each arg is appended according to its type: strings as
+// is while ints and floats get formatted in decimal. Floats
+// are printed with the fewest digits that parse back into
+// the same value:
+//
+//     astr_cat(&a, "cell_", 1.5f, "_", 42); // cell_1.5_42
+//     String s = str_cat(tm, path, "/", name);
+//
+// Note that char literals are ints in C, so 'x' is printed
+// as 120. Use "x" instead.
+#define str_cat(MEM, ...) ({ AString astr = astr_new(MEM); astr_cat(&astr, __VA_ARGS__); astr_to_str(&astr); })
+#define astr_cat(A, ...)  ({ def1(astr_cat_a, A); FOR_EACH(astr_cat_, astr_cat_a, __VA_ARGS__) })
+#define astr_cat_(A, X)\
+    _Generic((X),\
+        String:    astr_push_str,\
+        Char *:    astr_push_cstr,\
+        I8:        astr_push_fmt_i64,\
+        I16:       astr_push_fmt_i64,\
+        I32:       astr_push_fmt_i64,\
+        I64:       astr_push_fmt_i64,\
+        U8:        astr_push_fmt_u64,\
+        U16:       astr_push_fmt_u64,\
+        U32:       astr_push_fmt_u64,\
+        U64:       astr_push_fmt_u64,\
+        F32:       astr_push_fmt_f32,\
+        F64:       astr_push_fmt_f64\
+    )(A, X);
+
 Void    astr_print           (AString *);
 Void    astr_println         (AString *);
 CString astr_to_cstr         (AString *);
@@ -88,6 +123,10 @@ Void    astr_push_cstr       (AString *, CString);
 Void    astr_push_2cstr      (AString *, CString, CString);
 Void    astr_push_cstr_nul   (AString *, CString);
 Void    astr_push_str_quoted (AString *, String);
+Void    astr_push_fmt_u64    (AString *, U64);
+Void    astr_push_fmt_i64    (AString *, I64);
+Void    astr_push_fmt_f32    (AString *, F32);
+Void    astr_push_fmt_f64    (AString *, F64);
 Void    astr_push_fmt_va     Fmt(2, 0) (AString *, CString fmt, VaList);
 Void    astr_push_fmt        Fmt(2, 3) (AString *, CString fmt, ...);
 
@@ -117,14 +156,32 @@ Void    astr_push_fmt        Fmt(2, 3) (AString *, CString fmt, ...);
 //     String str = gb_str(gb);
 //     printf("%.*s\n", STR(str));
 //
+// Lazy mode:
+// ----------
+//
+// A buffer created with gb_new_from_file_lazy() does not read
+// the file. It maps it read-only and keeps a list of pieces
+// where each piece is either a view into the mapping or a
+// small gap buffer holding a page that was edited. Unedited
+// text is served straight from the mapping, so opening a
+// huge file takes constant time and memory use grows with
+// the edits rather than with the file size.
+//
+// Functions that need the whole text at once (gb_str) turn
+// a lazy buffer into a normal one. Use gb_slice() to read
+// parts of the text without doing that.
+//
 // =============================================================================
 istruct (GapBuf);
 
-GapBuf *gb_new            (Mem *, U64 gap_size);
-GapBuf *gb_new_from_file  (Mem *, String filepath, U64 gap_size);
-Void    gb_insert         (GapBuf *, String str, U64 idx);
-Void    gb_delete         (GapBuf *, U64 count, U64 idx);
-U64     gb_count          (GapBuf *);
-String  gb_str            (GapBuf *);
-U64     gb_line_to_offset (GapBuf *, U64 line);
-Void    gb_set_gap_size   (GapBuf *, U64 cap);
+GapBuf *gb_new                (Mem *, U64 gap_size);
+GapBuf *gb_new_from_file      (Mem *, String filepath, U64 gap_size);
+GapBuf *gb_new_from_file_lazy (Mem *, String filepath);
+Void    gb_destroy            (GapBuf *);
+Void    gb_insert             (GapBuf *, String str, U64 idx);
+Void    gb_delete             (GapBuf *, U64 count, U64 idx);
+U64     gb_count              (GapBuf *);
+String  gb_str                (GapBuf *);
+String  gb_slice              (GapBuf *, Mem *, U64 idx, U64 count);
+U64     gb_line_to_offset     (GapBuf *, U64 line);
+Void    gb_set_gap_size       (GapBuf *, U64 cap);
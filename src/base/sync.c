@@ -0,0 +1,136 @@
+#include "base/sync.h"
+#include "os/info.h"
+#include "os/threads.h"
+
+#define MAX_SPIN 100
+
+// Computed lazily so that the primitives work before main().
+// The race on the cache is benign since every thread computes
+// the same value.
+U32 sync_spin_limit () {
+    static U32 cached; // Limit + 1, or 0 if not computed yet.
+    U32 limit = atomic_load_relaxed(&cached);
+
+    if (! limit) {
+        limit = (os_get_proc_count() > 1) ? MAX_SPIN + 1 : 1;
+        atomic_store_relaxed(&cached, limit);
+    }
+
+    return limit - 1;
+}
+
+// =============================================================================
+// Mutex:
+//
+// The state is 0 when unlocked, 1 when locked and 2 when locked
+// with possible waiters. Only the unlock of a mutex in state 2
+// does a syscall. See "Futexes Are Tricky" by Ulrich Drepper.
+//
+// The spin field is a running average of how many spins it took
+// to get the lock, and the spin budget is about twice that. This
+// way a mutex with long critical sections stops wasting cycles.
+// =============================================================================
+static Void mutex_lock_slow (Mutex *m) {
+    U32 spin  = atomic_load_relaxed(&m->spin);
+    U32 limit = min(sync_spin_limit(), 2*spin + 10);
+    U32 i     = 0;
+
+    for (; i < limit; ++i) {
+        if (!atomic_load_relaxed(&m->state) && !atomic_cmp_exchange_acquire(&m->state, 0u, 1u)) break;
+        cpu_relax();
+    }
+
+    atomic_store_relaxed(&m->spin, cast(U32, cast(I32, spin) + (cast(I32, i) - cast(I32, spin))/8));
+    if (i < limit) return;
+
+    while (atomic_exchange_acquire(&m->state, 2u)) os_futex_wait(&m->state, 2);
+}
+
+Void mutex_lock (Mutex *m) {
+    if (atomic_cmp_exchange_acquire(&m->state, 0u, 1u)) mutex_lock_slow(m);
+}
+
+Bool mutex_try_lock (Mutex *m) {
+    return !atomic_cmp_exchange_acquire(&m->state, 0u, 1u);
+}
+
+Void mutex_unlock (Mutex *m) {
+    if (atomic_exchange_release(&m->state, 0u) == 2) os_futex_wake_one(&m->state);
+}
+
+// =============================================================================
+// Event:
+//
+// The state is 0 when unset, 1 when set and 2 when unset with
+// possible waiters.
+// =============================================================================
+Void sync_event_set (SyncEvent *e) {
+    if (atomic_exchange_release(&e->state, 1u) == 2) os_futex_wake_all(&e->state);
+}
+
+Void sync_event_reset (SyncEvent *e) {
+    atomic_cmp_exchange_relaxed(&e->state, 1u, 0u);
+}
+
+Bool sync_event_is_set (SyncEvent *e) {
+    return atomic_load_acquire(&e->state) == 1;
+}
+
+Void sync_event_wait (SyncEvent *e) {
+    for (U32 i = sync_spin_limit(); i; --i) {
+        if (sync_event_is_set(e)) return;
+        cpu_relax();
+    }
+
+    while (true) {
+        U32 s = atomic_load_acquire(&e->state);
+        if (s == 1) return;
+        if (s == 0 && atomic_cmp_exchange_relaxed(&e->state, 0u, 2u)) continue;
+        os_futex_wait(&e->state, 2);
+    }
+}
+
+// =============================================================================
+// Semaphore:
+//
+// The futex sits on the count itself, so a waiter only sleeps
+// while the count is 0. Posters check the waiters counter after
+// bumping the count and waiters bump it before sleeping, so at
+// least one side sees the other (both ops are seq_cst).
+// =============================================================================
+Void semaphore_init (Semaphore *s, U32 count) {
+    atomic_store_relaxed(&s->count, count);
+    atomic_store_relaxed(&s->waiters, 0u);
+}
+
+Bool semaphore_try_wait (Semaphore *s) {
+    U32 c = atomic_load_relaxed(&s->count);
+
+    while (c) {
+        U32 old = atomic_cmp_exchange_acquire(&s->count, c, c - 1);
+        if (old == c) return true;
+        c = old;
+    }
+
+    return false;
+}
+
+Void semaphore_wait (Semaphore *s) {
+    for (U32 i = sync_spin_limit(); i; --i) {
+        if (semaphore_try_wait(s)) return;
+        cpu_relax();
+    }
+
+    while (! semaphore_try_wait(s)) {
+        atomic_inc_load(&s->waiters);
+        os_futex_wait(&s->count, 0);
+        atomic_dec_load(&s->waiters);
+    }
+}
+
+Void semaphore_post (Semaphore *s, U32 n) {
+    atomic_add_load(&s->count, n);
+    if (! atomic_load(&s->waiters)) return;
+    if (n == 1) os_futex_wake_one(&s->count);
+    else os_futex_wake_all(&s->count);
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+// =============================================================================
+// Overview:
+// ---------
+//
+// Lightweight synchronization primitives built directly on top
+// of futexes. Unlike OsMutex and friends they are plain structs
+// that live inline in whatever owns them. There is nothing to
+// allocate or destroy: zero initialize and use.
+//
+// The uncontended paths are a single atomic op and never enter
+// the kernel. Under contention the waiter first spins for a bit
+// (critical sections are usually short), and only then parks on
+// the futex. The mutex adapts its spin budget to how long it
+// took to acquire the lock recently. Spinning is disabled if
+// there is only one cpu since it can't possibly help there.
+//
+// Primitives:
+//
+//     Mutex      Not recursive.
+//     SyncEvent  Manual reset event. Once set, all current and
+//                future waiters pass until it's reset.
+//     Semaphore  Counting semaphore.
+//
+// Usage example:
+// --------------
+//
+//     istruct (Cache) { Mutex lock; SyncEvent ready; Map(...) map; };
+//
+//     Void cache_insert (Cache *c, ...) {
+//         mutex_scoped_lock(&c->lock);
+//         map_add(&c->map, ...);
+//     }
+//
+//     Void loader (Cache *c) { ...; sync_event_set(&c->ready); }
+//     Void user   (Cache *c) { sync_event_wait(&c->ready); ... }
+//
+// =============================================================================
+#include "base/core.h"
+
+// Zero initialize before use. Don't copy once in use.
+istruct (Mutex)     { U32 state; U32 spin; }; // Private.
+istruct (SyncEvent) { U32 state; };           // Private.
+istruct (Semaphore) { U32 count; U32 waiters; };
+
+Void mutex_lock     (Mutex *);
+Bool mutex_try_lock (Mutex *);
+Void mutex_unlock   (Mutex *);
+
+inl Void mutex_unlock_ (Mutex **m) { mutex_unlock(*m); }
+#define  mutex_scoped_lock(M) cleanup(mutex_unlock_) Mutex *JOIN(_, __LINE__) = (M); mutex_lock(JOIN(_, __LINE__));
+
+Void sync_event_set    (SyncEvent *);
+Void sync_event_reset  (SyncEvent *);
+Void sync_event_wait   (SyncEvent *);
+Bool sync_event_is_set (SyncEvent *);
+
+Void semaphore_init     (Semaphore *, U32 count);
+Void semaphore_wait     (Semaphore *);
+Bool semaphore_try_wait (Semaphore *);
+Void semaphore_post     (Semaphore *, U32 n);
+
+// How many times to spin before sleeping in a hand-rolled wait
+// loop. It's 0 if there is only one cpu.
+U32 sync_spin_limit ();
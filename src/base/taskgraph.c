@@ -0,0 +1,100 @@
+#include "base/taskgraph.h"
+#include "base/array.h"
+
+array_typedef(TaskNode*, TaskNode);
+
+istruct (TaskNode) {
+    TaskGraph *graph;
+    TPoolFn *fn;
+    Void *fn_arg;
+    U32 dep_count;
+    U32 pending; // Unfinished dependencies in the current run.
+    ArrayTaskNode dependents;
+};
+
+istruct (TaskGraph) {
+    Mem *mem;
+    TPool *tp;
+    Bool validated;
+    TPoolGroup group;
+    ArrayTaskNode nodes;
+};
+
+TaskGraph *taskgraph_new (Mem *mem, TPool *tp) {
+    Auto g = mem_new(mem, TaskGraph);
+    g->mem = mem;
+    g->tp = tp;
+    array_init(&g->nodes, mem);
+    return g;
+}
+
+Void taskgraph_destroy (TaskGraph *g) {
+    array_iter (node, &g->nodes) {
+        array_free(&node->dependents);
+        mem_free(g->mem, .old_ptr=node, .old_size=sizeof(TaskNode));
+    }
+
+    array_free(&g->nodes);
+    mem_free(g->mem, .old_ptr=g, .old_size=sizeof(TaskGraph));
+}
+
+TaskNode *taskgraph_add (TaskGraph *g, TPoolFn fn, Void *fn_arg) {
+    Auto node = mem_new(g->mem, TaskNode);
+    node->graph = g;
+    node->fn = fn;
+    node->fn_arg = fn_arg;
+    array_init(&node->dependents, g->mem);
+    array_push(&g->nodes, node);
+    g->validated = false;
+    return node;
+}
+
+Void taskgraph_depend (TaskGraph *g, TaskNode *node, TaskNode *dependency) {
+    assert_dbg(node->graph == g && dependency->graph == g);
+    array_push(&dependency->dependents, node);
+    node->dep_count++;
+    g->validated = false;
+}
+
+// Kahn's algorithm: if the topological sort doesn't reach
+// every node, then the rest of them are part of a cycle.
+static Void validate (TaskGraph *g) {
+    tmem_new(tm);
+    ArrayTaskNode ready;
+    array_init(&ready, tm);
+
+    array_iter (node, &g->nodes) {
+        node->pending = node->dep_count;
+        if (! node->pending) array_push(&ready, node);
+    }
+
+    U64 visited = 0;
+
+    while (ready.count) {
+        TaskNode *node = array_pop(&ready);
+        visited++;
+        array_iter (dep, &node->dependents) if (--dep->pending == 0) array_push(&ready, dep);
+    }
+
+    assert_always(visited == g->nodes.count);
+    g->validated = true;
+}
+
+static TPOOL_FN(run_node) {
+    TaskNode *node = arg;
+    TaskGraph *g = node->graph;
+    node->fn(node->fn_arg, worker_id);
+
+    array_iter (dep, &node->dependents) {
+        if (atomic_dec_load(&dep->pending) == 0) tpool_group_push(g->tp, &g->group, run_node, dep);
+    }
+}
+
+Void taskgraph_run (TaskGraph *g) {
+    if (! g->validated) validate(g);
+
+    array_iter (node, &g->nodes) node->pending = node->dep_count;
+    array_iter (node, &g->nodes) if (! node->dep_count) tpool_group_push(g->tp, &g->group, run_node, node);
+
+    tpool_group_wait(g->tp, &g->group);
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+// =============================================================================
+// Overview:
+// ---------
+//
+// A reusable graph of tasks with dependencies that runs on a
+// TPool. A node becomes ready once all of the nodes it depends
+// on are done, and ready nodes run in parallel.
+//
+// The graph is built once and then run any number of times. A
+// run only resets a counter per node, so nothing is allocated
+// after the graph is built. The graph is validated for cycles
+// on the first run after it changed.
+//
+// The taskgraph_run function returns once all nodes are done.
+// It can be called from inside a TPoolFn, in which case the
+// worker helps run tasks while waiting.
+//
+// Usage example:
+// --------------
+//
+//     TaskGraph *g = taskgraph_new(mem, tp);
+//     TaskNode *style = taskgraph_add(g, style_fn, 0);
+//     TaskNode *x     = taskgraph_add(g, layout_fn, cast(Void*, 0));
+//     TaskNode *y     = taskgraph_add(g, layout_fn, cast(Void*, 1));
+//     TaskNode *hover = taskgraph_add(g, hover_fn, 0);
+//
+//     taskgraph_depend(g, x, style); // x runs after style.
+//     taskgraph_depend(g, y, style);
+//     taskgraph_depend(g, hover, x);
+//     taskgraph_depend(g, hover, y);
+//
+//     while (running) taskgraph_run(g); // The x and y nodes overlap.
+//
+// =============================================================================
+#include "base/core.h"
+#include "base/mem.h"
+#include "base/tpool.h"
+
+istruct (TaskGraph);
+istruct (TaskNode);
+
+TaskGraph *taskgraph_new     (Mem *, TPool *);
+Void       taskgraph_destroy (TaskGraph *);
+TaskNode  *taskgraph_add     (TaskGraph *, TPoolFn, Void *fn_arg);
+Void       taskgraph_depend  (TaskGraph *, TaskNode *node, TaskNode *dependency);
+Void       taskgraph_run     (TaskGraph *);
@@ -1,142 +1,887 @@
 #include "base/mem.h"
+#include "base/log.h"
+#include "base/mpmc.h"
 #include "base/tpool.h"
+#include "os/fs.h"
+#include "os/info.h"
+#include "os/time.h"
 #include "os/threads.h"
 
+#if TPOOL_TRACE
+    #define IF_TRACE(...) __VA_ARGS__
+#else
+    #define IF_TRACE(...)
+#endif
+
+istruct (Fiber);
+
+// Number of unfinished child tasks of a running task. When a
+// fiber parks on its counter the COUNTER_WAITER bit is set in
+// pending and whoever takes the count to 0 resumes the waiter.
+// Only the fiber that owns the counter can wait on it.
+istruct (Counter) {
+    U64 pending;
+    Fiber *waiter;
+};
+
+#define COUNTER_WAITER (1ull << 63)
+
+// A task is tracked either by the children counter of the
+// task that pushed it, or by a group. Grouped tasks are also
+// tracked by the root group so that tpool_wait sees them.
+ienum (TaskFlags, U8) {
+    TASK_FIBER  = flag(0), // Run the task on a fiber.
+    TASK_RESUME = flag(1), // The fn_arg is a suspended Fiber to resume.
+};
+
 istruct (Task) {
-    Task *next;
     TPoolFn *fn;
     Void *fn_arg;
+    Counter *counter;
+    TPoolGroup *group;
+    TaskFlags flags;
+    IF_TRACE(U64 push_ns;)
+};
+
+istruct (TraceEvent) {
+    TPoolFn *fn;
+    U64 begin_ns;
+    U64 end_ns;
+    TaskFlags flags;
+};
+
+ienum (FiberState, U8) {
+    FIBER_RUNNING,
+    FIBER_YIELDED,      // Goes to the back of the injection queue.
+    FIBER_WAIT_COUNTER, // Parks on its children counter.
+    FIBER_WAIT_GROUP,   // Parks on the wait_group.
+    FIBER_DONE,
+};
+
+// A fiber can move between threads when it's resumed, so it
+// can't use the thread local TMem ring or log of any thread.
+// Instead each fiber owns a ring and a log, and the worker
+// points the tmem_ring and log_data thread locals at them
+// while the fiber runs. Fibers are recycled together with
+// their stacks, rings and logs.
+istruct (Fiber) {
+    OsFiber *os;
+    Task task;
+    Counter children;
+    FiberState state;
+    TMemRing *tmem;
+    Log *log;
+    TPoolGroup *wait_group;
+    Fiber *next; // In the list of fibers parked on a group.
+};
+
+// The TPoolGroup.state field packs the number of unfinished
+// tasks together with some flags into one futex word:
+#define GROUP_THEN    1u  // A continuation is attached.
+#define GROUP_WAITERS 2u  // Someone is parked on the futex.
+#define GROUP_FIBERS  4u  // The TPoolGroup.fibers list is valid.
+#define GROUP_LOCK    8u  // Someone is editing the fibers list.
+#define GROUP_ONE     16u // One unfinished task.
+
+// A fixed capacity Chase-Lev deque. Only the owner pushes and
+// pops at the bottom, while thieves take from the top. Tasks
+// are stored by value. A thief copies the task before claiming
+// it with a CAS on top, which is fine since the owner can only
+// overwrite a slot after top has moved past it.
+istruct (Deque) {
+    alignas(CACHE_LINE) I64 top;
+    alignas(CACHE_LINE) I64 bottom;
+    alignas(CACHE_LINE) I64 capacity; // Power of 2.
+    Task *tasks;
 };
 
 istruct (Worker) {
     U64 id;
+    U32 cpu;           // Only used if the pool pins workers.
     TPool *pool;
     OsThread *thread;
-};
+    Counter *children; // Of the task currently being run.
+    OsFiber *home;     // The stack of the worker thread.
+    Fiber *fiber;      // Currently running fiber or 0.
+    TMemRing *tmem;    // Of the thread while a fiber runs.
+    Log *log;          // Of the thread while a fiber runs.
+    Deque deque;
 
-array_typedef(Task, Task);
-array_typedef(Worker, Worker);
+    IF_TRACE(
+        TPoolStats stats;
+        U64 trace_head; // Count of events ever written.
+        TraceEvent *trace_ring;
+    )
+};
 
+// Nothing in here takes a lock. Workers that run out of tasks
+// spin for a bit and then park on the wake_seq futex. Outside
+// callers of tpool_wait park on the root group.
 istruct (TPool) {
     Mem *mem;
-
-    ArrayTask task_ring;
-    U64 task_ring_count;
-    U64 task_ring_cursor;
-
-    OsMutex *mutex;     // Protects all of TPool.
-    OsCondVar *task_cv; // Signal that new tasks have arrived.
-    OsCondVar *push_cv; // Signal that task queue is not full.
-    OsCondVar *done_cv; // Signal that we are out of work or stopped.
-
-    ArrayWorker workers;
+    Worker *workers;
     U64 worker_count;
-    U64 working_count; // Number of workers running their TPoolFn.
-    Bool pending_push;
+    U64 deque_capacity;
+    Bool pin;
+    TPoolGroup root; // Tracks all tasks except children of tasks.
+    Mpmc(Task) injection; // Tasks pushed from the outside.
+    Mpmc(Fiber*) free_fibers;
+
+    alignas(CACHE_LINE) U32 wake_seq; // Bumped when tasks arrive.
+    U64 sleepers;
     Bool stop;
 };
 
-static Void worker (Void *arg) {
+static tls Worker *current_worker;
+
+// Code running on a fiber can resume on a different thread,
+// and the compiler is allowed to cache the address of a thread
+// local across function calls. Going through a function that
+// can't be inlined forces a fresh lookup.
+[[gnu::noinline]] static Worker *get_worker () {
+    return current_worker;
+}
+
+static Bool deque_push (Deque *dq, Task task) {
+    I64 b = atomic_load(&dq->bottom);
+    I64 t = atomic_load(&dq->top);
+    if ((b - t) >= dq->capacity) return false;
+    dq->tasks[b & (dq->capacity - 1)] = task;
+    atomic_store(&dq->bottom, b + 1);
+    return true;
+}
+
+static Bool deque_pop (Deque *dq, Task *out) {
+    I64 b = atomic_load(&dq->bottom) - 1;
+    atomic_store(&dq->bottom, b);
+    I64 t = atomic_load(&dq->top);
+
+    if (t > b) {
+        atomic_store(&dq->bottom, b + 1);
+        return false;
+    }
+
+    *out = dq->tasks[b & (dq->capacity - 1)];
+    if (t < b) return true;
+
+    // Last task: race the thieves for it.
+    Bool won = (atomic_cmp_exchange(&dq->top, t, t + 1) == t);
+    atomic_store(&dq->bottom, b + 1);
+    return won;
+}
+
+static Bool deque_steal (Deque *dq, Task *out) {
+    I64 t = atomic_load(&dq->top);
+    I64 b = atomic_load(&dq->bottom);
+    if (t >= b) return false;
+    Task task = dq->tasks[t & (dq->capacity - 1)];
+    if (atomic_cmp_exchange(&dq->top, t, t + 1) != t) return false;
+    *out = task;
+    return true;
+}
+
+static Bool deque_is_empty (Deque *dq) {
+    return atomic_load(&dq->top) >= atomic_load(&dq->bottom);
+}
+
+static Bool has_work (TPool *tp) {
+    if (mpmc_count(&tp->injection)) return true;
+    for (U64 i = 0; i < tp->worker_count; ++i) if (! deque_is_empty(&tp->workers[i].deque)) return true;
+    return false;
+}
+
+static Void wake_worker (TPool *tp) {
+    if (! atomic_load(&tp->sleepers)) return;
+    atomic_inc_load(&tp->wake_seq);
+    os_futex_wake_one(&tp->wake_seq);
+}
+
+#if TPOOL_TRACE
+// Stats only have one writer so they don't need atomic rmw ops.
+static Void stat_add (U64 *stat, U64 n) {
+    atomic_store_relaxed(stat, atomic_load_relaxed(stat) + n);
+}
+
+static TraceEvent trace_begin (Worker *w, Task *task) {
+    TraceEvent ev = { .fn=task->fn, .begin_ns=os_time_ns(), .flags=task->flags };
+    if (task->flags & TASK_RESUME) ev.fn = cast(Fiber*, task->fn_arg)->task.fn;
+
+    U64 wait   = (ev.begin_ns > task->push_ns) ? ev.begin_ns - task->push_ns : 0;
+    U64 bucket = min(63u - cast(U64, __builtin_clzll(wait | 1)), TPOOL_TRACE_HIST_BUCKETS - 1u);
+    stat_add(&w->stats.queue_wait_hist[bucket], 1);
+    stat_add(&w->stats.tasks_run, 1);
+    return ev;
+}
+
+static Void trace_end (Worker *w, TraceEvent *ev) {
+    ev->end_ns = os_time_ns();
+    U64 head = atomic_load_relaxed(&w->trace_head);
+    w->trace_ring[head % TPOOL_TRACE_RING_SIZE] = *ev;
+    atomic_store_release(&w->trace_head, head + 1);
+}
+#endif
+
+// Own deque first, then the injection queue, then steal
+// starting from a random victim to spread out contention.
+static Bool find_task (Worker *w, Task *out) {
+    TPool *tp = w->pool;
+    if (deque_pop(&w->deque, out)) return true;
+    if (mpmc_pop(&tp->injection, out)) return true;
+
+    U64 n = tp->worker_count;
+    U64 start = random_range(0, n);
+
+    for (U64 i = 0; i < n; ++i) {
+        Worker *victim = &tp->workers[(start + i) % n];
+        if ((victim != w) && deque_steal(&victim->deque, out)) {
+            IF_TRACE(stat_add(&w->stats.steals, 1);)
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static Void run_task (Worker *w, Task *task);
+
+static Void help_once (Worker *w) {
+    Task task;
+    if (find_task(w, &task)) run_task(w, &task);
+    else os_thread_yield();
+}
+
+static Void help_until_done (Worker *w, Counter *counter) {
+    while (atomic_load(&counter->pending)) help_once(w);
+}
+
+// Switches back to the worker which then queues or parks the
+// fiber depending on the state. See run_fiber.
+static Void fiber_suspend (Fiber *f, FiberState state) {
+    f->state = state;
+    os_fiber_switch(f->os, get_worker()->home);
+}
+
+static Void fiber_yield (Fiber *f) {
+    fiber_suspend(f, FIBER_YIELDED);
+}
+
+// One step of waiting for something. A fiber gets suspended,
+// a worker runs another task and other threads just yield.
+static Void wait_step (TPool *tp) {
+    Worker *w = get_worker();
+    if (! (w && (w->pool == tp))) os_thread_yield();
+    else if (w->fiber) fiber_yield(w->fiber);
+    else help_once(w);
+}
+
+// Waits for the children of the running task. A fiber parks
+// until the last child is done instead of spinning through
+// the queue, so a pool that has nothing else to do can sleep.
+static Void wait_children (Worker *w, Counter *children) {
+    if (w->fiber) {
+        Fiber *f = w->fiber; // Don't touch w after the switch.
+        while (atomic_load(&children->pending)) fiber_suspend(f, FIBER_WAIT_COUNTER);
+    } else {
+        help_until_done(w, children);
+    }
+}
+
+static Void push_injection (TPool *tp, Task task) {
+    while (! mpmc_push(&tp->injection, task)) wait_step(tp);
+    wake_worker(tp);
+}
+
+// Resumes a parked fiber. It's pushed to the deque of the
+// calling worker when possible since whatever woke it up is
+// probably still in the cache.
+static Task resume_task (Fiber *f) {
+    Task task = { .fn_arg=f, .flags=TASK_RESUME };
+    IF_TRACE(task.push_ns = os_time_ns();)
+    return task;
+}
+
+static Void resume_fiber (TPool *tp, Fiber *f) {
+    Task task = resume_task(f);
+    Worker *w = get_worker();
+
+    if (w && (w->pool == tp) && deque_push(&w->deque, task)) {
+        wake_worker(tp);
+    } else {
+        push_injection(tp, task);
+    }
+}
+
+static Void group_add (TPoolGroup *g) {
+    U32 v = atomic_add_load(&g->state, GROUP_ONE);
+    assert_always(v >= GROUP_ONE); // Overflow.
+}
+
+// The task is tracked by the group and the root group. It
+// is never run inline, because this is also used to push
+// continuations from places where that could deadlock.
+static Void push_grouped (TPool *tp, TPoolGroup *g, TPoolFn fn, Void *fn_arg, TaskFlags flags) {
+    Task task = { .fn=fn, .fn_arg=fn_arg, .group=g, .flags=flags };
+    IF_TRACE(task.push_ns = os_time_ns();)
+    if (g != &tp->root) group_add(g);
+    group_add(&tp->root);
+
+    Worker *w = get_worker();
+
+    if (w && (w->pool == tp) && deque_push(&w->deque, task)) {
+        wake_worker(tp);
+    } else {
+        push_injection(tp, task);
+    }
+}
+
+// Once the count drops to 0 the owner of the group may free
+// it, so the group must not be touched after the final CAS.
+// That's why the continuation and the parked fibers are copied
+// out beforehand, and why the flags share a word with the count.
+//
+// The fibers list is read under the GROUP_LOCK, since without
+// it a fiber could park and leave the word as it was, and the
+// final CAS would succeed with a stale list.
+static Void group_release (TPool *tp, TPoolGroup *g) {
+    U32 v = atomic_load(&g->state);
+    Bool locked = false;
+
+    while (true) {
+        assert_dbg(v >= GROUP_ONE);
+
+        if (v >= 2*GROUP_ONE) {
+            U32 new = (v - GROUP_ONE) & ~(locked ? GROUP_LOCK : 0);
+            U32 old = atomic_cmp_exchange(&g->state, v, new);
+            if (old == v) return;
+            v = old;
+            continue;
+        }
+
+        if ((v & GROUP_LOCK) && !locked) {
+            os_thread_yield();
+            v = atomic_load(&g->state);
+            continue;
+        }
+
+        if ((v & GROUP_FIBERS) && !locked) {
+            U32 old = atomic_cmp_exchange(&g->state, v, v | GROUP_LOCK);
+            if (old != v) { v = old; continue; }
+            v |= GROUP_LOCK;
+            locked = true;
+            continue;
+        }
+
+        TPoolFn *then_fn = g->then_fn;
+        Void *then_arg   = g->then_arg;
+        Fiber *fibers    = locked ? g->fibers : 0;
+        U32 old          = atomic_cmp_exchange(&g->state, v, 0);
+
+        if (old != v) {
+            v = old;
+            continue;
+        }
+
+        if (v & GROUP_THEN) push_grouped(tp, &tp->root, then_fn, then_arg, 0);
+
+        while (fibers) {
+            Fiber *next = fibers->next; // Read before it can park again.
+            resume_fiber(tp, fibers);
+            fibers = next;
+        }
+
+        if (v & GROUP_WAITERS) os_futex_wake_all(&g->state);
+        return;
+    }
+}
+
+// Adds the fiber to the list of the group unless the group is
+// already done, in which case it returns false. A stale list
+// left over from an earlier use of the group is dropped.
+static Bool group_park (TPoolGroup *g, Fiber *f) {
+    U32 v = atomic_load(&g->state);
+
+    while (true) {
+        if (v < GROUP_ONE) return false;
+
+        if (v & GROUP_LOCK) {
+            os_thread_yield();
+            v = atomic_load(&g->state);
+            continue;
+        }
+
+        U32 old = atomic_cmp_exchange(&g->state, v, v | GROUP_LOCK);
+        if (old == v) break;
+        v = old;
+    }
+
+    // The count can't reach 0 while we hold the lock.
+    f->next = (v & GROUP_FIBERS) ? g->fibers : 0;
+    g->fibers = f;
+    v |= GROUP_LOCK;
+
+    while (true) {
+        U32 old = atomic_cmp_exchange(&g->state, v, (v & ~GROUP_LOCK) | GROUP_FIBERS);
+        if (old == v) return true;
+        v = old;
+    }
+}
+
+// Returns false if the counter is already 0.
+static Bool counter_park (Counter *c, Fiber *f) {
+    c->waiter = f;
+    U64 v = atomic_load(&c->pending);
+
+    while (v) {
+        U64 old = atomic_cmp_exchange(&c->pending, v, v | COUNTER_WAITER);
+        if (old == v) return true;
+        v = old;
+    }
+
+    return false;
+}
+
+// The count never goes up while a fiber is parked on it,
+// so only one caller can see the bare COUNTER_WAITER bit.
+static Void counter_dec (TPool *tp, Counter *c) {
+    if (atomic_dec_load(&c->pending) != COUNTER_WAITER) return;
+    Fiber *f = c->waiter;
+    atomic_store(&c->pending, 0);
+    resume_fiber(tp, f);
+}
+
+static Void finish (TPool *tp, Task *task) {
+    if (task->counter) counter_dec(tp, task->counter);
+    if (! task->group) return;
+    if (task->group != &tp->root) group_release(tp, task->group);
+    group_release(tp, &tp->root);
+}
+
+// =============================================================================
+// Fibers:
+// =============================================================================
+#define FIBER_STACK_SIZE (256*KB)
+#define FIBER_TMEM_SIZE  (256*KB)
+#define FIBER_LOG_SIZE   (4*KB)
+#define FIBER_POOL_SIZE  64
+
+// Each loop iteration runs one task. The implicit wait for the
+// children happens here by suspending rather than helping, so
+// that the fiber doesn't pin its worker.
+static Void fiber_main (Void *arg) {
+    Fiber *f = arg;
+
+    while (true) {
+        f->task.fn(f->task.fn_arg, get_worker()->id);
+        while (atomic_load(&f->children.pending)) fiber_suspend(f, FIBER_WAIT_COUNTER);
+        f->state = FIBER_DONE;
+        os_fiber_switch(f->os, get_worker()->home);
+    }
+}
+
+static Fiber *fiber_new () {
+    Fiber *f = mem_new(mem_root, Fiber);
+    f->os = os_fiber_new(mem_root, FIBER_STACK_SIZE, fiber_main, f);
+    assert_always(f->os);
+
+    TMemRing *tmem = tmem_ring;
+    Log *log = log_data;
+    tmem_setup(mem_root, FIBER_TMEM_SIZE);
+    log_setup(mem_root, FIBER_LOG_SIZE);
+    f->tmem = tmem_ring;
+    f->log = log_data;
+    tmem_ring = tmem;
+    log_data = log;
+
+    return f;
+}
+
+static Void fiber_destroy (Fiber *f) {
+    TMemRing *tmem = tmem_ring;
+    Log *log = log_data;
+    tmem_ring = f->tmem;
+    log_data = f->log;
+    tmem_teardown();
+    log_teardown();
+    tmem_ring = tmem;
+    log_data = log;
+
+    os_fiber_destroy(f->os, mem_root);
+    mem_free(mem_root, .old_ptr=f, .old_size=sizeof(Fiber));
+}
+
+// Runs or resumes the fiber until it finishes or suspends.
+// A yielded fiber is pushed to the back of the injection queue
+// so that it gets resumed after other pending work. A waiting
+// fiber is parked on its counter or group and gets resumed by
+// whoever completes it. Both must happen after switching away
+// from the fiber since another worker could pick it up right
+// away.
+static Void run_fiber (Worker *w, Fiber *f) {
+    TPool *tp     = w->pool;
+    Counter *prev = w->children;
+
+    w->fiber    = f;
+    w->children = &f->children;
+    w->tmem     = tmem_ring;
+    w->log      = log_data;
+    tmem_ring   = f->tmem;
+    log_data    = f->log;
+    f->state    = FIBER_RUNNING;
+
+    os_fiber_switch(w->home, f->os);
+
+    tmem_ring   = w->tmem;
+    log_data    = w->log;
+    w->fiber    = 0;
+    w->children = prev;
+
+    switch (f->state) {
+    case FIBER_RUNNING:      badpath;
+    case FIBER_YIELDED:      push_injection(tp, resume_task(f)); break;
+    case FIBER_WAIT_COUNTER: if (! counter_park(&f->children, f)) resume_fiber(tp, f); break;
+    case FIBER_WAIT_GROUP:   if (! group_park(f->wait_group, f)) resume_fiber(tp, f); break;
+    case FIBER_DONE:
+        Task task = f->task;
+        if (! mpmc_push(&tp->free_fibers, f)) fiber_destroy(f);
+        finish(tp, &task);
+        break;
+    }
+}
+
+static Void start_fiber (Worker *w, Task *task) {
+    Fiber *f;
+    if (! mpmc_pop(&w->pool->free_fibers, &f)) f = fiber_new();
+    f->task = *task;
+    f->children = (Counter){};
+    run_fiber(w, f);
+}
+
+static Void run_plain_task (Worker *w, Task *task) {
+    Counter children = {};
+    Counter *prev = w->children;
+    w->children = &children;
+    task->fn(task->fn_arg, w->id);
+    help_until_done(w, &children);
+    w->children = prev;
+    finish(w->pool, task);
+}
+
+static Void run_task (Worker *w, Task *task) {
+    IF_TRACE(TraceEvent ev = trace_begin(w, task);)
+
+    if (task->flags & TASK_RESUME)     run_fiber(w, task->fn_arg);
+    else if (task->flags & TASK_FIBER) start_fiber(w, task);
+    else                               run_plain_task(w, task);
+
+    IF_TRACE(trace_end(w, &ev);)
+}
+
+static Void worker_loop (Void *arg) {
     Auto w  = cast(Worker*, arg);
     Auto tp = w->pool;
+    U64 idle_rounds = 0;
+    current_worker = w;
+    w->home = os_fiber_from_thread(mem_root);
+    if (tp->pin) os_thread_pin_self(w->cpu);
+    IF_TRACE(U64 mark = os_time_ns();)
 
     while (true) {
-        os_mutex_lock(tp->mutex);
-        while (!tp->stop && (tp->task_ring_count == 0)) os_cond_var_wait(tp->task_cv, tp->mutex);
-        if (tp->stop) break;
-        Auto task = array_get(&tp->task_ring, tp->task_ring_cursor);
-        tp->task_ring_cursor = (tp->task_ring_cursor + 1) % tp->task_ring.count;
-        tp->task_ring_count--;
-        tp->working_count++;
-        os_cond_var_signal(tp->push_cv);
-        os_mutex_unlock(tp->mutex);
+        Task task;
+
+        if (find_task(w, &task)) {
+            IF_TRACE(U64 start = os_time_ns(); stat_add(&w->stats.idle_ns, start - mark);)
+            run_task(w, &task);
+            IF_TRACE(mark = os_time_ns(); stat_add(&w->stats.busy_ns, mark - start);)
+            idle_rounds = 0;
+            continue;
+        }
 
-        task.fn(task.fn_arg, w->id);
+        if (atomic_load(&tp->stop)) break;
 
-        os_mutex_lock(tp->mutex);
-        tp->working_count--;
-        if (!tp->stop && !tp->task_ring_count && (tp->working_count == 0)) os_cond_var_signal(tp->done_cv);
-        os_mutex_unlock(tp->mutex);
+        if (++idle_rounds < 64) {
+            os_thread_yield();
+            continue;
+        }
+
+        // Pushers check the sleepers count after publishing a
+        // task, and we check for tasks after bumping it, so at
+        // least one side is guaranteed to see the other. If a
+        // pusher bumps wake_seq after we read it, the futex
+        // wait returns immediately.
+        idle_rounds = 0;
+        U32 seq = atomic_load(&tp->wake_seq);
+        atomic_inc_load(&tp->sleepers);
+        if (!atomic_load(&tp->stop) && !has_work(tp)) os_futex_wait(&tp->wake_seq, seq);
+        atomic_dec_load(&tp->sleepers);
     }
+}
+
+// Lists the cpus workers may run on in the order they should
+// be assigned: the first hardware thread of every core, then
+// the second one of every core, and so on. If the reservation
+// would leave no cores, it's ignored.
+static Void pick_cpus (TPoolConfig *cfg, ArrayU32 *out) {
+    OsTopology *topo = os_get_topology();
+    U32 reserve = (cfg->reserve_cores < topo->core_count) ? cfg->reserve_cores : 0;
+    U32 max_smt = 0;
+
+    if (! cfg->skip_smt) array_iter (cpu, &topo->cpus, *) max_smt = max(max_smt, cpu->smt_index);
 
-    tp->worker_count--;
-    if (tp->worker_count == 0) {
-        os_cond_var_signal(tp->done_cv);
-        os_cond_var_signal(tp->push_cv);
+    for (U32 smt = 0; smt <= max_smt; ++smt) {
+        array_iter (cpu, &topo->cpus, *) if (cpu->smt_index == smt && cpu->core >= reserve) array_push(out, cpu->id);
     }
-    os_mutex_unlock(tp->mutex);
 }
 
 // The allocator passed in here does not have to be thread safe,
 // or owned by the pool since only this function will touch it.
+//
+// The queue_size is the capacity of the injection queue and
+// of each worker deque.
 TPool *tpool_new (Mem *mem, U64 worker_count, U64 queue_size) {
-    TPool *tp        = mem_new(mem, TPool);
-    tp->mem          = mem;
-    tp->worker_count = worker_count ?: 2;
-    tp->mutex        = os_mutex_new(mem);
-    tp->task_cv      = os_cond_var_new(mem);
-    tp->push_cv      = os_cond_var_new(mem);
-    tp->done_cv      = os_cond_var_new(mem);
+    return tpool_new_ex(mem, .worker_count=worker_count, .queue_size=queue_size, .skip_smt=true);
+}
+
+TPool *tpool_new_cfg (Mem *mem, TPoolConfig *cfg) {
+    tmem_new(tm);
+    ArrayU32 cpus;
+    array_init(&cpus, tm);
+    pick_cpus(cfg, &cpus);
 
-    array_init(&tp->task_ring, mem);
-    array_ensure_count(&tp->task_ring, queue_size, 0);
+    U64 queue_size     = cfg->queue_size ?: 1*KB;
+    TPool *tp          = mem_new(mem, TPool);
+    tp->mem            = mem;
+    tp->pin            = cfg->pin && cpus.count;
+    tp->worker_count   = cfg->worker_count ?: max(cpus.count, 1u);
+    tp->deque_capacity = next_pow2(max(queue_size, 2u));
+    tp->workers        = mem_alloc(mem, Worker, .zeroed=true, .align=CACHE_LINE, .size=(tp->worker_count * sizeof(Worker)));
 
-    array_init(&tp->workers, mem);
-    array_ensure_count(&tp->workers, worker_count, 0);
+    mpmc_init(&tp->injection, mem, queue_size);
+    mpmc_init(&tp->free_fibers, mem, FIBER_POOL_SIZE);
 
-    array_iter (w, &tp->workers, *) {
-        w->id     = ARRAY_IDX;
-        w->pool   = tp;
-        w->thread = os_thread_new(mem, worker, w);
-        os_thread_detach(w->thread);
+    for (U64 i = 0; i < tp->worker_count; ++i) {
+        Worker *w = &tp->workers[i];
+        w->id = i;
+        w->pool = tp;
+        w->cpu = cpus.count ? array_get(&cpus, i % cpus.count) : 0;
+        w->deque.capacity = tp->deque_capacity;
+        w->deque.tasks = mem_alloc(mem, Task, .size=(tp->deque_capacity * sizeof(Task)));
+        IF_TRACE(w->trace_ring = mem_alloc(mem, TraceEvent, .size=(TPOOL_TRACE_RING_SIZE * sizeof(TraceEvent)));)
     }
 
+    // Start threads only after all deques are ready to be stolen from.
+    for (U64 i = 0; i < tp->worker_count; ++i) tp->workers[i].thread = os_thread_new(mem, worker_loop, &tp->workers[i]);
+
     return tp;
 }
 
-// This function might suspend the caller until currently
-// running tasks are finished. Tasks that are waiting in
-// the queue to be run will be removed.
+// This function suspends the caller until all tasks are
+// done and all worker threads have shut down.
 Void tpool_destroy (TPool *tp) {
-    os_mutex_lock(tp->mutex);
-    tp->stop = true;
-    os_cond_var_broadcast(tp->task_cv);
-    os_mutex_unlock(tp->mutex);
-
     tpool_wait(tp);
 
-    os_cond_var_destroy(tp->task_cv, tp->mem);
-    os_cond_var_destroy(tp->done_cv, tp->mem);
-    os_mutex_destroy(tp->mutex, tp->mem);
+    atomic_store(&tp->stop, true);
+    atomic_inc_load(&tp->wake_seq);
+    os_futex_wake_all(&tp->wake_seq);
+
+    for (U64 i = 0; i < tp->worker_count; ++i) {
+        Worker *w = &tp->workers[i];
+        os_thread_join(w->thread);
+        os_thread_destroy(w->thread, tp->mem);
+        os_fiber_destroy(w->home, mem_root);
+        mem_free(tp->mem, .old_ptr=w->deque.tasks, .old_size=(tp->deque_capacity * sizeof(Task)));
+        IF_TRACE(mem_free(tp->mem, .old_ptr=w->trace_ring, .old_size=(TPOOL_TRACE_RING_SIZE * sizeof(TraceEvent)));)
+    }
+
+    Fiber *f;
+    while (mpmc_pop(&tp->free_fibers, &f)) fiber_destroy(f);
+    mpmc_destroy(&tp->free_fibers);
+    mpmc_destroy(&tp->injection);
+    mem_free(tp->mem, .old_ptr=tp->workers, .old_size=(tp->worker_count * sizeof(Worker)));
     mem_free(tp->mem, .old_ptr=tp, .old_size=sizeof(TPool));
 }
 
-// IMPORTANT: Don't call this function from within TPoolFn
-// because it can deadlock. This is because this function
-// might suspend the caller if the internal queue is full.
+// When called from inside a TPoolFn this never blocks. When
+// called from the outside, it yields until there is room in
+// the injection queue.
+//
+// If the deque of the worker is full the task is run inline,
+// except on a fiber where it goes to the injection queue so
+// that the fiber stack doesn't have to fit the task too.
 Void tpool_push (TPool *tp, TPoolFn fn, Void *fn_arg) {
-    os_mutex_lock(tp->mutex);
-    tp->pending_push = true;
-    while (!tp->stop && (tp->task_ring_count == tp->task_ring.count)) os_cond_var_wait(tp->push_cv, tp->mutex);
-    if (! tp->stop) {
-        Auto task = array_ref(&tp->task_ring, (tp->task_ring_cursor + tp->task_ring_count) % tp->task_ring.count);
-        task->fn = fn;
-        task->fn_arg = fn_arg;
-        tp->task_ring_count++;
-        os_cond_var_signal(tp->task_cv);
-    }
-    tp->pending_push = false;
-    os_mutex_unlock(tp->mutex);
-}
-
-// Suspends caller until all work is done. Also used
-// internally to wait until all threads have shut down.
+    Worker *w = get_worker();
+
+    if (w && (w->pool == tp)) {
+        Task task = { .fn=fn, .fn_arg=fn_arg, .counter=w->children };
+        IF_TRACE(task.push_ns = os_time_ns();)
+        atomic_inc_load(&w->children->pending);
+        if (deque_push(&w->deque, task)) wake_worker(tp);
+        else if (w->fiber) push_injection(tp, task);
+        else run_task(w, &task);
+        return;
+    }
+
+    push_grouped(tp, &tp->root, fn, fn_arg, 0);
+}
+
+// From the outside this suspends the caller until all work
+// is done. From inside a TPoolFn it waits for the tasks that
+// the TPoolFn pushed, running other tasks in the meantime.
+// On a fiber it suspends the fiber instead.
 Void tpool_wait (TPool *tp) {
-    os_mutex_lock(tp->mutex);
-    while (tp->task_ring_count || tp->pending_push || (!tp->stop && tp->working_count) || (tp->stop && tp->worker_count)) {
-        os_cond_var_wait(tp->done_cv, tp->mutex);
+    Worker *w = get_worker();
+
+    if (w && (w->pool == tp)) {
+        wait_children(w, w->children);
+        return;
+    }
+
+    tpool_group_wait(tp, &tp->root);
+}
+
+// The task is not a child of the calling task even if this
+// is called from inside a TPoolFn, so it's not waited for at
+// the end of the calling task. This never runs the task inline.
+Void tpool_group_push (TPool *tp, TPoolGroup *g, TPoolFn fn, Void *fn_arg) {
+    push_grouped(tp, g, fn, fn_arg, 0);
+}
+
+// Same as tpool_group_push except that the task will run on a
+// fiber. Pass a null group to only track it by tpool_wait.
+Void tpool_fiber_push (TPool *tp, TPoolGroup *g, TPoolFn fn, Void *fn_arg) {
+    push_grouped(tp, g ?: &tp->root, fn, fn_arg, TASK_FIBER);
+}
+
+// On a fiber this suspends it and puts it at the back of the
+// queue. Elsewhere it just runs some other task or yields. Use
+// tpool_wait or tpool_group_wait to wait for tasks, since those
+// park the fiber until the tasks are done.
+Void tpool_yield (TPool *tp) {
+    wait_step(tp);
+}
+
+// Like a push of a task that only finishes at the release,
+// so the root group is held too. The group may be null to
+// hold only the root (tpool_wait).
+Void tpool_group_hold (TPool *tp, TPoolGroup *g) {
+    if (g) group_add(g);
+    group_add(&tp->root);
+}
+
+// Can be called from any thread. The continuation of the
+// group, if any, is pushed from here.
+Void tpool_group_release (TPool *tp, TPoolGroup *g) {
+    if (g) group_release(tp, g);
+    group_release(tp, &tp->root);
+}
+
+Bool tpool_group_done (TPoolGroup *g) {
+    return atomic_load(&g->state) < GROUP_ONE;
+}
+
+// From inside a TPoolFn this runs other tasks while waiting.
+Void tpool_group_wait (TPool *tp, TPoolGroup *g) {
+    Worker *w = get_worker();
+
+    if (w && (w->pool == tp)) {
+        if (w->fiber) {
+            Fiber *f = w->fiber; // Don't touch w after the switch.
+            f->wait_group = g;
+            while (! tpool_group_done(g)) fiber_suspend(f, FIBER_WAIT_GROUP);
+        } else {
+            while (! tpool_group_done(g)) help_once(w);
+        }
+
+        return;
+    }
+
+    U32 v = atomic_load(&g->state);
+
+    while (v >= GROUP_ONE) {
+        if (! (v & GROUP_WAITERS)) {
+            U32 old = atomic_cmp_exchange(&g->state, v, v | GROUP_WAITERS);
+            if (old != v) { v = old; continue; }
+            v |= GROUP_WAITERS;
+        }
+
+        os_futex_wait(&g->state, v);
+        v = atomic_load(&g->state);
+    }
+}
+
+// The continuation is pushed as a regular task when the group
+// completes, or right away if the group is already done. Only
+// one continuation can be attached at a time.
+Void tpool_group_then (TPool *tp, TPoolGroup *g, TPoolFn fn, Void *fn_arg) {
+    g->then_fn  = fn;
+    g->then_arg = fn_arg;
+    U32 v = atomic_load(&g->state);
+
+    while (true) {
+        assert_always(! (v & GROUP_THEN));
+
+        if (v < GROUP_ONE) {
+            push_grouped(tp, &tp->root, fn, fn_arg, 0);
+            return;
+        }
+
+        U32 old = atomic_cmp_exchange(&g->state, v, v | GROUP_THEN);
+        if (old == v) return;
+        v = old;
     }
-    os_mutex_unlock(tp->mutex);
+}
+
+Void tpool_stats (TPool *tp, U64 worker_id, TPoolStats *out) {
+    assert_always(worker_id < tp->worker_count);
+    *out = (TPoolStats){};
+
+    #if TPOOL_TRACE
+        TPoolStats *stats = &tp->workers[worker_id].stats;
+        out->tasks_run = atomic_load_relaxed(&stats->tasks_run);
+        out->steals    = atomic_load_relaxed(&stats->steals);
+        out->busy_ns   = atomic_load_relaxed(&stats->busy_ns);
+        out->idle_ns   = atomic_load_relaxed(&stats->idle_ns);
+        for (U64 i = 0; i < TPOOL_TRACE_HIST_BUCKETS; ++i) out->queue_wait_hist[i] = atomic_load_relaxed(&stats->queue_wait_hist[i]);
+    #endif
+}
+
+// Only call while the pool is idle.
+Void tpool_trace_reset (TPool *tp) {
+    #if TPOOL_TRACE
+        for (U64 i = 0; i < tp->worker_count; ++i) {
+            Worker *w = &tp->workers[i];
+            w->stats = (TPoolStats){};
+            atomic_store_release(&w->trace_head, 0u);
+        }
+    #endif
+}
+
+// Timestamps are in microseconds since boot; the viewers only
+// care about the relative positions. The fn arg is the address
+// of the TPoolFn which can be resolved with addr2line.
+Bool tpool_trace_export (TPool *tp, String path) {
+    tmem_new(tm);
+    AString json = astr_new(tm);
+    astr_push_cstr(&json, "{\"traceEvents\":[\n");
+
+    #if TPOOL_TRACE
+        for (U64 i = 0; i < tp->worker_count; ++i) {
+            Worker *w = &tp->workers[i];
+            astr_push_fmt(&json, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%lu,\"args\":{\"name\":\"worker %lu\"}}", i ? ",\n" : "", i, i);
+
+            U64 head  = atomic_load_acquire(&w->trace_head);
+            U64 count = min(head, TPOOL_TRACE_RING_SIZE);
+
+            for (U64 j = head - count; j < head; ++j) {
+                TraceEvent *ev = &w->trace_ring[j % TPOOL_TRACE_RING_SIZE];
+                CString name   = (ev->flags & (TASK_FIBER | TASK_RESUME)) ? "fiber" : "task";
+                astr_push_fmt(&json, ",\n{\"name\":\"%s\",\"cat\":\"tpool\",\"ph\":\"X\",\"pid\":1,\"tid\":%lu,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"fn\":\"0x%lx\"}}",
+                              name, i, cast(F64, ev->begin_ns)/1e3, cast(F64, ev->end_ns - ev->begin_ns)/1e3, cast(U64, ev->fn));
+            }
+        }
+    #endif
+
+    astr_push_cstr(&json, "\n]}\n");
+    return fs_write_entire_file(path, astr_to_str(&json));
 }
 
 // Split range [0, n] into m roughly even ranges of the
@@ -147,3 +892,200 @@ SliceRangeU64 tpool_split (TPool *tp, Mem *mem, U64 n) {
     array_iter (r, &ranges, *) { r->a = min(n, ARRAY_IDX*w); r->b = min(n, ARRAY_IDX*w+w); }
     return ranges;
 }
+
+// =============================================================================
+// Parallel loops:
+// =============================================================================
+istruct (LoopJob) {
+    TPool *tp;
+    U64 grain;
+    U64 val_size;
+    Void *identity;
+    Void *ctx;
+    TPoolForFn *for_fn;
+    TPoolReduceFn *reduce_fn;
+    TPoolCombineFn *combine_fn;
+};
+
+istruct (LoopTask) {
+    LoopJob *job;
+    RangeU64 range;
+    Void *acc;
+};
+
+static U64 pick_grain (TPool *tp, RangeU64 range, U64 grain) {
+    return grain ?: max(1u, (range.b - range.a) / (8 * tp->worker_count));
+}
+
+// Runs the root task in a fresh group so that we don't wait
+// for unrelated tasks, and so that this works the same way
+// from inside and outside the pool.
+static Void run_loop (TPool *tp, TPoolFn *fn, LoopTask *root) {
+    TPoolGroup group = {};
+    tpool_group_push(tp, &group, fn, root);
+    tpool_group_wait(tp, &group);
+}
+
+// Push the right half, recurse into the left half and wait
+// before returning since the right half lives on our stack.
+static TPOOL_FN(for_task) {
+    LoopTask *t = arg;
+    LoopJob *job = t->job;
+
+    if ((t->range.b - t->range.a) <= job->grain) {
+        job->for_fn(t->range, job->ctx, worker_id);
+        return;
+    }
+
+    U64 mid = t->range.a + (t->range.b - t->range.a)/2;
+    LoopTask right = { .job=job, .range={ mid, t->range.b } };
+    LoopTask left  = { .job=job, .range={ t->range.a, mid } };
+    tpool_push(job->tp, for_task, &right);
+    for_task(&left, worker_id);
+    tpool_wait(job->tp);
+}
+
+Void tpool_for_ (TPool *tp, RangeU64 range, U64 grain, TPoolForFn *fn, Void *ctx) {
+    if (range.a >= range.b) return;
+    LoopJob job = { .tp=tp, .grain=pick_grain(tp, range, grain), .ctx=ctx, .for_fn=fn };
+    run_loop(tp, for_task, &(LoopTask){ .job=&job, .range=range });
+}
+
+static TPOOL_FN(reduce_task) {
+    LoopTask *t = arg;
+    LoopJob *job = t->job;
+
+    if ((t->range.b - t->range.a) <= job->grain) {
+        job->reduce_fn(t->range, job->ctx, t->acc);
+        return;
+    }
+
+    alignas(MAX_ALIGN) U8 right_acc[TPOOL_MAX_VAL_SIZE];
+    memcpy(right_acc, job->identity, job->val_size);
+
+    U64 mid = t->range.a + (t->range.b - t->range.a)/2;
+    LoopTask right = { job, { mid, t->range.b }, right_acc };
+    LoopTask left  = { job, { t->range.a, mid }, t->acc };
+    tpool_push(job->tp, reduce_task, &right);
+    reduce_task(&left, worker_id);
+    tpool_wait(job->tp);
+    job->combine_fn(t->acc, right_acc, job->ctx);
+}
+
+Void tpool_reduce_ (TPool *tp, RangeU64 range, U64 grain, U64 val_size, Void *identity, Void *out, TPoolReduceFn *reduce_fn, TPoolCombineFn *combine_fn, Void *ctx) {
+    assert_always(val_size <= TPOOL_MAX_VAL_SIZE);
+    memcpy(out, identity, val_size);
+    if (range.a >= range.b) return;
+
+    LoopJob job = {
+        .tp         = tp,
+        .grain      = pick_grain(tp, range, grain),
+        .val_size   = val_size,
+        .identity   = identity,
+        .ctx        = ctx,
+        .reduce_fn  = reduce_fn,
+        .combine_fn = combine_fn,
+    };
+
+    run_loop(tp, reduce_task, &(LoopTask){ &job, range, out });
+}
+
+istruct (ScanJob) {
+    RangeU64 range;
+    U64 grain;
+    U64 val_size;
+    U8 *sums; // One value per chunk.
+    Void *identity;
+    Void *ctx;
+    TPoolReduceFn *reduce_fn;
+    TPoolScanFn *scan_fn;
+};
+
+static RangeU64 scan_chunk (ScanJob *job, U64 idx) {
+    U64 a = job->range.a + idx * job->grain;
+    return (RangeU64){ a, min(job->range.b, a + job->grain) };
+}
+
+static TPOOL_FOR_FN(scan_reduce_chunks) {
+    ScanJob *job = ctx;
+    for (U64 i = range.a; i < range.b; ++i) {
+        Void *sum = job->sums + i*job->val_size;
+        memcpy(sum, job->identity, job->val_size);
+        job->reduce_fn(scan_chunk(job, i), job->ctx, sum);
+    }
+}
+
+static TPOOL_FOR_FN(scan_chunks) {
+    ScanJob *job = ctx;
+    for (U64 i = range.a; i < range.b; ++i) job->scan_fn(scan_chunk(job, i), job->ctx, job->sums + i*job->val_size);
+}
+
+// The range is cut into chunks of grain size. The chunks are
+// reduced in parallel, then the chunk sums are turned into an
+// exclusive prefix on this thread (there are few of them), and
+// then the chunks are scanned in parallel.
+Void tpool_scan_ (TPool *tp, RangeU64 range, U64 grain, U64 val_size, Void *identity, TPoolReduceFn *reduce_fn, TPoolCombineFn *combine_fn, TPoolScanFn *scan_fn, Void *ctx) {
+    assert_always(val_size <= TPOOL_MAX_VAL_SIZE);
+    if (range.a >= range.b) return;
+
+    tmem_new(tm);
+    grain = pick_grain(tp, range, grain);
+    U64 chunk_count = ceil_div(range.b - range.a, grain);
+
+    ScanJob job = {
+        .range     = range,
+        .grain     = grain,
+        .val_size  = val_size,
+        .sums      = mem_alloc(tm, U8, .align=MAX_ALIGN, .size=(chunk_count * val_size)),
+        .identity  = identity,
+        .ctx       = ctx,
+        .reduce_fn = reduce_fn,
+        .scan_fn   = scan_fn,
+    };
+
+    tpool_for_(tp, (RangeU64){ 0, chunk_count }, 1, scan_reduce_chunks, &job);
+
+    alignas(MAX_ALIGN) U8 running[TPOOL_MAX_VAL_SIZE];
+    alignas(MAX_ALIGN) U8 sum[TPOOL_MAX_VAL_SIZE];
+    memcpy(running, identity, val_size);
+
+    for (U64 i = 0; i < chunk_count; ++i) {
+        Void *slot = job.sums + i*val_size;
+        memcpy(sum, slot, val_size);
+        memcpy(slot, running, val_size);
+        combine_fn(running, sum, ctx);
+    }
+
+    tpool_for_(tp, (RangeU64){ 0, chunk_count }, 1, scan_chunks, &job);
+}
+
+istruct (ScanU64) {
+    SliceU64 in;
+    SliceU64 out;
+    Bool inclusive;
+};
+
+static Void scan_u64_reduce (RangeU64 r, ScanU64 *s, U64 *acc) {
+    for (U64 i = r.a; i < r.b; ++i) *acc += array_get(&s->in, i);
+}
+
+static Void scan_u64_combine (U64 *acc, U64 *val, ScanU64 *s) {
+    *acc += *val;
+}
+
+static Void scan_u64_scan (RangeU64 r, ScanU64 *s, U64 *prefix) {
+    U64 sum = *prefix;
+
+    for (U64 i = r.a; i < r.b; ++i) {
+        U64 x = array_get(&s->in, i);
+        if (s->inclusive) sum += x;
+        array_set(&s->out, i, sum);
+        if (! s->inclusive) sum += x;
+    }
+}
+
+Void tpool_scan_u64 (TPool *tp, SliceU64 in, SliceU64 out, U64 grain, Bool inclusive) {
+    assert_always(out.count >= in.count);
+    ScanU64 s = { in, out, inclusive };
+    tpool_scan(tp, ((RangeU64){ 0, in.count }), grain, 0lu, scan_u64_reduce, scan_u64_combine, scan_u64_scan, &s);
+}
@@ -4,40 +4,291 @@
 // Overview:
 // ---------
 //
-// A simple thread pool with a bounded queue for tasks.
+// A work-stealing thread pool.
 //
-// IMPORTANT: The tpool_push function should not be called
-// from within TPoolFn as it can put the worker thread to
-// sleep causing deadlock.
+// Each worker owns a deque of tasks. Tasks pushed from inside
+// a TPoolFn go to the bottom of the deque of the calling worker
+// which pops them LIFO (good cache locality), while idle workers
+// steal from the top of other deques (oldest and usually largest
+// tasks first). Tasks pushed from outside the pool go into a
+// bounded injection queue that all workers poll.
+//
+// Tasks may push more tasks and wait on them, so recursive and
+// divide-and-conquer parallelism works. The tpool_wait function
+// has two modes:
+//
+//     1. Called from outside the pool it suspends the caller
+//        until all tasks (including nested ones) are done.
+//
+//     2. Called from inside a TPoolFn it waits only for the
+//        tasks pushed by that TPoolFn. While waiting the worker
+//        helps by running other tasks, so it never deadlocks.
+//
+// A task is not considered done until the tasks it pushed are
+// done, as if it ended with an implicit tpool_wait.
+//
+// If the deque of a worker is full, tpool_push runs the task
+// inline. A push from outside the pool blocks if the injection
+// queue is full.
+//
+// Task groups make it possible to wait for a subset of the work
+// so that independent subsystems sharing a pool don't block each
+// other. A group can also have a continuation: a task that gets
+// pushed once all tasks in the group are done.
+//
+// Tasks pushed into a group are not children of the task that
+// pushed them, so they are not waited for at the end of it.
+//
+// Work that is not a task (an I/O request, a job on some other
+// thread) can be tracked by a group too: tpool_group_hold keeps
+// the group from completing until the matching release.
+//
+// A task pushed with tpool_fiber_push runs on its own stack. When
+// it waits (tpool_wait, tpool_group_wait, or tpool_yield) it gets
+// suspended and the worker moves on to other tasks instead of
+// helping on top of the waiting task. A fiber that waits for tasks
+// or a group is parked until they are done, so a pool whose fibers
+// are all waiting on I/O goes to sleep. The fiber is resumed later,
+// possibly on another worker, so:
+//
+//     - The worker_id argument is only valid until the first wait.
+//     - Each fiber has its own TMem ring and log which follow it
+//       across threads. Scratch memory can span a wait.
+//     - Don't keep pointers to other thread locals across a wait.
+//     - Blocking syscalls still block the whole worker.
+//
+// Fibers are useful for long tasks that wait a lot, since normal
+// tasks that wait pin their worker's stack until they're done.
+//
+// The pool sizes itself from the cpu topology when worker_count
+// is 0: one worker per physical core for tpool_new, and one per
+// usable logical cpu for tpool_new_ex unless skip_smt is set.
+// With tpool_new_ex the workers can also be pinned to cpus, and
+// the first few cores can be kept free for latency sensitive
+// threads like the ui thread. Workers are spread over distinct
+// cores first and only then over SMT siblings.
 //
 // Usage example:
 // --------------
 //
-//     TPOOL_FN(worker) {
-//         os_sleep_ms(500);
-//         printf("id=%lu val=%lu\n", worker_id, cast(U64, arg));
+//     istruct (Fib) { U64 n; U64 result; };
+//
+//     TPOOL_FN(fib) {
+//         Fib *f = arg;
+//         if (f->n < 2) { f->result = f->n; return; }
+//         Fib a = { f->n - 1 };
+//         Fib b = { f->n - 2 };
+//         tpool_push(pool, fib, &a);
+//         tpool_push(pool, fib, &b);
+//         tpool_wait(pool); // Helps out until a and b are done.
+//         f->result = a.result + b.result;
 //     }
-//     
+//
 //     Void test () {
 //         tmem_new(tm);
-//         Auto tp = tpool_new(tm, 2, 1*KB);
-//         for (U64 i = 0; i < 10; ++i) tpool_push(tp, worker, cast(Void*, i));
-//         tpool_wait(tp);
-//         printf("Done!\n");
-//         tpool_destroy(tp);
+//         pool = tpool_new(tm, 4, 1*KB);
+//         Fib f = { 30 };
+//         tpool_push(pool, fib, &f);
+//         tpool_wait(pool);
+//         printf("fib=%lu\n", f.result);
+//         tpool_destroy(pool);
 //     }
 //
+// Example with groups:
+//
+//     TPoolGroup glyphs = {};
+//     TPoolGroup shaping = {};
+//     for (U64 i = 0; i < n; ++i) tpool_group_push(pool, &glyphs, rasterize, &glyph_jobs[i]);
+//     for (U64 i = 0; i < m; ++i) tpool_group_push(pool, &shaping, shape, &shape_jobs[i]);
+//     tpool_group_then(pool, &glyphs, upload_atlas, atlas);
+//     tpool_group_wait(pool, &shaping); // Doesn't wait for glyphs.
+//
+// Example with a reserved core:
+//
+//     os_thread_pin_self(os_get_topology()->cpus.data[0].id);
+//     pool = tpool_new_ex(mem, .reserve_cores=1, .pin=true, .skip_smt=true);
+//
+// Example with fibers:
+//
+//     TPOOL_FN(load_level) {
+//         tmem_new(tm); // Owned by the fiber, so it survives the wait.
+//         Level *level = parse_level(tm, arg);
+//         for (U64 i = 0; i < level->meshes.count; ++i) tpool_push(pool, load_mesh, &level->meshes.data[i]);
+//         tpool_wait(pool); // Suspends the fiber.
+//         link_level(level);
+//     }
+//
+//     tpool_fiber_push(pool, 0, load_level, path);
+//
 // =============================================================================
 #include "base/core.h"
 #include "base/array.h"
+#include "base/string.h"
 
 #define TPOOL_FN(NAME) Void NAME (Void *arg, U64 worker_id)
 typedef TPOOL_FN(TPoolFn);
 
 istruct (TPool);
 
-TPool        *tpool_new     (Mem *, U64 worker_count, U64 queue_size);
-Void          tpool_destroy (TPool *);
-Void          tpool_push    (TPool *, TPoolFn, Void *fn_arg);
-Void          tpool_wait    (TPool *);
-SliceRangeU64 tpool_split   (TPool *, Mem *, U64);
+// Zero initialize before use. A group can be reused once it is
+// done and can be freed once tpool_group_wait has returned.
+istruct (TPoolGroup) {
+    U32 state;    // Private.
+    Void *fibers; // Private.
+    TPoolFn *then_fn;
+    Void *then_arg;
+};
+
+// Options for tpool_new_ex.
+istruct (TPoolConfig) {
+    U64 worker_count;  // 0 means one per usable cpu.
+    U64 queue_size;    // 0 means 1*KB.
+    U32 reserve_cores; // Don't run workers on the first n cores.
+    Bool pin;          // Pin each worker to one cpu.
+    Bool skip_smt;     // Use only one cpu per physical core.
+};
+
+#define tpool_new_ex(MEM, ...) tpool_new_cfg(MEM, &(TPoolConfig){ __VA_ARGS__ })
+
+TPool        *tpool_new          (Mem *, U64 worker_count, U64 queue_size);
+TPool        *tpool_new_cfg      (Mem *, TPoolConfig *);
+Void          tpool_destroy       (TPool *);
+Void          tpool_push          (TPool *, TPoolFn, Void *fn_arg);
+Void          tpool_wait          (TPool *);
+SliceRangeU64 tpool_split         (TPool *, Mem *, U64);
+Void          tpool_group_push    (TPool *, TPoolGroup *, TPoolFn, Void *fn_arg);
+Void          tpool_group_wait    (TPool *, TPoolGroup *);
+Void          tpool_group_then    (TPool *, TPoolGroup *, TPoolFn, Void *fn_arg);
+Void          tpool_group_hold    (TPool *, TPoolGroup *);
+Void          tpool_group_release (TPool *, TPoolGroup *);
+Bool          tpool_group_done    (TPoolGroup *);
+Void          tpool_fiber_push    (TPool *, TPoolGroup *, TPoolFn, Void *fn_arg);
+Void          tpool_yield         (TPool *);
+
+// =============================================================================
+// Tracing:
+// --------
+//
+// Build with -DTPOOL_TRACE=1 (or "make trace") to instrument the
+// pool. Otherwise the hooks compile to nothing, the stats are all
+// zero and the exported trace has no events.
+//
+// Each worker counts the tasks it ran, the tasks it stole, the
+// time spent running tasks and the time spent looking for work
+// or sleeping. The time a task spent queued (from push to start)
+// goes into a histogram with power of two buckets: bucket i
+// counts waits in [2^i, 2^(i+1)) nanoseconds.
+//
+// Each worker also records a begin/end event for every task into
+// its own ring of the last TPOOL_TRACE_RING_SIZE events. A ring
+// has a single writer (its worker), so no locking is involved.
+// Stats and events are best read while the pool is idle, else
+// they may be slightly torn.
+//
+// The tpool_trace_export function writes the events in the Chrome
+// Trace Event format which can be loaded into chrome://tracing or
+// ui.perfetto.dev. Each worker is a thread row there. Tasks that
+// run while their worker waits on children appear nested.
+//
+// Example:
+//
+//     tpool_trace_reset(pool);
+//     run_frame();
+//     tpool_trace_export(pool, str("/tmp/frame.json"));
+//
+// =============================================================================
+#if !defined(TPOOL_TRACE)
+    #define TPOOL_TRACE 0
+#endif
+
+#define TPOOL_TRACE_RING_SIZE   (1u << 14)
+#define TPOOL_TRACE_HIST_BUCKETS 40
+
+istruct (TPoolStats) {
+    U64 tasks_run;
+    U64 steals;
+    U64 busy_ns;
+    U64 idle_ns;
+    U64 queue_wait_hist[TPOOL_TRACE_HIST_BUCKETS];
+};
+
+Void tpool_stats        (TPool *, U64 worker_id, TPoolStats *out);
+Void tpool_trace_reset  (TPool *);
+Bool tpool_trace_export (TPool *, String path);
+
+// =============================================================================
+// Parallel loops:
+// ---------------
+//
+// These split a range in halves recursively until the pieces are
+// at most grain long. One half is pushed as a stealable task and
+// the other one is processed by the current worker, so idle
+// workers steal the largest remaining pieces. If grain is 0 it's
+// picked so that there are about 8 pieces per worker.
+//
+// They can be called from inside or outside the pool, and they
+// return once the whole range is processed. The macros below
+// type check the callbacks against the type of the ctx pointer.
+//
+//     tpool_for:    Calls fn(range, ctx, worker_id) on the pieces.
+//
+//     tpool_reduce: Calls reduce_fn(range, ctx, &acc) on the pieces,
+//                   where acc starts out as the identity value, and
+//                   then merges the results in range order with
+//                   combine_fn(&acc, &other, ctx). Returns the acc.
+//
+//     tpool_scan:   Prefix scan in two passes. First it reduces the
+//                   pieces like tpool_reduce, then it calls
+//                   scan_fn(range, ctx, &prefix) on the pieces where
+//                   prefix is the reduction of everything before the
+//                   piece. The scan_fn decides whether the scan is
+//                   inclusive or exclusive.
+//
+// Usage example:
+// --------------
+//
+//     Void sum_fn (RangeU64 r, SliceU64 *ctx, U64 *acc) { for (U64 i = r.a; i < r.b; ++i) *acc += ctx->data[i]; }
+//     Void add_fn (U64 *acc, U64 *val, SliceU64 *ctx)   { *acc += *val; }
+//
+//     U64 total = tpool_reduce(tp, ((RangeU64){0, nums.count}), 0, 0lu, sum_fn, add_fn, &nums);
+//
+//     tpool_scan_u64(tp, nums, offsets, 0, false); // Exclusive prefix sum.
+//
+// =============================================================================
+#define TPOOL_FOR_FN(NAME) Void NAME (RangeU64 range, Void *ctx, U64 worker_id)
+typedef TPOOL_FOR_FN(TPoolForFn);
+typedef Void TPoolReduceFn  (RangeU64 range, Void *ctx, Void *acc);
+typedef Void TPoolCombineFn (Void *acc, Void *val, Void *ctx);
+typedef Void TPoolScanFn    (RangeU64 range, Void *ctx, Void *prefix);
+
+#define TPOOL_MAX_VAL_SIZE 64 // Max size of reduce/scan values.
+
+Void tpool_for_     (TPool *, RangeU64, U64 grain, TPoolForFn *, Void *ctx);
+Void tpool_reduce_  (TPool *, RangeU64, U64 grain, U64 val_size, Void *identity, Void *out, TPoolReduceFn *, TPoolCombineFn *, Void *ctx);
+Void tpool_scan_    (TPool *, RangeU64, U64 grain, U64 val_size, Void *identity, TPoolReduceFn *, TPoolCombineFn *, TPoolScanFn *, Void *ctx);
+Void tpool_scan_u64 (TPool *, SliceU64 in, SliceU64 out, U64 grain, Bool inclusive); // The in and out can alias.
+
+#define tpool_for(TP, RANGE, GRAIN, FN, CTX) ({\
+    def1(c, CTX);\
+    Void (*_(f))(RangeU64, Type(c), U64) = FN;\
+    tpool_for_(TP, RANGE, GRAIN, cast(TPoolForFn*, _(f)), c);\
+})
+
+#define tpool_reduce(TP, RANGE, GRAIN, IDENTITY, REDUCE_FN, COMBINE_FN, CTX) ({\
+    def1(c, CTX);\
+    Type(IDENTITY) _(id) = IDENTITY;\
+    Type(IDENTITY) _(acc);\
+    Void (*_(r))(RangeU64, Type(c), Type(&_(acc))) = REDUCE_FN;\
+    Void (*_(m))(Type(&_(acc)), Type(&_(acc)), Type(c)) = COMBINE_FN;\
+    tpool_reduce_(TP, RANGE, GRAIN, sizeof(_(acc)), &_(id), &_(acc), cast(TPoolReduceFn*, _(r)), cast(TPoolCombineFn*, _(m)), c);\
+    _(acc);\
+})
+
+#define tpool_scan(TP, RANGE, GRAIN, IDENTITY, REDUCE_FN, COMBINE_FN, SCAN_FN, CTX) ({\
+    def1(c, CTX);\
+    Type(IDENTITY) _(id) = IDENTITY;\
+    Void (*_(r))(RangeU64, Type(c), Type(&_(id))) = REDUCE_FN;\
+    Void (*_(m))(Type(&_(id)), Type(&_(id)), Type(c)) = COMBINE_FN;\
+    Void (*_(s))(RangeU64, Type(c), Type(&_(id))) = SCAN_FN;\
+    tpool_scan_(TP, RANGE, GRAIN, sizeof(_(id)), &_(id), cast(TPoolReduceFn*, _(r)), cast(TPoolCombineFn*, _(m)), cast(TPoolScanFn*, _(s)), c);\
+})
@@ -0,0 +1,162 @@
+#include "bench/spsc.h"
+#include "base/mem.h"
+#include "base/spsc.h"
+#include "os/time.h"
+#include "os/threads.h"
+
+#define PING_COUNT (1u << 16)
+#define PUSH_COUNT (1u << 22)
+#define CAPACITY   1024
+
+// =============================================================================
+// Locked channel:
+// =============================================================================
+istruct (Locked) {
+    OsMutex *mutex;
+    OsCondVar *not_empty;
+    OsCondVar *not_full;
+    U64 *ring;
+    U64 head;
+    U64 tail;
+};
+
+static Void locked_init (Locked *c) {
+    c->mutex     = os_mutex_new(mem_root);
+    c->not_empty = os_cond_var_new(mem_root);
+    c->not_full  = os_cond_var_new(mem_root);
+    c->ring      = mem_alloc(mem_root, U64, .size=(CAPACITY * sizeof(U64)));
+    c->head      = 0;
+    c->tail      = 0;
+}
+
+static Void locked_destroy (Locked *c) {
+    os_cond_var_destroy(c->not_empty, mem_root);
+    os_cond_var_destroy(c->not_full, mem_root);
+    os_mutex_destroy(c->mutex, mem_root);
+    mem_free(mem_root, .old_ptr=c->ring, .old_size=(CAPACITY * sizeof(U64)));
+}
+
+static Void locked_push (Locked *c, U64 *elems, U64 n) {
+    os_mutex_lock(c->mutex);
+    for (U64 i = 0; i < n; ++i) {
+        while (c->tail - c->head == CAPACITY) os_cond_var_wait(c->not_full, c->mutex);
+        c->ring[c->tail++ % CAPACITY] = elems[i];
+    }
+    os_cond_var_signal(c->not_empty);
+    os_mutex_unlock(c->mutex);
+}
+
+static U64 locked_pop (Locked *c, U64 *out, U64 n) {
+    os_mutex_lock(c->mutex);
+    while (c->tail == c->head) os_cond_var_wait(c->not_empty, c->mutex);
+    U64 count = min(n, c->tail - c->head);
+    for (U64 i = 0; i < count; ++i) out[i] = c->ring[c->head++ % CAPACITY];
+    os_cond_var_signal(c->not_full);
+    os_mutex_unlock(c->mutex);
+    return count;
+}
+
+// =============================================================================
+// Runners:
+// =============================================================================
+istruct (Ctx) {
+    Bool locked;
+    U64 batch;
+    Locked locked_ping, locked_pong;
+    Spsc(U64) ping, pong;
+};
+
+static Void ctx_push (Ctx *ctx, Bool ping, U64 *elems, U64 n) {
+    if (ctx->locked) locked_push(ping ? &ctx->locked_ping : &ctx->locked_pong, elems, n);
+    else spsc_push_wait_n(ping ? &ctx->ping : &ctx->pong, elems, n);
+}
+
+static U64 ctx_pop (Ctx *ctx, Bool ping, U64 *out, U64 n) {
+    if (ctx->locked) return locked_pop(ping ? &ctx->locked_ping : &ctx->locked_pong, out, n);
+    else return spsc_pop_wait_n(ping ? &ctx->ping : &ctx->pong, out, n);
+}
+
+static Void echo_thread (Void *arg) {
+    Ctx *ctx = arg;
+    U64 msg;
+    for (U64 i = 0; i < PING_COUNT; ++i) {
+        ctx_pop(ctx, true, &msg, 1);
+        ctx_push(ctx, false, &msg, 1);
+    }
+}
+
+static Void sink_thread (Void *arg) {
+    Ctx *ctx = arg;
+    U64 buf[64];
+    U64 expected = 0;
+    while (expected < PUSH_COUNT) {
+        U64 n = ctx_pop(ctx, true, buf, ctx->batch);
+        for (U64 i = 0; i < n; ++i) assert_always(buf[i] == expected++);
+    }
+}
+
+static Void ctx_init (Ctx *ctx, Bool locked, U64 batch) {
+    *ctx = (Ctx){ .locked=locked, .batch=batch };
+    locked_init(&ctx->locked_ping);
+    locked_init(&ctx->locked_pong);
+    spsc_init(&ctx->ping, mem_root, CAPACITY);
+    spsc_init(&ctx->pong, mem_root, CAPACITY);
+}
+
+static Void ctx_destroy (Ctx *ctx) {
+    locked_destroy(&ctx->locked_ping);
+    locked_destroy(&ctx->locked_pong);
+    spsc_destroy(&ctx->ping);
+    spsc_destroy(&ctx->pong);
+}
+
+static F64 bench_latency (Bool locked) {
+    Ctx ctx;
+    ctx_init(&ctx, locked, 1);
+    OsThread *echo = os_thread_new(mem_root, echo_thread, &ctx);
+
+    U64 start = os_time_ns();
+    for (U64 i = 0; i < PING_COUNT; ++i) {
+        U64 msg = i;
+        ctx_push(&ctx, true, &msg, 1);
+        ctx_pop(&ctx, false, &msg, 1);
+        assert_always(msg == i);
+    }
+    U64 elapsed = os_time_ns() - start;
+
+    os_thread_join(echo);
+    os_thread_destroy(echo, mem_root);
+    ctx_destroy(&ctx);
+    return cast(F64, elapsed) / (2.0 * PING_COUNT);
+}
+
+static F64 bench_stream (Bool locked, U64 batch) {
+    Ctx ctx;
+    ctx_init(&ctx, locked, batch);
+    OsThread *sink = os_thread_new(mem_root, sink_thread, &ctx);
+
+    U64 buf[64];
+    U64 start = os_time_ns();
+    for (U64 i = 0; i < PUSH_COUNT; i += batch) {
+        for (U64 j = 0; j < batch; ++j) buf[j] = i + j;
+        ctx_push(&ctx, true, buf, batch);
+    }
+    os_thread_join(sink);
+    U64 elapsed = os_time_ns() - start;
+
+    os_thread_destroy(sink, mem_root);
+    ctx_destroy(&ctx);
+    return cast(F64, elapsed) / PUSH_COUNT;
+}
+
+Void bench_spsc () {
+    printf("spsc: nanoseconds per message\n");
+    printf("%-10s %10s %10s\n", "", "locked", "spsc");
+    printf("%-10s %10.1f %10.1f\n", "latency", bench_latency(true), bench_latency(false));
+
+    for (U64 batch = 1; batch <= 64; batch *= 8) {
+        Char label[32];
+        snprintf(label, sizeof(label), "stream/%lu", batch);
+        printf("%-10s %10.1f %10.1f\n", label, bench_stream(true, batch), bench_stream(false, batch));
+    }
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+// =============================================================================
+// Overview:
+// ---------
+//
+// Measures the SPSC channel against a mutex plus condition variable
+// channel (what the code used before) in nanoseconds per message:
+//
+//     latency  Two threads ping-pong one message through a pair of
+//              channels using the blocking waits. Reports the one
+//              way latency (half a round trip).
+//     stream   One thread pushes PUSH_COUNT messages and the other
+//              one pops them, with the given batch size on both
+//              sides. Reports the amortized cost per message.
+//
+// Run with: ./mykron.bin -bench spsc
+//
+// =============================================================================
+#include "base/core.h"
+
+Void bench_spsc ();
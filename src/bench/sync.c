@@ -0,0 +1,135 @@
+#include "bench/sync.h"
+#include "base/mem.h"
+#include "base/array.h"
+#include "base/sync.h"
+#include "os/time.h"
+#include "os/threads.h"
+
+#define LOCK_ROUNDS (1u << 18)
+#define PING_ROUNDS (1u << 14)
+
+istruct (LockCtx) {
+    OsMutex *os_mutex;
+    Mutex mutex;
+    U64 counter;
+};
+
+static Void os_mutex_worker (Void *arg) {
+    LockCtx *ctx = arg;
+    for (U64 i = 0; i < LOCK_ROUNDS; ++i) {
+        os_mutex_lock(ctx->os_mutex);
+        ctx->counter++;
+        os_mutex_unlock(ctx->os_mutex);
+    }
+}
+
+static Void mutex_worker (Void *arg) {
+    LockCtx *ctx = arg;
+    for (U64 i = 0; i < LOCK_ROUNDS; ++i) {
+        mutex_lock(&ctx->mutex);
+        ctx->counter++;
+        mutex_unlock(&ctx->mutex);
+    }
+}
+
+istruct (PingCtx) {
+    OsSemaphore *os_ping;
+    OsSemaphore *os_pong;
+    Semaphore ping;
+    Semaphore pong;
+};
+
+static Void os_ping_worker (Void *arg) {
+    PingCtx *ctx = arg;
+    for (U64 i = 0; i < PING_ROUNDS; ++i) { os_semaphore_post(ctx->os_ping); os_semaphore_wait(ctx->os_pong); }
+}
+
+static Void os_pong_worker (Void *arg) {
+    PingCtx *ctx = arg;
+    for (U64 i = 0; i < PING_ROUNDS; ++i) { os_semaphore_wait(ctx->os_ping); os_semaphore_post(ctx->os_pong); }
+}
+
+static Void ping_worker (Void *arg) {
+    PingCtx *ctx = arg;
+    for (U64 i = 0; i < PING_ROUNDS; ++i) { semaphore_post(&ctx->ping, 1); semaphore_wait(&ctx->pong); }
+}
+
+static Void pong_worker (Void *arg) {
+    PingCtx *ctx = arg;
+    for (U64 i = 0; i < PING_ROUNDS; ++i) { semaphore_wait(&ctx->ping); semaphore_post(&ctx->pong, 1); }
+}
+
+// Runs fn on n threads with matching args and returns the wall
+// time in ms it took for all of them to finish.
+static U64 run_threads (U64 n, OsThreadFn *fns, Void **args) {
+    tmem_new(tm);
+    Array(OsThread*) threads;
+    array_init(&threads, tm);
+
+    U64 start = os_time_ms();
+    for (U64 i = 0; i < n; ++i) array_push(&threads, os_thread_new(mem_root, fns[i], args[i]));
+    array_iter (t, &threads) { os_thread_join(t); os_thread_destroy(t, mem_root); }
+    return os_time_ms() - start;
+}
+
+static U64 bench_lock (U64 n, Bool use_os) {
+    tmem_new(tm);
+    LockCtx ctx = { .os_mutex=os_mutex_new(mem_root) };
+    OsThreadFn *fns = mem_alloc(tm, OsThreadFn, .size=(n * sizeof(OsThreadFn)));
+    Void **args = mem_alloc(tm, Void*, .size=(n * sizeof(Void*)));
+    for (U64 i = 0; i < n; ++i) { fns[i] = use_os ? os_mutex_worker : mutex_worker; args[i] = &ctx; }
+
+    U64 elapsed = run_threads(n, fns, args);
+    assert_always(ctx.counter == n * LOCK_ROUNDS);
+    os_mutex_destroy(ctx.os_mutex, mem_root);
+    return elapsed;
+}
+
+static U64 bench_ping (U64 pairs, Bool use_os) {
+    tmem_new(tm);
+    PingCtx *ctx = mem_alloc(tm, PingCtx, .zeroed=true, .size=(pairs * sizeof(PingCtx)));
+    OsThreadFn *fns = mem_alloc(tm, OsThreadFn, .size=(2 * pairs * sizeof(OsThreadFn)));
+    Void **args = mem_alloc(tm, Void*, .size=(2 * pairs * sizeof(Void*)));
+
+    for (U64 i = 0; i < pairs; ++i) {
+        ctx[i].os_ping = os_semaphore_new(mem_root, 0);
+        ctx[i].os_pong = os_semaphore_new(mem_root, 0);
+        fns[2*i]       = use_os ? os_ping_worker : ping_worker;
+        fns[2*i + 1]   = use_os ? os_pong_worker : pong_worker;
+        args[2*i]      = &ctx[i];
+        args[2*i + 1]  = &ctx[i];
+    }
+
+    U64 elapsed = run_threads(2*pairs, fns, args);
+
+    for (U64 i = 0; i < pairs; ++i) {
+        os_semaphore_destroy(ctx[i].os_ping, mem_root);
+        os_semaphore_destroy(ctx[i].os_pong, mem_root);
+    }
+
+    return elapsed;
+}
+
+static F64 per_sec (U64 count, U64 ms) {
+    return cast(F64, count) / (cast(F64, max(ms, 1u)) / 1000.0);
+}
+
+Void bench_sync () {
+    printf("sync: mutex in million ops per second (%u per thread)\n", LOCK_ROUNDS);
+    printf("%8s %10s %10s\n", "threads", "pthread", "futex");
+
+    for (U64 n = 1; n <= 16; n *= 2) {
+        F64 os_ops = per_sec(n * LOCK_ROUNDS, bench_lock(n, true));
+        F64 ops    = per_sec(n * LOCK_ROUNDS, bench_lock(n, false));
+        printf("%8lu %10.2f %10.2f\n", n, os_ops/1e6, ops/1e6);
+    }
+
+    printf("\nsync: semaphore ping-pong in thousand round trips per second (%u per pair)\n", PING_ROUNDS);
+    printf("%8s %10s %10s\n", "pairs", "pthread", "futex");
+
+    for (U64 n = 1; n <= 8; n *= 2) {
+        F64 os_trips = per_sec(n * PING_ROUNDS, bench_ping(n, true));
+        F64 trips    = per_sec(n * PING_ROUNDS, bench_ping(n, false));
+        printf("%8lu %10.2f %10.2f\n", n, os_trips/1e3, trips/1e3);
+    }
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+// =============================================================================
+// Overview:
+// ---------
+//
+// Compares the futex primitives from base/sync.h with the pthread
+// wrappers from os/threads.h under contention:
+//
+//     mutex  Each of N threads does LOCK_ROUNDS lock/inc/unlock
+//            on one shared counter. Reports million ops per sec.
+//     sema   N pairs of threads ping-pong a token through two
+//            semaphores. Reports thousand round trips per sec.
+//
+// Run with: ./mykron.bin -bench sync
+//
+// =============================================================================
+#include "base/core.h"
+
+Void bench_sync ();
@@ -0,0 +1,163 @@
+#include "bench/tpool.h"
+#include "base/mem.h"
+#include "base/array.h"
+#include "base/tpool.h"
+#include "os/time.h"
+#include "os/threads.h"
+
+#define TASK_COUNT  (1u << 20)
+#define QUEUE_SIZE  (1*KB)
+
+TPOOL_FN(empty_task) {}
+
+// =============================================================================
+// Old pool design:
+// =============================================================================
+istruct (LockedTask) {
+    TPoolFn *fn;
+    Void *fn_arg;
+};
+
+array_typedef(LockedTask, LockedTask);
+
+istruct (LockedPool) {
+    OsMutex *mutex;
+    OsCondVar *task_cv;
+    OsCondVar *push_cv;
+    OsCondVar *done_cv;
+    ArrayLockedTask ring;
+    U64 ring_count;
+    U64 ring_cursor;
+    U64 working_count;
+    Bool stop;
+    Array(OsThread*) threads;
+};
+
+static Void locked_worker (Void *arg) {
+    LockedPool *lp = arg;
+
+    while (true) {
+        os_mutex_lock(lp->mutex);
+        while (!lp->stop && !lp->ring_count) os_cond_var_wait(lp->task_cv, lp->mutex);
+        if (lp->stop) break;
+        LockedTask task = array_get(&lp->ring, lp->ring_cursor);
+        lp->ring_cursor = (lp->ring_cursor + 1) % lp->ring.count;
+        lp->ring_count--;
+        lp->working_count++;
+        os_cond_var_signal(lp->push_cv);
+        os_mutex_unlock(lp->mutex);
+
+        task.fn(task.fn_arg, 0);
+
+        os_mutex_lock(lp->mutex);
+        lp->working_count--;
+        if (!lp->ring_count && !lp->working_count) os_cond_var_signal(lp->done_cv);
+        os_mutex_unlock(lp->mutex);
+    }
+
+    os_mutex_unlock(lp->mutex);
+}
+
+static Void locked_push (LockedPool *lp, TPoolFn fn, Void *fn_arg) {
+    os_mutex_lock(lp->mutex);
+    while (lp->ring_count == lp->ring.count) os_cond_var_wait(lp->push_cv, lp->mutex);
+    array_set(&lp->ring, (lp->ring_cursor + lp->ring_count) % lp->ring.count, ((LockedTask){ fn, fn_arg }));
+    lp->ring_count++;
+    os_cond_var_signal(lp->task_cv);
+    os_mutex_unlock(lp->mutex);
+}
+
+static Void locked_wait (LockedPool *lp) {
+    os_mutex_lock(lp->mutex);
+    while (lp->ring_count || lp->working_count) os_cond_var_wait(lp->done_cv, lp->mutex);
+    os_mutex_unlock(lp->mutex);
+}
+
+static U64 bench_locked (U64 worker_count) {
+    LockedPool lp = {};
+    lp.mutex   = os_mutex_new(mem_root);
+    lp.task_cv = os_cond_var_new(mem_root);
+    lp.push_cv = os_cond_var_new(mem_root);
+    lp.done_cv = os_cond_var_new(mem_root);
+    array_init(&lp.ring, mem_root);
+    array_ensure_count(&lp.ring, QUEUE_SIZE, 0);
+    array_init(&lp.threads, mem_root);
+    for (U64 i = 0; i < worker_count; ++i) array_push(&lp.threads, os_thread_new(mem_root, locked_worker, &lp));
+
+    U64 start = os_time_ms();
+    for (U64 i = 0; i < TASK_COUNT; ++i) locked_push(&lp, empty_task, 0);
+    locked_wait(&lp);
+    U64 elapsed = os_time_ms() - start;
+
+    os_mutex_lock(lp.mutex);
+    lp.stop = true;
+    os_cond_var_broadcast(lp.task_cv);
+    os_mutex_unlock(lp.mutex);
+
+    array_iter (t, &lp.threads) { os_thread_join(t); os_thread_destroy(t, mem_root); }
+    array_free(&lp.threads);
+    array_free(&lp.ring);
+    os_cond_var_destroy(lp.task_cv, mem_root);
+    os_cond_var_destroy(lp.push_cv, mem_root);
+    os_cond_var_destroy(lp.done_cv, mem_root);
+    os_mutex_destroy(lp.mutex, mem_root);
+    return elapsed;
+}
+
+// =============================================================================
+// Current pool:
+// =============================================================================
+static TPool *pool;
+
+static U64 bench_outside (U64 worker_count) {
+    pool = tpool_new(mem_root, worker_count, QUEUE_SIZE);
+    U64 start = os_time_ms();
+    for (U64 i = 0; i < TASK_COUNT; ++i) tpool_push(pool, empty_task, 0);
+    tpool_wait(pool);
+    U64 elapsed = os_time_ms() - start;
+    tpool_destroy(pool);
+    return elapsed;
+}
+
+// Splits the range in halves until single tasks are left, so
+// in total about 2*TASK_COUNT tasks get pushed.
+TPOOL_FN(split_task) {
+    RangeU64 *r = arg;
+    if (r->b - r->a < 2) return;
+    U64 mid = r->a + (r->b - r->a)/2;
+    RangeU64 left  = { r->a, mid };
+    RangeU64 right = { mid, r->b };
+    tpool_push(pool, split_task, &left);
+    tpool_push(pool, split_task, &right);
+    tpool_wait(pool);
+}
+
+static U64 bench_nested (U64 worker_count) {
+    pool = tpool_new(mem_root, worker_count, QUEUE_SIZE);
+    RangeU64 range = { 0, TASK_COUNT };
+    U64 start = os_time_ms();
+    tpool_push(pool, split_task, &range);
+    tpool_wait(pool);
+    U64 elapsed = os_time_ms() - start;
+    tpool_destroy(pool);
+    return elapsed;
+}
+
+// =============================================================================
+// Driver:
+// =============================================================================
+static F64 tasks_per_sec (U64 task_count, U64 ms) {
+    return cast(F64, task_count) / (cast(F64, max(ms, 1u)) / 1000.0);
+}
+
+Void bench_tpool () {
+    printf("tpool: million empty tasks per second (%u tasks per run)\n", TASK_COUNT);
+    printf("%8s %10s %10s %10s\n", "threads", "locked", "outside", "nested");
+
+    for (U64 n = 1; n <= 16; n *= 2) {
+        F64 locked  = tasks_per_sec(TASK_COUNT, bench_locked(n));
+        F64 outside = tasks_per_sec(TASK_COUNT, bench_outside(n));
+        F64 nested  = tasks_per_sec(2*TASK_COUNT - 1, bench_nested(n));
+        printf("%8lu %10.2f %10.2f %10.2f\n", n, locked/1e6, outside/1e6, nested/1e6);
+    }
+}
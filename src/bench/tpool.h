@@ -0,0 +1,25 @@
+#pragma once
+
+// =============================================================================
+// Overview:
+// ---------
+//
+// Throughput benchmark for the thread pool: how many empty tasks
+// per second can be pushed and run at 1, 2, 4, 8 and 16 workers.
+//
+// Three setups are measured:
+//
+//     locked  A copy of the old pool design: one mutex protected
+//             ring and condition variables. All tasks are pushed
+//             from the main thread.
+//     outside The real pool with all tasks pushed from the main
+//             thread (goes through the lock-free injection queue).
+//     nested  The real pool with tasks pushing tasks (goes through
+//             the worker deques).
+//
+// Run with: ./mykron.bin -bench tpool
+//
+// =============================================================================
+#include "base/core.h"
+
+Void bench_tpool ();
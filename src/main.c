@@ -6,16 +6,30 @@
 #include "os/info.h"
 #include "os/time.h"
 #include "base/log.h"
+#include "base/pack.h"
+#include "bench/spsc.h"
+#include "bench/sync.h"
+#include "bench/tpool.h"
 
 istruct (CmdLine) {
     U64 cursor;
     SliceCString args;
     String main_file_path;
+    String bench;
+    String pack_path;
+    String blog_path;
+    String blog_decode_path;
+    ArrayPackInput pack_inputs;
 };
 
 static Void cli_print_options () {
     printf(
-        "-h        Print command line options.\n"
+        "-h              Print command line options.\n"
+        "-bench X        Run benchmark X and exit. Options: tpool, sync, spsc.\n"
+        "-pack X         Write the files listed after it into the asset pack X and exit.\n"
+        "                The files listed after a -compress are compressed.\n"
+        "-blog X         Write a binary trace log into file X.\n"
+        "-blog-decode X  Print the binary log X as text and exit.\n"
     );
 }
 
@@ -42,6 +56,22 @@ static CmdLine cli_parse (Int argc, CString *argv) {
 
         if (str_match(arg, str("-h"))) {
             cli_print_options();
+        } else if (str_match(arg, str("-bench"))) {
+            cli.bench = cli_eat(&cli, "Expected benchmark name after -bench.");
+        } else if (str_match(arg, str("-blog"))) {
+            cli.blog_path = cli_eat(&cli, "Expected output path after -blog.");
+        } else if (str_match(arg, str("-blog-decode"))) {
+            cli.blog_decode_path = cli_eat(&cli, "Expected file path after -blog-decode.");
+        } else if (str_match(arg, str("-pack"))) {
+            cli.pack_path = cli_eat(&cli, "Expected output path after -pack.");
+            array_init(&cli.pack_inputs, mem_root);
+            Bool compress = false;
+
+            while (cli.cursor < cli.args.count) {
+                String file = cli_eat(&cli, "");
+                if (str_match(file, str("-compress"))) compress = true;
+                else array_push_lit(&cli.pack_inputs, .path=file, .compress=compress);
+            }
         } else {
             log_msg_fmt(LOG_ERROR, "", 1, "Unknown command line argument '%.*s'.", STR(arg));
         }
@@ -59,6 +89,43 @@ Int main (Int argc, CString *argv) {
     log_setup(mem_root, 4*KB);
     log_scope(ls, 1);
 
-    // cli_parse(argc, argv);
+    CmdLine cli = (argc > 1) ? cli_parse(argc, argv) : (CmdLine){};
+    if (ls->count[LOG_ERROR]) return 1;
+
+    if (cli.bench.count) {
+        if (str_match(cli.bench, str("tpool"))) bench_tpool();
+        else if (str_match(cli.bench, str("sync"))) bench_sync();
+        else if (str_match(cli.bench, str("spsc"))) bench_spsc();
+        else log_msg_fmt(LOG_ERROR, "", 1, "Unknown benchmark '%.*s'.", STR(cli.bench));
+        return ls->count[LOG_ERROR] ? 1 : 0;
+    }
+
+    if (cli.pack_path.count) {
+        if (! pack_build(cli.pack_path, cli.pack_inputs.as_slice)) return 1;
+        return 0;
+    }
+
+    if (cli.blog_decode_path.count) {
+        AString out = astr_new(mem_root);
+
+        if (! blog_decode(cli.blog_decode_path, &out)) {
+            log_msg_fmt(LOG_ERROR, "", 1, "Couldn't read binary log '%.*s'.", STR(cli.blog_decode_path));
+            return 1;
+        }
+
+        astr_print(&out);
+        return 0;
+    }
+
+    if (cli.blog_path.count && !blog_start_ex(mem_root, .path=cli.blog_path)) {
+        log_msg_fmt(LOG_ERROR, "", 1, "Couldn't open binary log '%.*s'.", STR(cli.blog_path));
+        return 1;
+    }
+
+    // Log output goes through a writer thread so that the
+    // ui thread never waits on the terminal.
+    log_sink_start_ex(mem_root);
     ui_test();
+    log_sink_stop();
+    blog_stop();
 }
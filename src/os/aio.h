@@ -0,0 +1,92 @@
+#pragma once
+
+// =============================================================================
+// Overview:
+// ---------
+//
+// Asynchronous file I/O that plugs into the thread pool.
+//
+// An AioOp describes one request. Fill in the inputs, submit it,
+// and once it's done read the outputs. Besides the single syscall
+// ops there are two compound ops:
+//
+//     AIO_READ_FILE  Like fs_read_entire_file (open, stat, read
+//                    and close), but without blocking the caller.
+//     AIO_PREFETCH   Pulls a file into the page cache so that a
+//                    later read or fs_map_file doesn't hit disk.
+//
+// On linux the requests go through io_uring. Each submit call is
+// a single syscall no matter how many ops it carries, and the
+// follow-up steps of compound ops are batched by a completion
+// thread. On kernels without io_uring (or where it's disabled by
+// seccomp) every op runs as a blocking task on the thread pool
+// instead, so the caller doesn't need a separate path.
+//
+// The completion is reported in two ways:
+//
+//     1. aio_wait blocks until the op is done, like a future.
+//     2. The op holds a TPoolGroup (if given) until it's done,
+//        so tpool_group_wait and tpool_group_then work with I/O
+//        just like with tasks. A fiber that waits on the group
+//        gets suspended instead of blocking its worker.
+//
+// The op is owned by the caller and must stay alive until it's
+// done. The Mem of the Aio and of AIO_READ_FILE ops is used from
+// the completion thread, so it must be thread safe (mem_root).
+//
+// Usage example:
+// --------------
+//
+//     Aio *aio = aio_new(mem_root, pool, 64);
+//
+//     TPoolGroup io = {};
+//     AioOp ops[2] = {
+//         { .tag=AIO_READ_FILE, .path=str("a.glsl"), .mem=mem_root },
+//         { .tag=AIO_READ_FILE, .path=str("b.glsl"), .mem=mem_root },
+//     };
+//     aio_submit_n(aio, ops, 2, &io);
+//
+//     init_window(); // Overlaps with the reads.
+//
+//     tpool_group_wait(pool, &io);
+//     if (! ops[0].error) compile(ops[0].data);
+//
+// =============================================================================
+#include "base/core.h"
+#include "base/mem.h"
+#include "base/string.h"
+#include "base/sync.h"
+#include "base/tpool.h"
+
+istruct (Aio);
+
+ienum (AioTag, U8) {
+    AIO_OPEN,      // In: path.               Out: fd (read only).
+    AIO_STAT,      // In: path.               Out: size.
+    AIO_READ,      // In: fd, offset, buf.    Out: size (bytes read, less than buf.count only at eof).
+    AIO_CLOSE,     // In: fd.
+    AIO_READ_FILE, // In: path, mem.          Out: data (0-terminated like fs_read_entire_file).
+    AIO_PREFETCH,  // In: path.
+};
+
+istruct (AioOp) {
+    AioTag tag;
+    String path;
+    Int fd;
+    U64 offset;
+    String buf;
+    Mem *mem;
+    U64 size;
+    String data;
+    I32 error; // Out: 0 or an errno value.
+
+    SyncEvent done; // Private.
+};
+
+Aio *aio_new      (Mem *, TPool *, U32 queue_depth);
+Void aio_destroy  (Aio *); // Waits for all ops.
+Void aio_submit   (Aio *, AioOp *, TPoolGroup *);
+Void aio_submit_n (Aio *, AioOp *ops, U64 count, TPoolGroup *);
+Void aio_wait     (AioOp *);
+Bool aio_done     (AioOp *);
+Bool aio_is_async (Aio *); // False if running on the thread pool fallback.
@@ -3,6 +3,26 @@
 #include "base/core.h"
 #include "base/mem.h"
 #include "base/string.h"
+#include "base/tpool.h"
+
+// Access pattern hints for fs_advise().
+ienum (FsAccess, U8) {
+    FS_ACCESS_NORMAL,
+    FS_ACCESS_RANDOM,
+    FS_ACCESS_SEQUENTIAL,
+};
+
+// Flags for fs_map_file().
+ienum (FsMapFlags, U8) {
+    FS_MAP_PREFETCH = flag(0), // Start reading the whole file in the background (MADV_WILLNEED).
+    FS_MAP_POPULATE = flag(1), // Read the whole file before returning (MAP_POPULATE).
+};
+
+// Flags for fs_copy_ex() and the batch functions.
+ienum (FsCopyFlags, U8) {
+    FS_COPY_SPARSE     = flag(0), // Keep holes in sparse files instead of filling them with zeros.
+    FS_COPY_NO_REFLINK = flag(1), // Always copy the bytes even if the filesystem could share the extents.
+};
 
 istruct (FsIter) {
     Mem *mem;
@@ -16,6 +36,7 @@ istruct (FsIter) {
 
 U64     fs_file_size            (String path);
 Bool    fs_copy                 (String oldpath, String newpath);
+Bool    fs_copy_ex              (String oldpath, String newpath, FsCopyFlags);
 Bool    fs_make_dir             (String path);
 Bool    fs_move                 (String oldpath, String newpath);
 Bool    fs_delete               (String path);
@@ -33,3 +54,170 @@ Bool    fs_write_entire_file    (String path, String buf);
 // is not counted by String.count. The extra_space is padding
 // at the end of the returned buffer; also not counted.
 String  fs_read_entire_file  (Mem *, String path, U64 extra_space);
+
+// Maps the file read-only into memory. Pages are loaded by
+// the kernel as they are touched, so this takes constant
+// time regardless of file size unless FS_MAP_POPULATE is
+// given. The access hint is applied as with fs_advise().
+//
+// Files that can't be mapped (pipes, procfs, some network
+// filesystems) are read into anonymous memory instead, so
+// the caller doesn't need a separate path for them.
+//
+// Returns an empty string if the file is empty or can't be
+// read. Release the string with fs_unmap_file().
+String  fs_map_file          (String path, FsAccess, FsMapFlags);
+Void    fs_unmap_file        (String);
+Void    fs_advise            (String mapped_file, U64 offset, U64 count, FsAccess);
+
+// For writers that keep a file open (like the log sink). The
+// fs_write_chunks function writes all chunks in order with as
+// few syscalls as possible (writev) and retries partial writes.
+#define FS_STDOUT 1
+
+Int     fs_open_append       (String path); // Creates the file if needed. Returns -1 on error.
+Int     fs_open_new          (String path); // Creates or truncates the file. Returns -1 on error.
+Bool    fs_write_chunks      (Int fd, SliceString chunks);
+Void    fs_close             (Int fd);
+
+// =============================================================================
+// Copying:
+// --------
+//
+// Copies are done by the kernel without moving the bytes through
+// user space. The fastest available method is picked per file:
+//
+//     1. A reflink (FICLONE) which makes the copy share the extents
+//        of the original on filesystems like btrfs and xfs, so the
+//        copy is instant no matter the size.
+//     2. copy_file_range which can use server side copy on network
+//        filesystems and copy offload on some devices.
+//     3. sendfile.
+//
+// With FS_COPY_SPARSE only the data regions of the source are
+// copied (found with SEEK_DATA and SEEK_HOLE). The new file gets
+// the permission bits of the old one. The copy is written to a
+// temporary file that is renamed over the destination once it's
+// complete, so a failed copy leaves the destination untouched.
+// Copying a file onto itself or one of its hard links fails.
+//
+// A batch copies or moves many files on a background thread. A
+// move is a rename, or a copy followed by a delete when the paths
+// are on different filesystems. The progress callback runs on the
+// background thread after each file and each chunk of a big file.
+// A ui can instead poll fs_batch_progress once per frame. Batches
+// can be canceled, in which case the partial copy is removed
+// and the remaining items are skipped.
+//
+// Usage example:
+// --------------
+//
+//     FsBatchItem items[] = {
+//         { .from=str("assets/big.pak"), .to=str("/mnt/usb/big.pak") },
+//         { .from=str("assets/small.pak"), .to=str("/mnt/usb/small.pak") },
+//     };
+//
+//     FsBatch *batch = fs_batch_new(mem, (SliceFsBatchItem){ items, 2 }, false, FS_COPY_SPARSE, 0, 0);
+//
+//     // Each frame:
+//     FsProgress p;
+//     fs_batch_progress(batch, &p);
+//     draw_progress_bar(p.bytes_done, p.bytes_total);
+//     if (fs_batch_done(batch)) all_ok = fs_batch_wait(batch);
+//
+// =============================================================================
+istruct (FsBatch);
+
+istruct (FsProgress) {
+    U64 bytes_done;
+    U64 bytes_total;
+    U64 files_done;
+    U64 files_total;
+};
+
+istruct (FsBatchItem) {
+    String from;
+    String to;
+    Bool ok; // Out.
+};
+
+array_typedef(FsBatchItem, FsBatchItem);
+
+#define FS_PROGRESS_FN(NAME) Void NAME (FsProgress *progress, Void *arg)
+typedef FS_PROGRESS_FN(FsProgressFn);
+
+// The items must stay alive until fs_batch_wait returns.
+FsBatch *fs_batch_new      (Mem *, SliceFsBatchItem, Bool move, FsCopyFlags, FsProgressFn *, Void *fn_arg);
+Void     fs_batch_progress (FsBatch *, FsProgress *out);
+Void     fs_batch_cancel   (FsBatch *);
+Bool     fs_batch_done     (FsBatch *);
+Bool     fs_batch_wait     (FsBatch *); // Frees the batch. Returns true if all items are ok.
+
+// =============================================================================
+// Walker:
+// -------
+//
+// Recursively visits all files and directories under a root and
+// hands them to a callback in batches. The types of entries come
+// from the directory listing itself, so there is no stat per entry
+// except on filesystems that don't report types, and for symlinks.
+// Symlinks are reported as what they point to, but directories
+// reached through a symlink are not descended into.
+//
+// Globs (see str_glob_match) are matched against the path relative
+// to the root, like "src/ui/ui.c". An entry is reported if it
+// matches one of the include globs (or there are none) and none
+// of the exclude globs. Excluded directories are not descended
+// into, which is much cheaper than filtering their contents.
+//
+// With a tpool each directory is read by a separate task, so the
+// callback runs concurrently on the workers and the order of the
+// entries is unspecified. Without a tpool everything runs on the
+// calling thread. Either way fs_walk_ex returns when the whole
+// tree has been visited, or false if the root can't be opened.
+//
+// The batch and its strings are only valid during the callback.
+//
+// Usage example:
+// --------------
+//
+//     FS_WALK_FN(index_files) {
+//         Index *index = arg;
+//         mutex_scoped_lock(&index->lock);
+//         array_iter (e, &batch, *) index_add(index, e->path);
+//     }
+//
+//     fs_walk_ex(str("."), index_files, &index,
+//         .tpool    = pool,
+//         .include  = globs,   // "**/*.c", "**/*.h"
+//         .exclude  = ignored, // ".git", "**/build"
+//         .skip_directories = true,
+//     );
+//
+// =============================================================================
+istruct (FsWalkEntry) {
+    String path;          // The root joined with the relative path.
+    String relative_path; // Suffix of path.
+    String name;          // Suffix of path.
+    Bool is_directory;
+};
+
+array_typedef(FsWalkEntry, FsWalkEntry);
+
+#define FS_WALK_FN(NAME) Void NAME (SliceFsWalkEntry batch, Void *arg)
+typedef FS_WALK_FN(FsWalkFn);
+
+istruct (FsWalkConfig) {
+    FsWalkFn *fn;
+    Void *fn_arg;
+    TPool *tpool;        // 0 means walk on the calling thread.
+    SliceString include; // Empty means everything.
+    SliceString exclude;
+    U32 batch_size;      // 0 means 256.
+    Bool skip_files;
+    Bool skip_directories;
+};
+
+#define fs_walk_ex(ROOT, FN, ARG, ...) fs_walk_cfg(ROOT, &(FsWalkConfig){ .fn=(FN), .fn_arg=(ARG), __VA_ARGS__ })
+
+Bool fs_walk_cfg (String root, FsWalkConfig *);
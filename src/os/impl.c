@@ -1,3 +1,8 @@
+// The linux backends use non-POSIX APIs (syscall, futex, ...).
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+    #define _GNU_SOURCE
+#endif
+
 #include "base/core.h"
 
 #if OS_LINUX
@@ -5,6 +10,8 @@
     #include "os/linux/time.c"
     #include "os/linux/info.c"
     #include "os/linux/threads.c"
+    #include "os/linux/aio.c"
+    #include "os/linux/watch.c"
 #else
     #error "Bad os."
 #endif
@@ -1,6 +1,59 @@
 #pragma once
 
 #include "base/core.h"
+#include "base/array.h"
 
-U64 os_get_proc_count ();
-U64 os_get_page_size  ();
+// =============================================================================
+// Topology:
+//
+// The topology is read from sysfs on the first call and cached
+// for the lifetime of the program. It's safe to call from any
+// thread. If sysfs is unavailable, each logical cpu is reported
+// as its own core on package 0 and node 0, without caches.
+//
+// Only the cpus in the affinity the process started with (from
+// taskset, a cgroup cpuset, ...) are listed, so the counts are
+// those of the cpus the program can actually use.
+//
+// Logical cpus sharing a physical core (SMT siblings) have the
+// same core index and consecutive smt_index values. Cores are
+// numbered densely in the order of their first logical cpu, so
+// the core of cpus[0] is core 0.
+// =============================================================================
+istruct (OsCpu) {
+    U32 id;        // Logical cpu number as used for affinity.
+    U32 core;      // Dense index of the physical core.
+    U32 package;   // Physical package (socket) id.
+    U32 node;      // NUMA node.
+    U32 smt_index; // 0 for the first hardware thread of a core.
+};
+
+ienum (OsCacheType, U8) {
+    OS_CACHE_DATA,
+    OS_CACHE_INSTRUCTION,
+    OS_CACHE_UNIFIED,
+};
+
+istruct (OsCache) {
+    OsCacheType type;
+    U32 level;
+    U32 line_size;
+    U32 shared_by; // Number of logical cpus sharing one instance.
+    U64 size;      // Of one instance in bytes.
+};
+
+array_typedef(OsCpu, OsCpu);
+array_typedef(OsCache, OsCache);
+
+istruct (OsTopology) {
+    SliceOsCpu cpus;     // Online cpus in the process affinity, sorted by id.
+    SliceOsCache caches; // As seen from cpus[0].
+    U64 core_count;
+    U64 package_count;
+    U64 node_count;
+};
+
+U64         os_get_proc_count ();
+U64         os_get_page_size  ();
+OsTopology *os_get_topology   ();
+U64         os_get_cache_size (U32 level); // Data or unified cache, 0 if unknown.
@@ -0,0 +1,469 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "os/aio.h"
+#include "os/threads.h"
+
+// Every op is driven by the same state machine (advance) in both
+// backends. The io_uring backend turns each step into one SQE and
+// feeds the CQE back into advance on the completion thread. The
+// fallback runs the steps as blocking syscalls in a pool task.
+//
+// Each op has at most one SQE in flight at a time, and the count
+// of ops in flight is bounded by the slots semaphore, so neither
+// the SQ nor the CQ can overflow. All SQ writes and submissions
+// happen under the sq_lock; only the completion thread touches
+// the CQ.
+
+ienum (Step, U8) {
+    STEP_OPEN,
+    STEP_STAT,
+    STEP_READ,
+    STEP_FADVISE,
+    STEP_CLOSE,
+    STEP_DONE,
+};
+
+istruct (Req) {
+    Aio *aio;
+    AioOp *op;
+    TPoolGroup *group;
+    CString path;
+    Step step;
+    I32 error;
+    U64 pos; // Bytes read so far.
+    struct statx stx;
+};
+
+istruct (Ring) {
+    Int fd;
+    U8 *rings; // The SQ and CQ rings share one mapping.
+    U64 rings_size;
+    U32 *sq_head;
+    U32 *sq_tail;
+    U32 *sq_mask;
+    U32 *sq_array;
+    U32 *cq_head;
+    U32 *cq_tail;
+    U32 *cq_mask;
+    struct io_uring_sqe *sqes;
+    U64 sqes_size;
+    struct io_uring_cqe *cqes;
+    U32 entries;
+    U32 to_submit;
+};
+
+istruct (Aio) {
+    Mem *mem;
+    TPool *tpool;
+    Bool async;
+    Ring ring;
+    Mutex sq_lock;
+    Semaphore slots;
+    OsThread *reaper;
+    TPoolGroup tasks; // Fallback ops in flight.
+};
+
+// =============================================================================
+// State machine:
+// =============================================================================
+// Compound ops still have to close the file they opened.
+static Void fail (Req *req, I32 error) {
+    AioOp *op  = req->op;
+    req->error = error;
+
+    if (op->data.data) {
+        mem_free(op->mem, .old_ptr=op->data.data, .old_size=(op->data.count + 1));
+        op->data = (String){};
+    }
+
+    Bool owns_fd = (op->tag == AIO_READ_FILE || op->tag == AIO_PREFETCH) && (req->step != STEP_OPEN);
+    req->step = owns_fd ? STEP_CLOSE : STEP_DONE;
+}
+
+static Void first_step (Req *req) {
+    switch (req->op->tag) {
+    case AIO_OPEN:      req->step = STEP_OPEN; break;
+    case AIO_STAT:      req->step = STEP_STAT; break;
+    case AIO_READ:      req->step = STEP_READ; break;
+    case AIO_CLOSE:     req->step = STEP_CLOSE; break;
+    case AIO_READ_FILE: req->step = STEP_OPEN; break;
+    case AIO_PREFETCH:  req->step = STEP_OPEN; break;
+    }
+}
+
+// Res is the result of the current step in the kernel style:
+// a negative errno value on failure.
+static Void advance (Req *req, I64 res) {
+    AioOp *op = req->op;
+
+    switch (req->step) {
+    case STEP_OPEN:
+        if (res < 0) { fail(req, -res); break; }
+        op->fd = res;
+        req->step = (op->tag == AIO_OPEN) ? STEP_DONE :
+                    (op->tag == AIO_READ_FILE) ? STEP_STAT :
+                    STEP_FADVISE;
+        break;
+
+    case STEP_STAT:
+        if (res < 0) { fail(req, -res); break; }
+        op->size = req->stx.stx_size;
+
+        if (op->tag == AIO_STAT) {
+            req->step = STEP_DONE;
+        } else {
+            op->data.count = op->size;
+            op->data.data  = mem_alloc(op->mem, Char, .size=(op->size + 1));
+            req->step      = op->size ? STEP_READ : STEP_CLOSE;
+        }
+        break;
+
+    case STEP_READ: {
+        if (res < 0) { fail(req, -res); break; }
+        req->pos += res;
+        U64 want  = (op->tag == AIO_READ) ? op->buf.count : op->data.count;
+
+        if (res && (req->pos < want)) break; // Short read: read the rest.
+
+        if (op->tag == AIO_READ) {
+            op->size  = req->pos;
+            req->step = STEP_DONE;
+        } else {
+            op->data.count = req->pos; // The file shrank.
+            req->step = STEP_CLOSE;
+        }
+    } break;
+
+    case STEP_FADVISE:
+        req->step = STEP_CLOSE; // It's only a hint.
+        break;
+
+    case STEP_CLOSE:
+        if (res < 0 && !req->error) req->error = -res;
+        op->fd = -1;
+        req->step = STEP_DONE;
+        break;
+
+    case STEP_DONE: badpath;
+    }
+
+    if (req->step == STEP_DONE) {
+        op->error = req->error;
+        if (op->data.data) op->data.data[op->data.count] = 0;
+    }
+}
+
+static Void complete (Req *req) {
+    Aio *aio        = req->aio;
+    AioOp *op       = req->op;
+    TPoolGroup *grp = req->group;
+
+    mem_free(aio->mem, .old_ptr=req->path, .old_size=(op->path.count + 1));
+    mem_free(aio->mem, .old_ptr=req, .old_size=sizeof(Req));
+
+    if (aio->async) semaphore_post(&aio->slots, 1);
+    sync_event_set(&op->done); // The op may be freed after this.
+    tpool_group_release(aio->tpool, grp);
+}
+
+// =============================================================================
+// Fallback:
+// =============================================================================
+static I64 run_step (Req *req) {
+    AioOp *op = req->op;
+    I64 r = 0;
+
+    switch (req->step) {
+    case STEP_OPEN:    r = openat(AT_FDCWD, req->path, O_RDONLY|O_CLOEXEC); break;
+    case STEP_STAT:    r = (op->tag == AIO_STAT) ? statx(AT_FDCWD, req->path, 0, STATX_SIZE, &req->stx) : statx(op->fd, "", AT_EMPTY_PATH, STATX_SIZE, &req->stx); break;
+    case STEP_CLOSE:   r = close(op->fd); break;
+    case STEP_FADVISE: return -posix_fadvise(op->fd, 0, 0, POSIX_FADV_WILLNEED);
+    case STEP_READ:
+        if (op->tag == AIO_READ) r = pread(op->fd, op->buf.data + req->pos, op->buf.count - req->pos, op->offset + req->pos);
+        else                     r = pread(op->fd, op->data.data + req->pos, op->data.count - req->pos, req->pos);
+        break;
+    case STEP_DONE: badpath;
+    }
+
+    return (r < 0) ? -errno : r;
+}
+
+static TPOOL_FN(run_blocking) {
+    Req *req = arg;
+    while (req->step != STEP_DONE) advance(req, run_step(req));
+    complete(req);
+}
+
+// =============================================================================
+// io_uring:
+// =============================================================================
+static Int uring_setup (U32 entries, struct io_uring_params *p) {
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static Int uring_enter (Int fd, U32 to_submit, U32 min_complete, U32 flags) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, 0, 0);
+}
+
+// Opcodes for openat, statx, fadvise and close appeared in 5.6
+// along with the RW_CUR_POS feature, so that's what we look for.
+static Bool ring_init (Ring *ring, U32 entries) {
+    struct io_uring_params p = {};
+    Int fd = uring_setup(entries, &p);
+    if (fd < 0) return false;
+
+    U32 needed = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_RW_CUR_POS;
+    if ((p.features & needed) != needed) { close(fd); return false; }
+
+    ring->fd      = fd;
+    ring->entries = p.sq_entries;
+    ring->rings_size = max(p.sq_off.array + p.sq_entries*sizeof(U32), p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe));
+    ring->rings = mmap(0, ring->rings_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring->rings == MAP_FAILED) { close(fd); return false; }
+
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(0, ring->sqes_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) { munmap(ring->rings, ring->rings_size); close(fd); return false; }
+
+    ring->sq_head  = cast(U32*, ring->rings + p.sq_off.head);
+    ring->sq_tail  = cast(U32*, ring->rings + p.sq_off.tail);
+    ring->sq_mask  = cast(U32*, ring->rings + p.sq_off.ring_mask);
+    ring->sq_array = cast(U32*, ring->rings + p.sq_off.array);
+    ring->cq_head  = cast(U32*, ring->rings + p.cq_off.head);
+    ring->cq_tail  = cast(U32*, ring->rings + p.cq_off.tail);
+    ring->cq_mask  = cast(U32*, ring->rings + p.cq_off.ring_mask);
+    ring->cqes     = cast(struct io_uring_cqe*, ring->rings + p.cq_off.cqes);
+
+    return true;
+}
+
+static Void ring_destroy (Ring *ring) {
+    munmap(ring->sqes, ring->sqes_size);
+    munmap(ring->rings, ring->rings_size);
+    close(ring->fd);
+}
+
+// Must hold the sq_lock. The SQ can't be full (see the top).
+static struct io_uring_sqe *ring_get_sqe (Ring *ring) {
+    U32 tail = *ring->sq_tail + ring->to_submit;
+    U32 idx  = tail & *ring->sq_mask;
+    assert_dbg(tail - atomic_load_acquire(ring->sq_head) < ring->entries);
+    ring->sq_array[idx] = idx;
+    ring->to_submit++;
+    struct io_uring_sqe *sqe = &ring->sqes[idx];
+    *sqe = (struct io_uring_sqe){};
+    return sqe;
+}
+
+// Must hold the sq_lock. Publishes the SQEs obtained since the
+// last submit and hands them to the kernel in one syscall.
+static Void ring_submit (Ring *ring) {
+    if (! ring->to_submit) return;
+    atomic_store_release(ring->sq_tail, *ring->sq_tail + ring->to_submit);
+
+    while (ring->to_submit) {
+        Int r = uring_enter(ring->fd, ring->to_submit, 0, 0);
+        if (r >= 0) { ring->to_submit -= r; continue; }
+        assert_always(errno == EINTR || errno == EAGAIN || errno == EBUSY);
+        os_thread_yield();
+    }
+}
+
+static Void prep_step (Req *req, struct io_uring_sqe *sqe) {
+    AioOp *op = req->op;
+    sqe->user_data = cast(U64, req);
+
+    switch (req->step) {
+    case STEP_OPEN:
+        sqe->opcode     = IORING_OP_OPENAT;
+        sqe->fd         = AT_FDCWD;
+        sqe->addr       = cast(U64, req->path);
+        sqe->open_flags = O_RDONLY|O_CLOEXEC;
+        break;
+
+    case STEP_STAT:
+        sqe->opcode = IORING_OP_STATX;
+        sqe->len    = STATX_SIZE;
+        sqe->off    = cast(U64, &req->stx);
+
+        if (op->tag == AIO_STAT) {
+            sqe->fd   = AT_FDCWD;
+            sqe->addr = cast(U64, req->path);
+        } else {
+            sqe->fd          = op->fd;
+            sqe->addr        = cast(U64, "");
+            sqe->statx_flags = AT_EMPTY_PATH;
+        }
+        break;
+
+    case STEP_READ:
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd     = op->fd;
+
+        if (op->tag == AIO_READ) {
+            sqe->addr = cast(U64, op->buf.data + req->pos);
+            sqe->len  = op->buf.count - req->pos;
+            sqe->off  = op->offset + req->pos;
+        } else {
+            sqe->addr = cast(U64, op->data.data + req->pos);
+            sqe->len  = op->data.count - req->pos;
+            sqe->off  = req->pos;
+        }
+        break;
+
+    case STEP_FADVISE:
+        sqe->opcode         = IORING_OP_FADVISE;
+        sqe->fd             = op->fd;
+        sqe->fadvise_advice = POSIX_FADV_WILLNEED;
+        break;
+
+    case STEP_CLOSE:
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd     = op->fd;
+        break;
+
+    case STEP_DONE: badpath;
+    }
+}
+
+// A CQE with user_data 0 is the quit signal from aio_destroy
+// which only sends it once all ops are done.
+static Void reaper (Void *arg) {
+    Aio *aio   = arg;
+    Ring *ring = &aio->ring;
+
+    while (true) {
+        Int r = uring_enter(ring->fd, 0, 1, IORING_ENTER_GETEVENTS);
+        if (r < 0) assert_always(errno == EINTR || errno == EAGAIN || errno == EBUSY);
+
+        U32 head = *ring->cq_head;
+        U32 tail = atomic_load_acquire(ring->cq_tail);
+        Bool quit = false;
+        Bool resubmit = false;
+
+        for (; head != tail; ++head) {
+            struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+            Req *req = cast(Req*, cqe->user_data);
+            I32 res  = cqe->res;
+
+            if (! req) { quit = true; continue; }
+
+            advance(req, res);
+
+            if (req->step == STEP_DONE) {
+                complete(req);
+            } else {
+                mutex_lock(&aio->sq_lock);
+                prep_step(req, ring_get_sqe(ring));
+                mutex_unlock(&aio->sq_lock);
+                resubmit = true;
+            }
+        }
+
+        atomic_store_release(ring->cq_head, head);
+
+        if (resubmit) {
+            mutex_scoped_lock(&aio->sq_lock);
+            ring_submit(ring);
+        }
+
+        if (quit) return;
+    }
+}
+
+// =============================================================================
+// Api:
+// =============================================================================
+Aio *aio_new (Mem *mem, TPool *tp, U32 queue_depth) {
+    Auto aio   = mem_new(mem, Aio);
+    aio->mem   = mem;
+    aio->tpool = tp;
+    aio->async = ring_init(&aio->ring, next_pow2(max(queue_depth, 2u)));
+
+    if (aio->async) {
+        semaphore_init(&aio->slots, aio->ring.entries - 1); // Keep one for the quit signal.
+        aio->reaper = os_thread_new(mem, reaper, aio);
+        assert_always(aio->reaper);
+    }
+
+    return aio;
+}
+
+Void aio_destroy (Aio *aio) {
+    if (aio->async) {
+        for (U32 i = 1; i < aio->ring.entries; ++i) semaphore_wait(&aio->slots);
+
+        mutex_lock(&aio->sq_lock);
+        ring_get_sqe(&aio->ring)->opcode = IORING_OP_NOP;
+        ring_submit(&aio->ring);
+        mutex_unlock(&aio->sq_lock);
+
+        os_thread_join(aio->reaper);
+        os_thread_destroy(aio->reaper, aio->mem);
+        ring_destroy(&aio->ring);
+    } else {
+        tpool_group_wait(aio->tpool, &aio->tasks);
+    }
+
+    mem_free(aio->mem, .old_ptr=aio, .old_size=sizeof(Aio));
+}
+
+Void aio_submit (Aio *aio, AioOp *op, TPoolGroup *group) {
+    aio_submit_n(aio, op, 1, group);
+}
+
+// With io_uring this blocks only if queue_depth ops are already
+// in flight. The whole batch is submitted with one syscall.
+Void aio_submit_n (Aio *aio, AioOp *ops, U64 count, TPoolGroup *group) {
+    for (U64 i = 0; i < count; ++i) {
+        AioOp *op    = &ops[i];
+        op->error    = 0;
+        op->done     = (SyncEvent){};
+        op->data     = (String){};
+        if (op->tag != AIO_READ && op->tag != AIO_CLOSE) op->fd = -1;
+
+        Auto req   = mem_new(aio->mem, Req);
+        req->aio   = aio;
+        req->op    = op;
+        req->group = group;
+        req->path  = cstr(aio->mem, op->path);
+        first_step(req);
+
+        tpool_group_hold(aio->tpool, group);
+
+        if (! aio->async) {
+            tpool_group_push(aio->tpool, &aio->tasks, run_blocking, req);
+            continue;
+        }
+
+        if (! semaphore_try_wait(&aio->slots)) {
+            { mutex_scoped_lock(&aio->sq_lock); ring_submit(&aio->ring); } // Don't sit on the batch while blocked.
+            semaphore_wait(&aio->slots);
+        }
+
+        mutex_scoped_lock(&aio->sq_lock);
+        prep_step(req, ring_get_sqe(&aio->ring));
+    }
+
+    if (aio->async) {
+        mutex_scoped_lock(&aio->sq_lock);
+        ring_submit(&aio->ring);
+    }
+}
+
+Void aio_wait (AioOp *op) {
+    sync_event_wait(&op->done);
+}
+
+Bool aio_done (AioOp *op) {
+    return sync_event_is_set(&op->done);
+}
+
+Bool aio_is_async (Aio *aio) {
+    return aio->async;
+}
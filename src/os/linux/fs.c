@@ -5,8 +5,15 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
 #include <sys/sendfile.h>
+#include <linux/fs.h>
+#include <sys/syscall.h>
 #include "os/fs.h"
+#include "os/info.h"
+#include "os/threads.h"
 
 String fs_read_entire_file (Mem *mem, String path, U64 extra_space) {
     tmem_new(tm);
@@ -42,6 +49,78 @@ String fs_read_entire_file (Mem *mem, String path, U64 extra_space) {
     return result;
 }
 
+// The fallback for fs_map_file(). The result lives in an
+// anonymous mapping, so fs_unmap_file() doesn't have to know
+// which path produced it.
+static String map_by_reading (Int fd) {
+    tmem_new(tm);
+    AString buf = astr_new(tm);
+
+    while (true) {
+        array_ensure_capacity(&buf, 64*KB);
+        Auto r = read(fd, buf.data + buf.count, buf.capacity - buf.count);
+        if (r < 0) return (String){};
+        if (r == 0) break;
+        buf.count += r;
+    }
+
+    if (! buf.count) return (String){};
+
+    Void *p = mmap(0, buf.count, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) return (String){};
+    memcpy(p, buf.data, buf.count);
+    mprotect(p, buf.count, PROT_READ);
+
+    return (String){ .data=p, .count=buf.count };
+}
+
+String fs_map_file (String path, FsAccess access, FsMapFlags flags) {
+    tmem_new(tm);
+
+    Auto fd = open(cstr(tm, path), O_RDONLY);
+    if (fd < 0) return (String){};
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) { close(fd); return (String){}; }
+
+    String result = {};
+
+    if (S_ISREG(st.st_mode) && st.st_size > 0) {
+        Int mmap_flags = MAP_PRIVATE | ((flags & FS_MAP_POPULATE) ? MAP_POPULATE : 0);
+        Void *p = mmap(0, st.st_size, PROT_READ, mmap_flags, fd, 0);
+        if (p != MAP_FAILED) result = (String){ .data=p, .count=cast(U64, st.st_size) };
+    }
+
+    if (! result.data) result = map_by_reading(fd);
+    close(fd); // The mapping holds its own reference to the file.
+
+    fs_advise(result, 0, result.count, access);
+    if ((flags & FS_MAP_PREFETCH) && result.data) posix_madvise(result.data, result.count, POSIX_MADV_WILLNEED);
+    return result;
+}
+
+Void fs_unmap_file (String mapped_file) {
+    if (mapped_file.data) munmap(mapped_file.data, mapped_file.count);
+}
+
+// The range [offset, offset+count) is extended to page
+// boundaries as required by the kernel.
+Void fs_advise (String mapped_file, U64 offset, U64 count, FsAccess access) {
+    if (! mapped_file.data) return;
+
+    Int advice = 0;
+    switch (access) {
+    case FS_ACCESS_NORMAL:     advice = POSIX_MADV_NORMAL; break;
+    case FS_ACCESS_RANDOM:     advice = POSIX_MADV_RANDOM; break;
+    case FS_ACCESS_SEQUENTIAL: advice = POSIX_MADV_SEQUENTIAL; break;
+    }
+
+    offset    = min(offset, mapped_file.count);
+    count     = min(count, mapped_file.count - offset);
+    U64 start = offset & ~(os_get_page_size() - 1);
+    posix_madvise(mapped_file.data + start, offset + count - start, advice);
+}
+
 Bool fs_write_entire_file (String path, String buf) {
     tmem_new(tm);
 
@@ -51,7 +130,7 @@ Bool fs_write_entire_file (String path, String buf) {
     U64 bytes_written = 0;
     while (bytes_written < buf.count) {
         Auto r = write(fd, buf.data+bytes_written, buf.count-bytes_written);
-        if (r == -1) return false;
+        if (r == -1) { close(fd); return false; }
         bytes_written += r;
     }
 
@@ -59,6 +138,50 @@ Bool fs_write_entire_file (String path, String buf) {
     return true;
 }
 
+Int fs_open_append (String path) {
+    tmem_new(tm);
+    return open(cstr(tm, path), O_CREAT|O_WRONLY|O_APPEND|O_CLOEXEC, 0644);
+}
+
+Int fs_open_new (String path) {
+    tmem_new(tm);
+    return open(cstr(tm, path), O_CREAT|O_WRONLY|O_TRUNC|O_CLOEXEC, 0644);
+}
+
+Bool fs_write_chunks (Int fd, SliceString chunks) {
+    struct iovec iov[64];
+    U64 chunk  = 0;
+    U64 offset = 0; // Into the first chunk that isn't fully written.
+
+    while (chunk < chunks.count) {
+        U64 n = 0;
+
+        for (U64 i = chunk; i < chunks.count && n < 64; ++i) {
+            String c = array_get(&chunks, i);
+            U64 skip = (i == chunk) ? offset : 0;
+            iov[n++] = (struct iovec){ .iov_base=(c.data + skip), .iov_len=(c.count - skip) };
+        }
+
+        I64 r = writev(fd, iov, n);
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0) return false;
+
+        for (U64 w = r; chunk < chunks.count;) {
+            U64 left = array_get(&chunks, chunk).count - offset;
+            if (w < left) { offset += w; break; }
+            w -= left;
+            offset = 0;
+            chunk++;
+        }
+    }
+
+    return true;
+}
+
+Void fs_close (Int fd) {
+    close(fd);
+}
+
 U64 fs_file_size (String path) {
     tmem_new(tm);
     struct stat st = {};
@@ -66,31 +189,231 @@ U64 fs_file_size (String path) {
     return (r == 0) ? st.st_size : 0;
 }
 
+// =============================================================================
+// Copying:
+// =============================================================================
+#define COPY_CHUNK (16*MB) // Granularity of progress reports and cancellation.
+
+istruct (FsBatch) {
+    Mem *mem;
+    OsThread *thread;
+    SliceFsBatchItem items;
+    Bool move;
+    FsCopyFlags flags;
+    FsProgressFn *fn;
+    Void *fn_arg;
+    Bool canceled;
+    Bool done;
+    FsProgress progress; // Updated atomically.
+};
+
+istruct (CopyCtx) {
+    FsBatch *batch; // Can be null.
+    Bool no_copy_file_range;
+};
+
+static Void report (FsBatch *b) {
+    if (! b->fn) return;
+    FsProgress p;
+    fs_batch_progress(b, &p);
+    b->fn(&p, b->fn_arg);
+}
+
+// Returns false if the batch was canceled.
+static Bool advance_progress (CopyCtx *ctx, U64 bytes) {
+    FsBatch *b = ctx->batch;
+    if (! b) return true;
+    atomic_add_load(&b->progress.bytes_done, bytes);
+    report(b);
+    return ! atomic_load(&b->canceled);
+}
+
+// Tries copy_file_range and falls back to sendfile for the rest
+// of the batch if the kernel or the filesystems don't support it.
+static Bool copy_range (Int in, Int out, U64 offset, U64 count, CopyCtx *ctx) {
+    while (count) {
+        U64 chunk = min(count, COPY_CHUNK);
+        I64 r;
+
+        if (! ctx->no_copy_file_range) {
+            loff_t in_off  = offset;
+            loff_t out_off = offset;
+            r = copy_file_range(in, &in_off, out, &out_off, chunk, 0);
+
+            if (r < 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP)) {
+                ctx->no_copy_file_range = true;
+                continue;
+            }
+        } else {
+            if (lseek(out, offset, SEEK_SET) < 0) return false;
+            off_t in_off = offset;
+            r = sendfile(out, in, &in_off, chunk);
+        }
+
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0) return false;
+        if (r == 0) return true; // The source shrank.
+
+        offset += r;
+        count  -= r;
+        if (! advance_progress(ctx, r)) return false;
+    }
+
+    return true;
+}
+
+// Copies the data regions and skips the holes. The holes past
+// the last data region are made by the final ftruncate.
+static Bool copy_sparse (Int in, Int out, U64 size, CopyCtx *ctx) {
+    U64 offset = 0;
+
+    while (offset < size) {
+        off_t data = lseek(in, offset, SEEK_DATA);
+
+        if (data < 0 && errno == ENXIO) break; // Only a hole left.
+        if (data < 0) return copy_range(in, out, offset, size - offset, ctx); // No SEEK_DATA support.
+
+        off_t hole = lseek(in, data, SEEK_HOLE);
+        if (hole < 0) hole = size;
+        hole = min(cast(U64, hole), size);
+
+        if (! advance_progress(ctx, data - offset)) return false;
+        if (! copy_range(in, out, data, hole - data, ctx)) return false;
+        offset = hole;
+    }
+
+    if (! advance_progress(ctx, size - min(offset, size))) return false;
+    return ftruncate(out, size) == 0;
+}
+
+// The data goes into a temporary file next to the destination
+// which is renamed over it at the end. So the destination is
+// never truncated, and a failed copy leaves it as it was. Copying
+// a file onto itself (or onto a hard link of it) is an error.
+static Bool copy_file (String oldpath, String newpath, FsCopyFlags flags, CopyCtx *ctx) {
+    tmem_new(tm);
+    static U32 tmp_counter;
+
+    Int in = open(cstr(tm, oldpath), O_RDONLY|O_CLOEXEC);
+    if (in < 0) return false;
+
+    struct stat st;
+    if (fstat(in, &st) != 0 || !S_ISREG(st.st_mode)) { close(in); return false; }
+
+    CString out_path = cstr(tm, newpath);
+    struct stat dst;
+
+    if (stat(out_path, &dst) == 0 && dst.st_dev == st.st_dev && dst.st_ino == st.st_ino) {
+        close(in);
+        errno = EINVAL;
+        return false;
+    }
+
+    CString tmp_path = cstr(tm, astr_fmt(tm, "%.*s.tmp-%i-%u", STR(newpath), getpid(), atomic_inc_load(&tmp_counter)));
+    Int out = open(tmp_path, O_WRONLY|O_CREAT|O_EXCL|O_CLOEXEC, st.st_mode & 0777);
+    if (out < 0) { close(in); return false; }
+
+    Bool ok = false;
+    if (!(flags & FS_COPY_NO_REFLINK) && ioctl(out, FICLONE, in) == 0) {
+        ok = advance_progress(ctx, st.st_size);
+    } else if (flags & FS_COPY_SPARSE) {
+        ok = copy_sparse(in, out, st.st_size, ctx);
+    } else {
+        ok = copy_range(in, out, 0, st.st_size, ctx);
+    }
+
+    close(in);
+    if (close(out) != 0) ok = false;
+    if (ok && rename(tmp_path, out_path) != 0) ok = false;
+    if (! ok) unlink(tmp_path);
+    return ok;
+}
+
+Bool fs_copy_ex (String oldpath, String newpath, FsCopyFlags flags) {
+    CopyCtx ctx = {};
+    return copy_file(oldpath, newpath, flags, &ctx);
+}
+
 Bool fs_copy (String oldpath, String newpath) {
+    return fs_copy_ex(oldpath, newpath, FS_COPY_SPARSE);
+}
+
+static Bool batch_item (FsBatch *b, FsBatchItem *item, CopyCtx *ctx) {
     tmem_new(tm);
 
-    Auto old_fd = open(cstr(tm, oldpath), O_RDONLY);
-    if (old_fd < 0) return false;
+    if (b->move) {
+        if (rename(cstr(tm, item->from), cstr(tm, item->to)) == 0) {
+            advance_progress(ctx, fs_file_size(item->to));
+            return true;
+        }
 
-    Auto new_fd = open(cstr(tm, newpath), O_WRONLY, 0744);
-    if (new_fd < 0) { close(old_fd); return false; }
+        if (errno != EXDEV) return false;
+    }
 
-    U64 bytes_to_copy = fs_file_size(oldpath);
-    U64 bytes_copied  = 0;
-    Bool result = true;
+    if (! copy_file(item->from, item->to, b->flags, ctx)) return false;
+    return b->move ? fs_delete(item->from) : true;
+}
 
-    while (bytes_to_copy > 0) {
-        off_t offset = bytes_copied;
-        Int r = sendfile(new_fd, old_fd, &offset, bytes_to_copy);
-        if (r < 0) { result = false; break; }
-        if (r == 0) break;
-        bytes_to_copy -= r;
-        bytes_copied  += r;
+static Void batch_run (Void *arg) {
+    FsBatch *b  = arg;
+    CopyCtx ctx = { .batch=b };
+
+    array_iter (item, &b->items, *) {
+        if (atomic_load(&b->canceled)) break;
+        item->ok = batch_item(b, item, &ctx);
+        atomic_inc_load(&b->progress.files_done);
+        report(b);
     }
 
-    close(old_fd);
-    close(new_fd);
-    return result;
+    atomic_store(&b->done, true);
+}
+
+// The totals are computed on the calling thread so that they
+// are valid as soon as this returns.
+FsBatch *fs_batch_new (Mem *mem, SliceFsBatchItem items, Bool move, FsCopyFlags flags, FsProgressFn *fn, Void *fn_arg) {
+    Auto b    = mem_new(mem, FsBatch);
+    b->mem    = mem;
+    b->items  = items;
+    b->move   = move;
+    b->flags  = flags;
+    b->fn     = fn;
+    b->fn_arg = fn_arg;
+
+    b->progress.files_total = items.count;
+    array_iter (item, &items, *) {
+        item->ok = false;
+        b->progress.bytes_total += fs_file_size(item->from);
+    }
+
+    b->thread = os_thread_new(mem, batch_run, b);
+    assert_always(b->thread);
+    return b;
+}
+
+Void fs_batch_progress (FsBatch *b, FsProgress *out) {
+    out->bytes_done  = atomic_load(&b->progress.bytes_done);
+    out->bytes_total = b->progress.bytes_total;
+    out->files_done  = atomic_load(&b->progress.files_done);
+    out->files_total = b->progress.files_total;
+}
+
+Void fs_batch_cancel (FsBatch *b) {
+    atomic_store(&b->canceled, true);
+}
+
+Bool fs_batch_done (FsBatch *b) {
+    return atomic_load(&b->done);
+}
+
+Bool fs_batch_wait (FsBatch *b) {
+    os_thread_join(b->thread);
+    os_thread_destroy(b->thread, b->mem);
+
+    Bool ok = true;
+    array_iter (item, &b->items, *) ok &= item->ok;
+
+    mem_free(b->mem, .old_ptr=b, .old_size=sizeof(FsBatch));
+    return ok;
 }
 
 String fs_current_working_dir (Mem *mem) {
@@ -132,7 +455,7 @@ String fs_get_full_path (Mem *mem, String path) {
     return r ? str(b) : (String){};
 }
 
-Bool fs_delete_file (String path) {
+Bool fs_delete (String path) {
     tmem_new(tm);
     Int r = remove(cstr(tm, path));
     return r == 0;
@@ -161,35 +484,243 @@ FsIter *fs_iter_new (Mem *mem, String path, Bool skip_dirs, Bool skip_files) {
     return &it->base;
 }
 
+// The type of an entry comes from readdir when the filesystem
+// reports it, so stat is only needed for symlinks and unknowns.
 Bool fs_iter_next (FsIter *iter) {
-    if (! cast(FsIterLinux*, iter)->dir) return false;
+    DIR *dir = cast(FsIterLinux*, iter)->dir;
+    if (! dir) return false;
 
     while (true) {
-        Auto entry = readdir(cast(FsIterLinux*, iter)->dir);
+        Auto entry = readdir(dir);
         if (! entry) return false;
 
+        CString name = entry->d_name;
+        if (name[0] == '.' && name[1] == 0) continue;
+        if (name[0] == '.' && name[1] == '.' && name[2] == 0) continue;
+
+        Bool is_dir = entry->d_type == DT_DIR;
+
+        if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+            struct stat st = {};
+            if (fstatat(dirfd(dir), name, &st, 0) == -1) continue;
+            if (!S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode)) continue;
+            is_dir = S_ISDIR(st.st_mode);
+        } else if (entry->d_type != DT_REG && !is_dir) {
+            continue;
+        }
+
+        if (!is_dir && iter->skip_files) continue;
+        if (is_dir && iter->skip_directories) continue;
+
         iter->current_full_path.count = 0;
-        astr_push_fmt(&iter->current_full_path, "%.*s/%s", STR(iter->directory_path), entry->d_name);
+        astr_cat(&iter->current_full_path, iter->directory_path, "/", name);
+        astr_push_byte(&iter->current_full_path, 0);
+        iter->current_full_path.count--;
         iter->current_file_name = str(entry->d_name);
+        iter->is_directory = is_dir;
+        return true;
+    }
+}
 
-        struct stat st = {};
-        Int r = stat(iter->current_full_path.data, &st);
+Void fs_iter_destroy (FsIter *iter) {
+    if (cast(FsIterLinux*, iter)->dir) closedir(cast(FsIterLinux*, iter)->dir);
+    array_free(&iter->current_full_path);
+    mem_free(iter->mem, .old_ptr=iter, .old_size=sizeof(FsIterLinux));
+}
+
+// =============================================================================
+// Walker:
+//
+// Directories are opened relative to the root fd and entries are
+// stat'ed (when needed) relative to their directory fd, so the
+// kernel never has to resolve a full path. Each directory is one
+// job: a pool task, or an element of the pending stack when there
+// is no pool. A job owns its relative path (allocated from
+// mem_root since jobs move between threads) and frees it.
+//
+// The batches are built in a scratch scope per batch, so memory
+// stays bounded even for directories with millions of entries.
+// =============================================================================
+#define WALK_DENTS_SIZE (32*KB)
+
+istruct (LinuxDirent64) {
+    U64 d_ino;
+    I64 d_off;
+    U16 d_reclen;
+    U8  d_type;
+    Char d_name[];
+};
+
+istruct (Walk) {
+    FsWalkConfig *cfg;
+    String root;
+    Int root_fd;
+    U32 batch_size;
+    TPoolGroup group;
+    ArrayString pending;
+};
+
+istruct (WalkJob) {
+    Walk *walk;
+    String rel;
+};
+
+static Bool walk_matches (SliceString globs, String path) {
+    array_iter (glob, &globs) if (str_glob_match(glob, path)) return true;
+    return false;
+}
+
+static Void walk_dir (Walk *, String rel);
+
+static Void walk_free_rel (String rel) {
+    if (rel.count) mem_free(mem_root, .old_ptr=rel.data, .old_size=rel.count);
+}
+
+static TPOOL_FN(walk_task) {
+    WalkJob *job = arg;
+    walk_dir(job->walk, job->rel);
+    walk_free_rel(job->rel);
+    mem_free(mem_root, .old_ptr=job, .old_size=sizeof(WalkJob));
+}
+
+// The root is pushed with an empty relative path.
+static Void walk_push (Walk *w, String rel) {
+    String copy = {};
+
+    if (rel.count) {
+        copy = (String){ .data=mem_alloc(mem_root, Char, .size=rel.count), .count=rel.count };
+        memcpy(copy.data, rel.data, rel.count);
+    }
+
+    if (w->cfg->tpool) {
+        Auto job  = mem_new(mem_root, WalkJob);
+        job->walk = w;
+        job->rel  = copy;
+        tpool_group_push(w->cfg->tpool, &w->group, walk_task, job);
+    } else {
+        array_push(&w->pending, copy);
+    }
+}
 
-        if (r == -1) continue;
-        if (!S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode)) continue;
-        if (S_ISREG(st.st_mode) && iter->skip_files) continue;
-        if (S_ISDIR(st.st_mode) && iter->skip_directories) continue;
-        if (entry->d_name[0] == '.' && entry->d_name[1] == 0) continue;
-        if (entry->d_name[0] == '.' && entry->d_name[1] == '.' && entry->d_name[2] == 0) continue;
+// Returns false if the entry should be skipped.
+static Bool walk_entry_type (Int dir_fd, LinuxDirent64 *d, Bool *out_is_dir, Bool *out_is_link) {
+    *out_is_link = d->d_type == DT_LNK;
 
-        iter->is_directory = S_ISDIR(st.st_mode);
-        break;
+    switch (d->d_type) {
+    case DT_DIR: *out_is_dir = true; return true;
+    case DT_REG: *out_is_dir = false; return true;
+    case DT_LNK: break;
+    case DT_UNKNOWN: break;
+    default: return false;
     }
 
+    struct stat st;
+
+    if (d->d_type == DT_UNKNOWN) {
+        if (fstatat(dir_fd, d->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1) return false;
+        *out_is_link = S_ISLNK(st.st_mode);
+    }
+
+    if (*out_is_link && fstatat(dir_fd, d->d_name, &st, 0) == -1) return false;
+    if (!S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode)) return false;
+    *out_is_dir = S_ISDIR(st.st_mode);
     return true;
 }
 
-Void fs_iter_destroy (FsIter *iter) {
-    closedir(cast(FsIterLinux*, iter)->dir);
-    mem_free(iter->mem, .old_ptr=iter, .old_size=sizeof(FsIterLinux));
+static Void walk_dir (Walk *w, String rel) {
+    tmem_new(tm);
+    FsWalkConfig *cfg = w->cfg;
+
+    Int fd = openat(w->root_fd, rel.count ? cstr(tm, rel) : ".", O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    if (fd < 0) return;
+
+    U8 *dents = mem_alloc(tm, U8, .size=WALK_DENTS_SIZE);
+    I64 dents_count = 0;
+    I64 dents_pos = 0;
+    Bool eof = false;
+    Bool sep = w->root.count && (w->root.data[w->root.count-1] != '/');
+
+    while (! eof) {
+        tmem_new(btm);
+        ArrayFsWalkEntry batch;
+        array_init(&batch, btm);
+
+        while (batch.count < w->batch_size) {
+            if (dents_pos == dents_count) {
+                dents_count = syscall(SYS_getdents64, fd, dents, WALK_DENTS_SIZE);
+                dents_pos = 0;
+                if (dents_count <= 0) { eof = true; break; }
+            }
+
+            Auto d = cast(LinuxDirent64*, dents + dents_pos);
+            dents_pos += d->d_reclen;
+
+            if (d->d_name[0] == '.' && d->d_name[1] == 0) continue;
+            if (d->d_name[0] == '.' && d->d_name[1] == '.' && d->d_name[2] == 0) continue;
+
+            Bool is_dir, is_link;
+            if (! walk_entry_type(fd, d, &is_dir, &is_link)) continue;
+            if (!is_dir && cfg->skip_files) continue;
+
+            // Build "root/rel/name" in one allocation; the relative
+            // path and the name are slices of it.
+            U64 name_count = strlen(d->d_name);
+            U64 rel_count  = rel.count ? rel.count + 1 + name_count : name_count;
+            U64 root_count = w->root.count + sep;
+            Char *p        = mem_alloc(btm, Char, .size=(root_count + rel_count + 1));
+
+            memcpy(p, w->root.data, w->root.count);
+            if (sep) p[w->root.count] = '/';
+            if (rel.count) { memcpy(p + root_count, rel.data, rel.count); p[root_count + rel.count] = '/'; }
+            memcpy(p + root_count + rel_count - name_count, d->d_name, name_count + 1);
+
+            FsWalkEntry e = {
+                .path          = { .data=p, .count=(root_count + rel_count) },
+                .relative_path = { .data=(p + root_count), .count=rel_count },
+                .name          = { .data=(p + root_count + rel_count - name_count), .count=name_count },
+                .is_directory  = is_dir,
+            };
+
+            if (walk_matches(cfg->exclude, e.relative_path)) continue;
+            if (is_dir && !is_link) walk_push(w, e.relative_path);
+            if (is_dir ? cfg->skip_directories : cfg->skip_files) continue;
+            if (cfg->include.count && !walk_matches(cfg->include, e.relative_path)) continue;
+
+            array_push(&batch, e);
+        }
+
+        if (batch.count) cfg->fn(batch.as_slice, cfg->fn_arg);
+    }
+
+    close(fd);
+}
+
+Bool fs_walk_cfg (String root, FsWalkConfig *cfg) {
+    tmem_new(tm);
+
+    Walk w = {
+        .cfg        = cfg,
+        .root       = root,
+        .root_fd    = open(cstr(tm, root), O_RDONLY|O_DIRECTORY|O_CLOEXEC),
+        .batch_size = cfg->batch_size ?: 256,
+    };
+
+    if (w.root_fd < 0) return false;
+
+    if (cfg->tpool) {
+        walk_push(&w, (String){});
+        tpool_group_wait(cfg->tpool, &w.group);
+    } else {
+        array_init(&w.pending, tm);
+        walk_push(&w, (String){});
+
+        while (w.pending.count) {
+            String rel = array_pop(&w.pending);
+            walk_dir(&w, rel);
+            walk_free_rel(rel);
+        }
+    }
+
+    close(w.root_fd);
+    return true;
 }
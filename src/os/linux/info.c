@@ -1,6 +1,10 @@
+#include <fcntl.h>
+#include <sched.h>
 #include <unistd.h>
 #include <sys/sysinfo.h>
 #include "os/info.h"
+#include "base/sync.h"
+#include "base/string.h"
 
 U64 os_get_proc_count () {
     return get_nprocs();
@@ -9,3 +13,194 @@ U64 os_get_proc_count () {
 U64 os_get_page_size () {
     return sysconf(_SC_PAGESIZE);
 }
+
+// =============================================================================
+// Topology:
+// =============================================================================
+#define SYS_CPU_DIR  "/sys/devices/system/cpu"
+#define SYS_NODE_DIR "/sys/devices/system/node"
+
+static OsTopology *topology;
+static Mutex topology_mutex;
+
+// Captured before main() runs, so it's the affinity the process
+// was started with (for example by taskset or a cpuset) and not
+// the pin of some thread. The topology only lists these cpus and
+// os_thread_new starts threads with this affinity.
+static cpu_set_t process_affinity;
+static Bool process_affinity_valid;
+
+[[gnu::constructor]] static Void capture_process_affinity () {
+    process_affinity_valid = sched_getaffinity(0, sizeof(cpu_set_t), &process_affinity) == 0;
+}
+
+static Bool cpu_allowed (U32 id) {
+    return !process_affinity_valid || (id < CPU_SETSIZE && CPU_ISSET(id, &process_affinity));
+}
+
+// Sysfs files report a fake size of 4KB, so they can't go
+// through fs_read_entire_file. They are all tiny anyway.
+static String read_sys_file (Mem *mem, CString fmt, U64 arg1, U64 arg2) {
+    Char path[256];
+    snprintf(path, sizeof(path), fmt, arg1, arg2);
+
+    Int fd = open(path, O_RDONLY);
+    if (fd < 0) return (String){};
+
+    Char *buf = mem_alloc(mem, Char, .size=256);
+    Auto n = read(fd, buf, 255);
+    close(fd);
+    if (n <= 0) return (String){};
+
+    buf[n] = 0;
+    return str_trim((String){ .data=buf, .count=cast(U64, n) });
+}
+
+static Bool read_sys_u64 (CString fmt, U64 arg1, U64 arg2, U64 *out) {
+    tmem_new(tm);
+    String s = read_sys_file(tm, fmt, arg1, arg2);
+    return s.count && str_parse_u64(s, out, 10);
+}
+
+// Parses lists like "0-3,8,10-11".
+static Bool parse_cpu_list (String s, ArrayU32 *out) {
+    tmem_new(tm);
+    ArrayString ranges;
+    array_init(&ranges, tm);
+    str_split(s, str(","), false, false, &ranges);
+
+    array_iter (range, &ranges) {
+        U64 a, b;
+        U64 dash = str_index_of_first(range, '-');
+
+        if (dash == ARRAY_NIL_IDX) {
+            if (! str_parse_u64(range, &a, 10)) return false;
+            b = a;
+        } else {
+            if (! str_parse_u64(str_prefix_to(range, dash), &a, 10)) return false;
+            if (! str_parse_u64(str_suffix_from(range, dash + 1), &b, 10)) return false;
+        }
+
+        for (U64 i = a; i <= b; ++i) array_push(out, cast(U32, i));
+    }
+
+    return true;
+}
+
+// Sizes look like "32K" or "16M".
+static U64 parse_cache_size (String s) {
+    U64 mul = 1;
+    if      (str_ends_with(s, str("K"))) { mul = KB; s.count--; }
+    else if (str_ends_with(s, str("M"))) { mul = MB; s.count--; }
+    else if (str_ends_with(s, str("G"))) { mul = GB; s.count--; }
+    U64 n;
+    return str_parse_u64(s, &n, 10) ? n * mul : 0;
+}
+
+static Void read_caches (U32 cpu, ArrayOsCache *out) {
+    for (U64 i = 0;; ++i) {
+        tmem_new(tm);
+        String type = read_sys_file(tm, SYS_CPU_DIR "/cpu%lu/cache/index%lu/type", cpu, i);
+        if (! type.count) break;
+
+        OsCache cache = {};
+        U64 level = 0, line = 0;
+        read_sys_u64(SYS_CPU_DIR "/cpu%lu/cache/index%lu/level", cpu, i, &level);
+        read_sys_u64(SYS_CPU_DIR "/cpu%lu/cache/index%lu/coherency_line_size", cpu, i, &line);
+        cache.level     = level;
+        cache.line_size = line;
+        cache.size      = parse_cache_size(read_sys_file(tm, SYS_CPU_DIR "/cpu%lu/cache/index%lu/size", cpu, i));
+        cache.type      = str_match(type, str("Data"))        ? OS_CACHE_DATA :
+                          str_match(type, str("Instruction")) ? OS_CACHE_INSTRUCTION :
+                                                                OS_CACHE_UNIFIED;
+
+        ArrayU32 shared;
+        array_init(&shared, tm);
+        parse_cpu_list(read_sys_file(tm, SYS_CPU_DIR "/cpu%lu/cache/index%lu/shared_cpu_list", cpu, i), &shared);
+        cache.shared_by = max(shared.count, 1u);
+
+        array_push(out, cache);
+    }
+}
+
+static OsTopology *read_topology (Mem *mem) {
+    tmem_new(tm);
+    OsTopology *topo = mem_new(mem, OsTopology);
+
+    ArrayU32 online;
+    array_init(&online, tm);
+    if (! parse_cpu_list(read_sys_file(tm, SYS_CPU_DIR "/online", 0, 0), &online) || !online.count) {
+        online.count = 0;
+        for (U32 i = 0; i < os_get_proc_count(); ++i) array_push(&online, i);
+    }
+
+    // Cpus outside the affinity can't be pinned to, so they
+    // would only make the pool oversized.
+    ArrayU32 allowed;
+    array_init(&allowed, tm);
+    array_iter (id, &online) if (cpu_allowed(id)) array_push(&allowed, id);
+    if (allowed.count) online = allowed;
+
+    ArrayOsCpu cpus;
+    array_init(&cpus, mem);
+
+    // Maps (package, core_id) pairs to dense core indices.
+    ArrayU64 core_keys;
+    array_init(&core_keys, tm);
+    U64 max_package = 0;
+
+    array_iter (id, &online) {
+        U64 package = 0, core_id = id;
+        read_sys_u64(SYS_CPU_DIR "/cpu%lu/topology/physical_package_id", id, 0, &package);
+        read_sys_u64(SYS_CPU_DIR "/cpu%lu/topology/core_id", id, 0, &core_id);
+
+        U64 key  = (package << 32) | core_id;
+        U64 core = array_find(&core_keys, IT == key);
+        if (core == ARRAY_NIL_IDX) { core = core_keys.count; array_push(&core_keys, key); }
+
+        U32 smt_index = 0;
+        array_iter (cpu, &cpus, *) if (cpu->core == core) smt_index++;
+
+        max_package = max(max_package, package);
+        array_push_lit(&cpus, .id=id, .core=core, .package=package, .smt_index=smt_index);
+    }
+
+    ArrayU32 nodes;
+    array_init(&nodes, tm);
+    parse_cpu_list(read_sys_file(tm, SYS_NODE_DIR "/online", 0, 0), &nodes);
+
+    array_iter (node, &nodes) {
+        ArrayU32 node_cpus;
+        array_init(&node_cpus, tm);
+        parse_cpu_list(read_sys_file(tm, SYS_NODE_DIR "/node%lu/cpulist", node, 0), &node_cpus);
+        array_iter (id, &node_cpus) array_iter (cpu, &cpus, *) if (cpu->id == id) cpu->node = node;
+    }
+
+    ArrayOsCache caches;
+    array_init(&caches, mem);
+    if (cpus.count) read_caches(array_get(&cpus, 0).id, &caches);
+
+    topo->cpus          = cpus.as_slice;
+    topo->caches        = caches.as_slice;
+    topo->core_count    = core_keys.count;
+    topo->package_count = max_package + 1;
+    topo->node_count    = max(nodes.count, 1u);
+    return topo;
+}
+
+OsTopology *os_get_topology () {
+    OsTopology *topo = atomic_load_acquire(&topology);
+    if (topo) return topo;
+
+    mutex_scoped_lock(&topology_mutex);
+    if (! topology) atomic_store_release(&topology, read_topology(mem_root));
+    return topology;
+}
+
+U64 os_get_cache_size (U32 level) {
+    OsTopology *topo = os_get_topology();
+    array_iter (cache, &topo->caches, *) {
+        if (cache->level == level && cache->type != OS_CACHE_INSTRUCTION) return cache->size;
+    }
+    return 0;
+}
@@ -1,6 +1,14 @@
 #include <errno.h>
+#include <sched.h>
 #include <pthread.h>
 #include <semaphore.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#if !ARCH_X86_64
+    #include <ucontext.h>
+#endif
 #include "os/threads.h"
 #include "base/log.h"
 #include "base/mem.h"
@@ -19,15 +27,27 @@ static Void *thread_entry (Void *arg) {
     tmem_setup(mem_root, 1*MB);
     log_setup(mem_root, 4*KB);
     thread->base.fn(thread->base.fn_arg);
+    log_teardown();
+    log_sink_detach();
+    tmem_teardown();
     return 0;
 }
 
+// A new pthread inherits the affinity of its creator, so a thread
+// created by a pinned thread would share its core. New threads
+// start with the process affinity instead.
 OsThread *os_thread_new (Mem *mem, OsThreadFn fn, Void *fn_arg) {
     Auto thread = mem_new(mem, LinuxThread);
     thread->base.fn = fn;
     thread->base.fn_arg = fn_arg;
-    Int r = pthread_create(&thread->handle, 0, thread_entry, thread);
-    if (r == -1) {
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if (process_affinity_valid) pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &process_affinity);
+    Int r = pthread_create(&thread->handle, &attr, thread_entry, thread);
+    pthread_attr_destroy(&attr);
+
+    if (r != 0) {
         mem_free(mem, .old_ptr=thread, .old_size=sizeof(LinuxThread));
         return 0;
     }
@@ -51,6 +71,165 @@ Void os_thread_detach (OsThread *thread) {
     assert_always(r == 0);
 }
 
+Void os_thread_yield () {
+    sched_yield();
+}
+
+Bool os_thread_pin (OsThread *thread, U32 cpu) {
+    Auto t = cast(LinuxThread*, thread);
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(t->handle, sizeof(set), &set) == 0;
+}
+
+Bool os_thread_pin_self (U32 cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+U32 os_thread_get_cpu () {
+    Int cpu = sched_getcpu();
+    return (cpu < 0) ? 0 : cpu;
+}
+
+// =============================================================================
+// Fibers:
+// =============================================================================
+istruct (LinuxFiber) {
+    OsFiber base;
+    U8 *stack; // Includes the guard page. Zero for thread fibers.
+    U64 stack_total_size;
+    #if ARCH_X86_64
+        Void *sp;
+    #else
+        ucontext_t ctx;
+    #endif
+};
+
+static Void fiber_entry (LinuxFiber *fiber) {
+    fiber->base.fn(fiber->base.fn_arg);
+    badpath; // Fibers must not return.
+}
+
+#if ARCH_X86_64
+    // Void linux_fiber_switch (Void **from_sp, Void *to_sp);
+    //
+    // Pushes the callee saved registers and the sse/x87 control
+    // words onto the current stack, swaps the stack pointers and
+    // pops everything back off the new stack. A fresh fiber stack
+    // is prepared so that the final ret lands in linux_fiber_start
+    // with the LinuxFiber in r12 and fiber_entry in r13.
+    __asm__(
+        ".text\n"
+        ".globl linux_fiber_switch\n"
+        ".hidden linux_fiber_switch\n"
+        ".type linux_fiber_switch, @function\n"
+        ".p2align 4\n"
+        "linux_fiber_switch:\n"
+        "    pushq %rbp\n"
+        "    pushq %rbx\n"
+        "    pushq %r12\n"
+        "    pushq %r13\n"
+        "    pushq %r14\n"
+        "    pushq %r15\n"
+        "    subq $8, %rsp\n"
+        "    stmxcsr (%rsp)\n"
+        "    fnstcw 4(%rsp)\n"
+        "    movq %rsp, (%rdi)\n"
+        "    movq %rsi, %rsp\n"
+        "    ldmxcsr (%rsp)\n"
+        "    fldcw 4(%rsp)\n"
+        "    addq $8, %rsp\n"
+        "    popq %r15\n"
+        "    popq %r14\n"
+        "    popq %r13\n"
+        "    popq %r12\n"
+        "    popq %rbx\n"
+        "    popq %rbp\n"
+        "    ret\n"
+        ".size linux_fiber_switch, .-linux_fiber_switch\n"
+        ".globl linux_fiber_start\n"
+        ".hidden linux_fiber_start\n"
+        ".type linux_fiber_start, @function\n"
+        ".p2align 4\n"
+        "linux_fiber_start:\n"
+        "    movq %r12, %rdi\n"
+        "    callq *%r13\n"
+        "    ud2\n"
+        ".size linux_fiber_start, .-linux_fiber_start\n"
+    );
+
+    Void linux_fiber_switch (Void **from_sp, Void *to_sp);
+    Void linux_fiber_start ();
+
+    static Void fiber_init_context (LinuxFiber *fiber) {
+        // The stack top is page aligned. The ret address slot
+        // must be 8 mod 16 so that the stack is 16 aligned at
+        // the call in linux_fiber_start.
+        U64 *sp = cast(U64*, fiber->stack + fiber->stack_total_size) - 8;
+        sp[0] = 0x1F80 | (cast(U64, 0x037F) << 32); // Default mxcsr and x87 control word.
+        sp[1] = 0; // r15
+        sp[2] = 0; // r14
+        sp[3] = cast(U64, fiber_entry); // r13
+        sp[4] = cast(U64, fiber); // r12
+        sp[5] = 0; // rbx
+        sp[6] = 0; // rbp
+        sp[7] = cast(U64, linux_fiber_start);
+        fiber->sp = sp;
+    }
+#else
+    static Void fiber_entry_uc (U32 hi, U32 lo) {
+        fiber_entry(cast(LinuxFiber*, (cast(U64, hi) << 32) | lo));
+    }
+
+    static Void fiber_init_context (LinuxFiber *fiber) {
+        U64 page = sysconf(_SC_PAGESIZE);
+        U64 ptr  = cast(U64, fiber);
+        getcontext(&fiber->ctx);
+        fiber->ctx.uc_stack.ss_sp   = fiber->stack + page;
+        fiber->ctx.uc_stack.ss_size = fiber->stack_total_size - page;
+        fiber->ctx.uc_link          = 0;
+        makecontext(&fiber->ctx, cast(Void (*)(), fiber_entry_uc), 2, cast(U32, ptr >> 32), cast(U32, ptr));
+    }
+#endif
+
+OsFiber *os_fiber_new (Mem *mem, U64 stack_size, OsFiberFn fn, Void *fn_arg) {
+    U64 page  = sysconf(_SC_PAGESIZE);
+    U64 total = page + stack_size + padding_to_align(stack_size, page);
+    U8 *stack = mmap(0, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (stack == MAP_FAILED) return 0;
+    mprotect(stack, page, PROT_NONE); // Guard page.
+
+    Auto fiber = mem_new(mem, LinuxFiber);
+    fiber->base.fn = fn;
+    fiber->base.fn_arg = fn_arg;
+    fiber->stack = stack;
+    fiber->stack_total_size = total;
+    fiber_init_context(fiber);
+    return cast(OsFiber*, fiber);
+}
+
+OsFiber *os_fiber_from_thread (Mem *mem) {
+    return cast(OsFiber*, mem_new(mem, LinuxFiber));
+}
+
+Void os_fiber_destroy (OsFiber *fiber, Mem *mem) {
+    Auto f = cast(LinuxFiber*, fiber);
+    if (f->stack) munmap(f->stack, f->stack_total_size);
+    mem_free(mem, .old_ptr=f, .old_size=sizeof(LinuxFiber));
+}
+
+Void os_fiber_switch (OsFiber *from, OsFiber *to) {
+    #if ARCH_X86_64
+        linux_fiber_switch(&cast(LinuxFiber*, from)->sp, cast(LinuxFiber*, to)->sp);
+    #else
+        swapcontext(&cast(LinuxFiber*, from)->ctx, &cast(LinuxFiber*, to)->ctx);
+    #endif
+}
+
 // =============================================================================
 // Mutex:
 // =============================================================================
@@ -67,9 +246,9 @@ OsMutex *os_mutex_new (Mem *mem) {
 }
 
 Void os_mutex_destroy (OsMutex *mutex, Mem *mem) {
-    Auto m = cast(LinuxMutex*, mutex);
-    pthread_mutex_destroy(&m->handle);
-    mem_free(mem, .old_ptr=m, .old_size=sizeof(LinuxMutex));
+    Auto lm = cast(LinuxMutex*, mutex); // Not named m since mem_free() defines an m.
+    pthread_mutex_destroy(&lm->handle);
+    mem_free(mem, .old_ptr=lm, .old_size=sizeof(LinuxMutex));
 }
 
 Void os_mutex_lock (OsMutex *mutex) {
@@ -201,3 +380,18 @@ Void os_semaphore_post (OsSemaphore *sem) {
         badpath;
     }
 }
+
+// =============================================================================
+// Futex:
+// =============================================================================
+Void os_futex_wait (U32 *addr, U32 expected) {
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, expected, 0, 0, 0);
+}
+
+Void os_futex_wake_one (U32 *addr) {
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, 1, 0, 0, 0);
+}
+
+Void os_futex_wake_all (U32 *addr) {
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT32_MAX, 0, 0, 0);
+}
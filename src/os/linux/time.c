@@ -11,3 +11,9 @@ U64 os_time_ms () {
     clock_gettime(CLOCK_MONOTONIC, &ts);
     return cast(U64, (ts.tv_sec * 1000) + (ts.tv_nsec / 1'000'000));
 }
+
+U64 os_time_ns () {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return cast(U64, (ts.tv_sec * 1'000'000'000) + ts.tv_nsec);
+}
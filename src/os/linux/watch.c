@@ -0,0 +1,173 @@
+#include <poll.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include "os/watch.h"
+#include "os/time.h"
+#include "os/threads.h"
+#include "base/spsc.h"
+#include "base/sync.h"
+
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO | IN_CREATE | IN_ATTRIB)
+
+istruct (WatchFile) {
+    Int wd; // Of the parent directory.
+    String path;
+    String name;
+    U64 tag;
+    U64 deadline; // 0 if there is no pending change.
+};
+
+array_typedef(WatchFile, WatchFile);
+
+istruct (FsWatch) {
+    Mem *mem;
+    OsThread *thread;
+    Int inotify_fd;
+    Int stop_fd;
+    U64 debounce_ms;
+    Mutex lock; // For the files.
+    ArrayWatchFile files;
+    Spsc(FsWatchEvent) events;
+};
+
+static Void touch_file (FsWatch *w, WatchFile *file, U64 now) {
+    file->deadline = now + w->debounce_ms;
+}
+
+// Reads until the queue is drained. A change restarts the quiet
+// period of the file, so a burst of events becomes one event.
+static Void read_events (FsWatch *w) {
+    alignas(struct inotify_event) Char buf[4096];
+    U64 now = os_time_ms();
+
+    while (true) {
+        I64 n = read(w->inotify_fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+
+        mutex_scoped_lock(&w->lock);
+
+        for (Char *p = buf; p < buf + n;) {
+            Auto e = cast(struct inotify_event*, p);
+            p += sizeof(struct inotify_event) + e->len;
+
+            if (e->mask & IN_Q_OVERFLOW) {
+                array_iter (file, &w->files, *) touch_file(w, file, now);
+            } else if (e->len) {
+                String name = str(e->name);
+                array_iter (file, &w->files, *) {
+                    if (file->wd == e->wd && str_match(file->name, name)) touch_file(w, file, now);
+                }
+            }
+        }
+    }
+}
+
+// Posts the files that have been quiet long enough. Returns the
+// poll timeout until the next pending file is due or -1.
+static Int post_events (FsWatch *w) {
+    mutex_scoped_lock(&w->lock);
+
+    U64 now     = os_time_ms();
+    Int timeout = -1;
+
+    array_iter (file, &w->files, *) {
+        if (! file->deadline) continue;
+
+        if (file->deadline <= now && spsc_push(&w->events, ((FsWatchEvent){ .path=file->path, .tag=file->tag }))) {
+            file->deadline = 0;
+        } else {
+            U64 wait = (file->deadline > now) ? (file->deadline - now) : w->debounce_ms; // The channel is full.
+            if (timeout < 0 || wait < cast(U64, timeout)) timeout = wait;
+        }
+    }
+
+    return timeout;
+}
+
+static Void watch_run (Void *arg) {
+    FsWatch *w  = arg;
+    Int timeout = -1;
+
+    while (true) {
+        struct pollfd fds[] = {
+            { .fd=w->inotify_fd, .events=POLLIN },
+            { .fd=w->stop_fd, .events=POLLIN },
+        };
+
+        Int r = poll(fds, 2, timeout);
+        if (r < 0 && errno != EINTR) break;
+        if (fds[1].revents) break;
+        if (fds[0].revents & POLLIN) read_events(w);
+
+        timeout = post_events(w);
+    }
+}
+
+FsWatch *fs_watch_new (Mem *mem, U32 debounce_ms) {
+    Int inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd < 0) return 0;
+
+    Int stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (stop_fd < 0) { close(inotify_fd); return 0; }
+
+    Auto w         = mem_new(mem, FsWatch);
+    w->mem         = mem;
+    w->inotify_fd  = inotify_fd;
+    w->stop_fd     = stop_fd;
+    w->debounce_ms = debounce_ms;
+    array_init(&w->files, mem);
+    spsc_init(&w->events, mem, 64);
+
+    w->thread = os_thread_new(mem, watch_run, w);
+    assert_always(w->thread);
+    return w;
+}
+
+Void fs_watch_destroy (FsWatch *w) {
+    U64 one = 1;
+    while (write(w->stop_fd, &one, sizeof(one)) < 0 && errno == EINTR);
+    os_thread_join(w->thread);
+    os_thread_destroy(w->thread, w->mem);
+
+    close(w->inotify_fd);
+    close(w->stop_fd);
+
+    array_iter (file, &w->files, *) mem_free(w->mem, .old_ptr=file->path.data, .old_size=file->path.count);
+    array_free(&w->files);
+    spsc_destroy(&w->events);
+    mem_free(w->mem, .old_ptr=w, .old_size=sizeof(FsWatch));
+}
+
+// Watching the same directory twice yields the same descriptor,
+// so files in one directory share a watch.
+Bool fs_watch_add (FsWatch *w, String path, U64 tag) {
+    tmem_new(tm);
+
+    String dir = str_prefix_to_last(path, '/');
+    String name;
+
+    if (dir.data) {
+        name = str_suffix_from_last(path, '/');
+        if (! dir.count) dir = str("/");
+    } else {
+        name = path;
+        dir  = str(".");
+    }
+
+    Int wd = inotify_add_watch(w->inotify_fd, cstr(tm, dir), WATCH_MASK);
+    if (wd < 0) return false;
+
+    WatchFile file = { .wd=wd, .tag=tag, .path=str_copy(w->mem, path) };
+    file.name = str_suffix_from(file.path, file.path.count - name.count);
+
+    mutex_scoped_lock(&w->lock);
+    array_push(&w->files, file);
+    return true;
+}
+
+Bool fs_watch_poll (FsWatch *w, FsWatchEvent *out) {
+    return spsc_pop(&w->events, out);
+}
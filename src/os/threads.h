@@ -5,6 +5,11 @@
 
 // =============================================================================
 // Threads:
+//
+// The pin functions restrict a thread to run only on the given
+// logical cpu (see os_get_topology). They return false if the
+// cpu doesn't exist or the affinity can't be changed. A pin is
+// not inherited: threads from os_thread_new start unpinned.
 // =============================================================================
 typedef Void (*OsThreadFn)(Void *);
 
@@ -13,10 +18,41 @@ istruct (OsThread) {
     Void *fn_arg;
 };
 
-OsThread *os_thread_new     (Mem *, OsThreadFn, Void *fn_arg);
-Void      os_thread_destroy (OsThread *, Mem *);
-Bool      os_thread_join    (OsThread *);
-Void      os_thread_detach  (OsThread *);
+OsThread *os_thread_new      (Mem *, OsThreadFn, Void *fn_arg);
+Void      os_thread_destroy  (OsThread *, Mem *);
+Bool      os_thread_join     (OsThread *);
+Void      os_thread_detach   (OsThread *);
+Void      os_thread_yield    ();
+Bool      os_thread_pin      (OsThread *, U32 cpu);
+Bool      os_thread_pin_self (U32 cpu);
+U32       os_thread_get_cpu  ();
+
+// =============================================================================
+// Fibers:
+//
+// Stackful coroutines with explicit switching. Stacks come
+// with a guard page at the low end so an overflow crashes
+// instead of silently corrupting memory.
+//
+// The os_fiber_from_thread function wraps the stack of the
+// calling thread so that there is something to switch back
+// to. The fn of a fiber must never return; it should switch
+// to another fiber at the end instead.
+//
+// Only callee saved registers are preserved, so switch only
+// through os_fiber_switch (it's a regular function call).
+// =============================================================================
+typedef Void (*OsFiberFn)(Void *);
+
+istruct (OsFiber) {
+    OsFiberFn fn;
+    Void *fn_arg;
+};
+
+OsFiber *os_fiber_new         (Mem *, U64 stack_size, OsFiberFn, Void *fn_arg);
+OsFiber *os_fiber_from_thread (Mem *);
+Void     os_fiber_destroy     (OsFiber *, Mem *);
+Void     os_fiber_switch      (OsFiber *from, OsFiber *to);
 
 // =============================================================================
 // Mutex:
@@ -63,3 +99,14 @@ OsSemaphore *os_semaphore_new     (Mem *, U32);
 Void         os_semaphore_destroy (OsSemaphore *, Mem *);
 Void         os_semaphore_wait    (OsSemaphore *);
 Void         os_semaphore_post    (OsSemaphore *);
+
+// =============================================================================
+// Futex:
+//
+// The wait function puts the caller to sleep if *addr still
+// equals the expected value. It can return spuriously, so it
+// should be called in a loop that rechecks the condition.
+// =============================================================================
+Void os_futex_wait     (U32 *addr, U32 expected);
+Void os_futex_wake_one (U32 *addr);
+Void os_futex_wake_all (U32 *addr);
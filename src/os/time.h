@@ -3,4 +3,5 @@
 #include "base/core.h"
 
 U64  os_time_ms  ();
+U64  os_time_ns  ();
 Void os_sleep_ms (U64 msec);
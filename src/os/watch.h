@@ -0,0 +1,55 @@
+#pragma once
+
+// =============================================================================
+// Overview:
+// ---------
+//
+// Watches files for changes and reports them as events that the
+// owner thread (usually the ui thread) polls once per frame.
+//
+// The events are read on a background thread. On linux that's
+// inotify, with the watches placed on the parent directories of
+// the files rather than on the files themselves. That way a file
+// that an editor saves by writing a temporary file and renaming
+// it over the original (a new inode) is still tracked.
+//
+// A single save usually produces a burst of kernel events (a few
+// modify events, a close, a rename). They are coalesced: a file
+// is reported once it has been quiet for the debounce interval,
+// so the owner sees one event per save and never a half written
+// file.
+//
+// The events are handed over through a single producer, single
+// consumer channel, so only one thread may call fs_watch_poll.
+// Files can be added from any thread.
+//
+// Usage example:
+// --------------
+//
+//     FsWatch *watch = fs_watch_new(mem_root, 50);
+//     fs_watch_add(watch, str("src/ui/rect_fs.glsl"), RECT_FS);
+//
+//     // Each frame:
+//     FsWatchEvent event;
+//     while (fs_watch_poll(watch, &event)) reload(event.tag, event.path);
+//
+//     fs_watch_destroy(watch);
+//
+// =============================================================================
+#include "base/core.h"
+#include "base/mem.h"
+#include "base/string.h"
+
+istruct (FsWatch);
+
+istruct (FsWatchEvent) {
+    String path; // As given to fs_watch_add(). Valid until fs_watch_destroy().
+    U64 tag;     // As given to fs_watch_add().
+};
+
+// The Mem must be thread safe if files are added from other
+// threads. Returns 0 if the os doesn't support watching.
+FsWatch *fs_watch_new     (Mem *, U32 debounce_ms);
+Void     fs_watch_destroy (FsWatch *);
+Bool     fs_watch_add     (FsWatch *, String path, U64 tag); // Returns false if the directory can't be watched.
+Bool     fs_watch_poll    (FsWatch *, FsWatchEvent *out); // Returns false if there are no events.
@@ -40,73 +40,21 @@ static GlyphId info_to_id (GlyphInfo *info) {
     return cast(U64, info->glyph_index) | (cast(U64, info->font_slot) << 32);
 }
 
-static GlyphSlot **cache_get_slot (GlyphCache *cache, GlyphId id) {
-    return &cache->map[hash_u64(id) % cache->atlas_size];
-}
-
-static GlyphSlot *cache_get (GlyphCache *cache, GlyphId id) {
-    GlyphSlot *s = *cache_get_slot(cache, id);
-    while (s && (s->id != id)) s = s->map_next;
-    return s;
-}
-
-static Void cache_add (GlyphCache *cache, GlyphSlot *slot) {
-    GlyphSlot **s = cache_get_slot(cache, slot->id);
-    slot->map_next = *s;
-    *s = slot;
-}
-
-static Void cache_remove (GlyphCache *cache, GlyphSlot *slot) {
-    GlyphSlot **s = cache_get_slot(cache, slot->id);
-    while (*s != slot) s = &(*s)->map_next;
-    *s = slot->map_next;
-}
-
 GlyphSlot *glyph_cache_get (GlyphCache *cache, GlyphInfo *info) {
-    GlyphId id = info_to_id(info);
-    GlyphSlot *slot = cache_get(cache, id);
-
-    Bool atlas_update_needed = true;
-
-    // Remove from lru chain.
-    if (slot) {
-        slot->lru_next->lru_prev = slot->lru_prev;
-        slot->lru_prev->lru_next = slot->lru_next;
-        atlas_update_needed = false;
-    }
-
-    // See if we have a free slot.
-    if (!slot && cache->sentinel.map_next) {
-        slot = cache->sentinel.map_next;
-        cache->sentinel.map_next = slot->map_next;
-        slot->id = id;
-        slot->font_slot = info->font_slot;
+    Bool found;
+    GlyphSlot *slot = lru_add(&cache->slots, info_to_id(info), 0, &found);
+
+    if (! found) {
+        U32 idx           = lru_idx(&cache->slots, slot);
+        slot->x           = (idx % cache->atlas_size) * cache->atlas_slot_size;
+        slot->y           = (idx / cache->atlas_size) * cache->atlas_slot_size;
+        slot->font_slot   = info->font_slot;
         slot->glyph_index = info->glyph_index;
-        cache_add(cache, slot);
-    }
-
-    // Evict the lru slot.
-    if (! slot) {
-        assert_dbg(cache->sentinel.lru_prev != &cache->sentinel);
-        slot = cache->sentinel.lru_prev;
-        cache_remove(cache, slot);
-        slot->id = id;
-        slot->font_slot = info->font_slot;
-        slot->glyph_index = info->glyph_index;
-        cache_add(cache, slot);
-    }
 
-    // Mark as mru slot
-    slot->lru_next = cache->sentinel.lru_next;
-    slot->lru_prev = &cache->sentinel;
-    cache->sentinel.lru_next->lru_prev = slot;
-    cache->sentinel.lru_next = slot;
-
-    if (atlas_update_needed) {
         Font *font = array_ref(&cache->font_slots, slot->font_slot);
 
         if (FT_Load_Glyph(font->ft_face, slot->glyph_index, FT_LOAD_RENDER | (FT_HAS_COLOR(font->ft_face) ? FT_LOAD_COLOR : 0))) {
-            log_msg_fmt(LOG_ERROR, LOG_HEADER, 0, "Couldn't load/render font glyph.");
+            log_msg_fmt_limited(LOG_ERROR, LOG_HEADER, 0, "Couldn't load/render font glyph.");
             goto done;
         }
 
@@ -122,7 +70,7 @@ GlyphSlot *glyph_cache_get (GlyphCache *cache, GlyphInfo *info) {
         slot->pixel_mode = ft_bitmap.pixel_mode;
 
         if ((w > cache->atlas_slot_size) || (h > cache->atlas_slot_size)) {
-            log_msg_fmt(LOG_ERROR, LOG_HEADER, 0, "Font glyph too big to fit into atlas slot.");
+            log_msg_fmt_limited(LOG_ERROR, LOG_HEADER, 0, "Font glyph too big to fit into atlas slot.");
             goto done;
         }
 
@@ -173,13 +121,59 @@ GlyphSlot *glyph_cache_get (GlyphCache *cache, GlyphInfo *info) {
     return slot;
 }
 
-static Void font_init (GlyphCache *cache, Font *font, String font_binary) {
+static CString font_paths[FONT_COUNT] = {
+    [FONT_LATIN]    = "data/fonts/NotoSans-Regular.ttf",
+    [FONT_ARABIC]   = "data/fonts/NotoSansArabic-Regular.ttf",
+    [FONT_JAPANESE] = "data/fonts/NotoSansJP-Regular.ttf",
+    [FONT_EMOJI]    = "data/fonts/NotoColorEmoji-COLRv1.ttf",
+};
+
+// Pulls the font files into the page cache in the background so
+// that glyph_cache_new() doesn't wait on the disk. It can be called
+// before there is a GL context. The ops must stay alive until the
+// group is done. Fonts that are in the pack are skipped.
+Void glyph_cache_prefetch (Aio *aio, AioOp ops[FONT_COUNT], TPoolGroup *group, Pack *pack) {
+    for (U32 i = 0; i < FONT_COUNT; ++i) {
+        String path = str(font_paths[i]);
+        if (pack && pack_get(pack, path).data) continue;
+        ops[i] = (AioOp){ .tag=AIO_PREFETCH, .path=path };
+        aio_submit(aio, &ops[i], group);
+    }
+}
+
+// The font file is mapped rather than read since FreeType only
+// needs read-only bytes and touches a small part of big fonts.
+// Fonts needed right away can be prefetched in the background.
+// If the font is in the asset pack, it's used from there.
+// On error this logs, leaves the font zeroed and returns false.
+static Bool font_init (GlyphCache *cache, Font *font, String path, FsMapFlags map_flags, Pack *pack) {
+    *font      = (Font){};
+    font->file = pack ? pack_get(pack, path) : (String){};
+
+    if (! font->file.data) {
+        font->file   = fs_map_file(path, FS_ACCESS_RANDOM, map_flags);
+        font->mapped = true;
+    }
+
+    if (! font->file.data) {
+        log_msg_fmt(LOG_ERROR, LOG_HEADER, 0, "Couldn't read font file [%.*s].", STR(path));
+        *font = (Font){};
+        return false;
+    }
+
     FT_Open_Args args = {
         .flags       = FT_OPEN_MEMORY,
-        .memory_base = cast(U8*, font_binary.data),
-        .memory_size = font_binary.count,
+        .memory_base = cast(U8*, font->file.data),
+        .memory_size = font->file.count,
     };
-    if (FT_Open_Face(cache->ft_lib, &args, 0, &font->ft_face)) log_msg_fmt(LOG_ERROR, LOG_HEADER, 0, "Couldn't open freetype face.");
+
+    if (FT_Open_Face(cache->ft_lib, &args, 0, &font->ft_face)) {
+        log_msg_fmt(LOG_ERROR, LOG_HEADER, 0, "Couldn't open freetype face [%.*s].", STR(path));
+        if (font->mapped) fs_unmap_file(font->file);
+        *font = (Font){};
+        return false;
+    }
+
     FT_Set_Pixel_Sizes(font->ft_face, cache->font_size * cache->dpr, cache->font_size * cache->dpr);
 
     font->hb_face = hb_ft_face_create_referenced(font->ft_face);
@@ -187,39 +181,25 @@ static Void font_init (GlyphCache *cache, Font *font, String font_binary) {
 
     I32 hb_font_size = cache->font_size * cache->dpr * 64;
     hb_font_set_scale(font->hb_font, hb_font_size, hb_font_size);
+    return true;
 }
 
-GlyphCache *glyph_cache_new (Mem *mem, U16 atlas_size, U32 font_size) {
+GlyphCache *glyph_cache_new (Mem *mem, U16 atlas_size, U32 font_size, Pack *pack) {
     Auto cache = mem_new(mem, GlyphCache);
     cache->mem = mem;
     cache->dpr = 1;
     cache->font_size = font_size;
     cache->atlas_size = atlas_size;
     cache->atlas_slot_size = cache->font_size * cache->dpr * 2;
-    cache->slots = mem_alloc(mem, GlyphSlot, .size=(atlas_size * atlas_size * sizeof(GlyphSlot)));
-    cache->map = mem_alloc(mem, GlyphSlot*, .zeroed=true, .size=(atlas_size * sizeof(GlyphSlot*)));
-    cache->sentinel.lru_next = &cache->sentinel;
-    cache->sentinel.lru_prev = &cache->sentinel;
-
-    U32 x = 0;
-    U32 y = 0;
-    for (U32 i = 0; i < cast(U32, atlas_size) * atlas_size; ++i) {
-        GlyphSlot *slot = &cache->slots[i];
-        slot->x = x*cache->atlas_slot_size;
-        slot->y = y*cache->atlas_slot_size;
-        slot->map_next = cache->sentinel.map_next;
-        cache->sentinel.map_next = slot;
-        x++;
-        if (x == atlas_size) { x = 0; y++; }
-    }
+    lru_init(&cache->slots, mem, cast(U32, atlas_size) * atlas_size);
 
     if (FT_Init_FreeType(&cache->ft_lib)) log_msg_fmt(LOG_ERROR, LOG_HEADER, 0, "Couldn't init freetype.");
     array_init(&cache->font_slots, mem);
     array_ensure_count(&cache->font_slots, FONT_COUNT, false);
-    font_init(cache, array_ref(&cache->font_slots, FONT_LATIN), fs_read_entire_file(mem, str("./data/fonts/NotoSans-Regular.ttf"), 0));
-    font_init(cache, array_ref(&cache->font_slots, FONT_ARABIC), fs_read_entire_file(mem, str("./data/fonts/NotoSansArabic-Regular.ttf"), 0));
-    font_init(cache, array_ref(&cache->font_slots, FONT_JAPANESE), fs_read_entire_file(mem, str("./data/fonts/NotoSansJP-Regular.ttf"), 0));
-    font_init(cache, array_ref(&cache->font_slots, FONT_EMOJI), fs_read_entire_file(mem, str("./data/fonts/NotoColorEmoji-COLRv1.ttf"), 0));
+    font_init(cache, array_ref(&cache->font_slots, FONT_LATIN), str(font_paths[FONT_LATIN]), FS_MAP_PREFETCH, pack);
+    font_init(cache, array_ref(&cache->font_slots, FONT_ARABIC), str(font_paths[FONT_ARABIC]), 0, pack);
+    font_init(cache, array_ref(&cache->font_slots, FONT_JAPANESE), str(font_paths[FONT_JAPANESE]), 0, pack);
+    font_init(cache, array_ref(&cache->font_slots, FONT_EMOJI), str(font_paths[FONT_EMOJI]), 0, pack);
 
     Auto hooks = plutosvg_ft_svg_hooks();
     if (FT_Property_Set(cache->ft_lib, "ot-svg", "svg-hooks", hooks)) log_msg_fmt(LOG_ERROR, LOG_HEADER, 0, "Couldn't set pluto svg hooks.");
@@ -235,13 +215,56 @@ GlyphCache *glyph_cache_new (Mem *mem, U16 atlas_size, U32 font_size) {
     return cache;
 }
 
+// The hb face holds its own reference to the FT face, so it has
+// to go before FT_Done_Face can free the face, and the face has
+// to go before the file it reads from is unmapped.
+static Void font_close (Font *font) {
+    if (! font->ft_face) return;
+    hb_font_destroy(font->hb_font);
+    hb_face_destroy(font->hb_face);
+    if (FT_Done_Face(font->ft_face)) log_msg_fmt(LOG_ERROR, LOG_HEADER, 0, "Couldn't free freetype face.");
+    if (font->mapped) fs_unmap_file(font->file);
+    *font = (Font){};
+}
+
 Void glyph_cache_destroy (GlyphCache *cache) {
+    lru_destroy(&cache->slots);
+    array_iter (font, &cache->font_slots, *) font_close(font);
+
     if (FT_Done_FreeType(cache->ft_lib)) log_msg_fmt(LOG_ERROR, LOG_HEADER, 0, "Couldn't free freetype face.");
+}
+
+// The entry starts with the key (see info_to_id).
+static Bool glyph_in_font (ULruEntry *entry, Void *ctx) {
+    GlyphId id = *cast(GlyphId*, entry);
+    return (id >> 32) == *cast(FontSlot*, ctx);
+}
 
-    array_iter (font, &cache->font_slots, *) {
-        if (FT_Done_Face(font->ft_face)) log_msg_fmt(LOG_ERROR, LOG_HEADER, 0, "Couldn't free freetype face.");
-        hb_font_destroy(font->hb_font);
+// Reopens the font from its file (never from the pack, since the
+// point is to pick up an edited file) and drops only the glyphs
+// of this font from the atlas. They get rendered again with the
+// new face when next used; the glyphs of other fonts stay warm.
+//
+// The new face is opened before the old one is closed, so if the
+// file is half written or gone the old face stays in use.
+Void glyph_cache_reload_font (GlyphCache *cache, FontSlot slot) {
+    Font new_font;
+
+    if (! font_init(cache, &new_font, str(font_paths[slot]), 0, 0)) {
+        log_msg_fmt(LOG_WARNING, LOG_HEADER, 0, "Keeping the old version of font [%s].", font_paths[slot]);
+        return;
     }
+
+    Font *font = array_ref(&cache->font_slots, slot);
+    font_close(font);
+    *font = new_font;
+
+    U32 count = lru_remove_if(&cache->slots, glyph_in_font, &slot);
+    log_msg_fmt(LOG_NOTE, LOG_HEADER, 0, "Reloaded font [%s]; dropped %u glyphs.", font_paths[slot], count);
+}
+
+CString glyph_cache_font_path (FontSlot slot) {
+    return font_paths[slot];
 }
 
 static hb_direction_t script_to_direction (hb_script_t script) {
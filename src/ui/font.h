@@ -2,6 +2,9 @@
 #include <hb-ft.h>
 #include "base/core.h"
 #include "base/map.h"
+#include "base/lru.h"
+#include "os/aio.h"
+#include "base/pack.h"
 
 ienum (FontSlot, U8) {
     FONT_LATIN,
@@ -34,15 +37,11 @@ istruct (GlyphSlot) {
     FT_Pixel_Mode pixel_mode;
     FontSlot font_slot;
     U32 glyph_index;
-
-    // Private:
-    GlyphId id;
-    GlyphSlot *lru_next;
-    GlyphSlot *lru_prev;
-    GlyphSlot *map_next;
 };
 
 istruct (Font) {
+    String file; // Mapped with fs_map_file() or a view into a Pack.
+    Bool mapped;
     FT_Face ft_face;
     hb_face_t *hb_face;
     hb_font_t *hb_font;
@@ -57,15 +56,16 @@ istruct (GlyphCache) {
     U32 dpr; // Device pixel ratio.
     Array(Font) font_slots;
     FT_Library ft_lib;
-    GlyphSlot **map;
-    GlyphSlot *slots;
-    GlyphSlot sentinel;
+    Lru(GlyphId, GlyphSlot) slots; // The entry idx maps to the atlas cell.
 };
 
 array_typedef(Font, Font);
 array_typedef(GlyphInfo, GlyphInfo);
 
-GlyphCache    *glyph_cache_new     (Mem *, U16 atlas_size, U32 font_size);
-Void           glyph_cache_destroy (GlyphCache *);
-GlyphSlot     *glyph_cache_get     (GlyphCache *, GlyphInfo *);
-SliceGlyphInfo get_glyph_infos     (GlyphCache *, Mem *, String);
+GlyphCache    *glyph_cache_new         (Mem *, U16 atlas_size, U32 font_size, Pack *);
+Void           glyph_cache_destroy     (GlyphCache *);
+Void           glyph_cache_prefetch    (Aio *, AioOp ops[FONT_COUNT], TPoolGroup *, Pack *);
+Void           glyph_cache_reload_font (GlyphCache *, FontSlot);
+CString        glyph_cache_font_path   (FontSlot);
+GlyphSlot     *glyph_cache_get         (GlyphCache *, GlyphInfo *);
+SliceGlyphInfo get_glyph_infos         (GlyphCache *, Mem *, String);
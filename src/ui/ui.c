@@ -7,12 +7,26 @@
 #include "base/string.h"
 #include "os/time.h"
 #include "base/map.h"
+#include "base/taskgraph.h"
 #include "os/fs.h"
+#include "os/info.h"
+#include "os/threads.h"
+#include "os/aio.h"
+#include "os/watch.h"
+#include "base/pack.h"
 #include "ui/font.h"
 
+#define XXH_STATIC_LINKING_ONLY
+#include "vendor/xxhash/xxhash.h"
+#if ARCH_X86_64
+    #include "vendor/xxhash/xxh_x86dispatch.h"
+#endif
+
 istruct (Ui);
 static Void ui_init (Mem *, Mem *);
 static Void ui_frame (F32 dt);
+static TaskGraph *frame_graph_new ();
+static Void ui_reload_font (FontSlot);
 Ui *ui;
 
 // =============================================================================
@@ -115,6 +129,57 @@ F32 current_frame;
 U64 frame_count;
 F32 first_counted_frame;
 
+TPool *tpool;
+Aio *aio;
+Pack *pack; // Null if there's no asset pack.
+
+// Files needed during startup are taken from the asset pack. If
+// there isn't one, they are read in the background while the
+// window and the GL context are being created.
+ienum (StartupFile, U8) {
+    RECT_VS,
+    RECT_FS,
+    SCREEN_VS,
+    SCREEN_FS,
+    BLUR_VS,
+    BLUR_FS,
+    STARTUP_FILE_COUNT,
+};
+
+CString startup_paths[STARTUP_FILE_COUNT] = {
+    [RECT_VS]   = "src/ui/rect_vs.glsl",
+    [RECT_FS]   = "src/ui/rect_fs.glsl",
+    [SCREEN_VS] = "src/ui/screen_vs.glsl",
+    [SCREEN_FS] = "src/ui/screen_fs.glsl",
+    [BLUR_VS]   = "src/ui/blur_vs.glsl",
+    [BLUR_FS]   = "src/ui/blur_fs.glsl",
+};
+
+AioOp startup_files[STARTUP_FILE_COUNT];
+AioOp font_prefetches[FONT_COUNT];
+TPoolGroup startup_io;
+
+// The programs and the files they are built from, so that a
+// changed file only rebuilds the programs that use it.
+istruct (ShaderProgram) {
+    U32 *id;
+    StartupFile vshader_file;
+    StartupFile fshader_file;
+};
+
+#define SHADER_PROGRAM_COUNT 3
+ShaderProgram shader_programs[SHADER_PROGRAM_COUNT] = {
+    { &rect_shader,   RECT_VS,   RECT_FS },
+    { &screen_shader, SCREEN_VS, SCREEN_FS },
+    { &blur_shader,   BLUR_VS,   BLUR_FS },
+};
+
+// Asset files are watched so that edits show up without a restart.
+// The tag of a watched file is its StartupFile, or for fonts the
+// FontSlot offset by WATCH_FONT.
+#define WATCH_FONT STARTUP_FILE_COUNT
+FsWatch *watch;
+
 static U32 framebuffer_new (U32 *out_texture, Bool only_color_attach, U32 w, U32 h);
 
 static Void set_bool  (U32 p, CString name, Bool v) { glUniform1i(glGetUniformLocation(p, name), cast(Int, v)); }
@@ -255,15 +320,30 @@ static U32 framebuffer_new (U32 *out_texture, Bool only_color_attach, U32 w, U32
     return r;
 }
 
-static U32 shader_compile (GLenum type, String filepath) {
-    tmem_new(tm);
+// The source is the last read of the file (at startup or by a
+// reload), or else the pack entry. The startup_io group must be
+// done by now. Sources from the pack are not 0-terminated, hence
+// the explicit length.
+static String shader_source (StartupFile file) {
+    AioOp *op = &startup_files[file];
+    if (op->data.data) return op->data;
+    return pack ? pack_get(pack, str(startup_paths[file])) : (String){};
+}
+
+// Logs and returns 0 on error.
+static U32 shader_compile (GLenum type, StartupFile file) {
+    String filepath = str(startup_paths[file]);
+    String source   = shader_source(file);
 
-    String source = fs_read_entire_file(tm, filepath, 0);
-    if (! source.data) error_fmt("Unable to read file: %.*s\n", STR(filepath));
+    if (! source.data) {
+        log_msg_fmt(LOG_ERROR, "UI", 1, "Unable to read file: %.*s", STR(filepath));
+        return 0;
+    }
 
     U32 shader = glCreateShader(type);
+    Int length = source.count;
 
-    glShaderSource(shader, 1, cast(const GLchar**, &source.data), 0);
+    glShaderSource(shader, 1, cast(const GLchar**, &source.data), &length);
     glCompileShader(shader);
 
     Int success; glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
@@ -275,20 +355,30 @@ static U32 shader_compile (GLenum type, String filepath) {
         array_increase_count(msg, cast(U32, count), false);
         glGetShaderInfoLog(shader, count, 0, msg->data + offset);
         msg->count--; // Get rid of the NUL byte...
-        error();
+        glDeleteShader(shader);
+        return 0;
     }
 
     return shader;
 }
 
-static U32 shader_new (CString vshader_path, CString fshader_path) {
-    U32 id      = glCreateProgram();
-    U32 vshader = shader_compile(GL_VERTEX_SHADER, str(vshader_path));
-    U32 fshader = shader_compile(GL_FRAGMENT_SHADER, str(fshader_path));
+// Logs and returns 0 on error.
+static U32 shader_new (StartupFile vshader_file, StartupFile fshader_file) {
+    U32 vshader = shader_compile(GL_VERTEX_SHADER, vshader_file);
+    U32 fshader = shader_compile(GL_FRAGMENT_SHADER, fshader_file);
+
+    if (!vshader || !fshader) {
+        glDeleteShader(vshader);
+        glDeleteShader(fshader);
+        return 0;
+    }
 
+    U32 id = glCreateProgram();
     glAttachShader(id, vshader);
     glAttachShader(id, fshader);
     glLinkProgram(id);
+    glDeleteShader(vshader);
+    glDeleteShader(fshader);
 
     Int success; glGetProgramiv(id, GL_LINK_STATUS, &success);
     if (! success) {
@@ -299,15 +389,63 @@ static U32 shader_new (CString vshader_path, CString fshader_path) {
         array_increase_count(msg, cast(U32, count), false);
         glGetProgramInfoLog(id, count, 0, msg->data + offset);
         msg->count--; // Get rid of the NUL byte...
-        error();
+        glDeleteProgram(id);
+        return 0;
     }
 
-    glDeleteShader(vshader);
-    glDeleteShader(fshader);
-
     return id;
 }
 
+// Rereads the file and rebuilds only the programs that use it.
+// If the new source doesn't build, the old program stays in use
+// so that a typo doesn't take down the ui.
+static Void shader_reload (StartupFile file) {
+    String filepath = str(startup_paths[file]);
+    String source   = fs_read_entire_file(mem_root, filepath, 0);
+
+    if (! source.data) {
+        log_msg_fmt(LOG_ERROR, "UI", 1, "Unable to read file: %.*s", STR(filepath));
+        return;
+    }
+
+    AioOp *op = &startup_files[file];
+    if (op->data.data) mem_free(op->mem, .old_ptr=op->data.data, .old_size=(op->data.count + 1));
+    op->data = source;
+    op->mem  = mem_root;
+
+    for (U32 i = 0; i < SHADER_PROGRAM_COUNT; ++i) {
+        ShaderProgram *p = &shader_programs[i];
+        if (p->vshader_file != file && p->fshader_file != file) continue;
+
+        U32 id = shader_new(p->vshader_file, p->fshader_file);
+        if (! id) continue;
+
+        glDeleteProgram(*p->id);
+        *p->id = id;
+        log_msg_fmt(LOG_NOTE, "UI", 1, "Reloaded shader: %.*s", STR(filepath));
+    }
+}
+
+// Asset reloading is a convenience, so it's skipped if the
+// os can't watch files.
+static Void assets_watch_begin () {
+    watch = fs_watch_new(mem_root, 50);
+    if (! watch) return;
+    for (U32 i = 0; i < STARTUP_FILE_COUNT; ++i) fs_watch_add(watch, str(startup_paths[i]), i);
+    for (U32 i = 0; i < FONT_COUNT; ++i) fs_watch_add(watch, str(glyph_cache_font_path(i)), WATCH_FONT + i);
+}
+
+// Called once per frame on the ui thread.
+static Void assets_reload () {
+    if (! watch) return;
+
+    FsWatchEvent event;
+    while (fs_watch_poll(watch, &event)) {
+        if (event.tag < WATCH_FONT) shader_reload(event.tag);
+        else ui_reload_font(event.tag - WATCH_FONT);
+    }
+}
+
 static Void flush_vertices () {
     glBindVertexArray(VAO);
     glUseProgram(rect_shader);
@@ -393,7 +531,30 @@ static Void draw_rect_fn (RectAttributes *a) {
     draw_rect_vertex(&p[5], a->top_left, vec2(tr.x, tr.y), a->color, a);
 }
 
+// Files that are not in the pack (or all of them if there is no
+// pack) are read from disk.
+static Void startup_io_begin () {
+    pack = pack_open(mem_root, str("data/assets.pack"));
+
+    for (U32 i = 0; i < STARTUP_FILE_COUNT; ++i) {
+        String path = str(startup_paths[i]);
+        if (pack && pack_get(pack, path).data) continue;
+        if (pack) log_msg_fmt(LOG_WARNING, "UI", 0, "[%.*s] is not in the asset pack; reading it from disk. Run \"make pack\" to update the pack.", STR(path));
+        startup_files[i] = (AioOp){ .tag=AIO_READ_FILE, .path=path, .mem=mem_root };
+        aio_submit(aio, &startup_files[i], &startup_io);
+    }
+
+    glyph_cache_prefetch(aio, font_prefetches, &startup_io, pack);
+}
+
 Void ui_test () {
+    parena = arena_new(mem_root, 1*MB);
+    farena = arena_new(mem_root, 1*MB);
+
+    tpool = tpool_new_ex(cast(Mem*, parena), .queue_size=1*KB, .reserve_cores=1, .pin=true);
+    aio   = aio_new(mem_root, tpool, 64);
+    startup_io_begin();
+
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
@@ -420,15 +581,19 @@ Void ui_test () {
     glGenVertexArrays(1, &VAO);
     glGenBuffers(1, &VBO);
 
-    parena = arena_new(mem_root, 1*MB);
-    farena = arena_new(mem_root, 1*MB);
+    tpool_group_wait(tpool, &startup_io);
 
     framebuffer   = framebuffer_new(&framebuffer_tex, 1, win_width, win_height);
     blur_buffer1  = framebuffer_new(&blur_tex1, 1, floor(win_width/BLUR_SHRINK), floor(win_height/BLUR_SHRINK));
     blur_buffer2  = framebuffer_new(&blur_tex2, 1, floor(win_width/BLUR_SHRINK), floor(win_height/BLUR_SHRINK));
-    rect_shader   = shader_new("src/ui/rect_vs.glsl", "src/ui/rect_fs.glsl");
-    screen_shader = shader_new("src/ui/screen_vs.glsl", "src/ui/screen_fs.glsl");
-    blur_shader   = shader_new("src/ui/blur_vs.glsl", "src/ui/blur_fs.glsl");
+
+    for (U32 i = 0; i < SHADER_PROGRAM_COUNT; ++i) {
+        ShaderProgram *p = &shader_programs[i];
+        *p->id = shader_new(p->vshader_file, p->fshader_file);
+        if (! *p->id) error();
+    }
+
+    assets_watch_begin();
 
     { // Screen quad init:
         array_init(&screen_vertices, parena);
@@ -469,14 +634,25 @@ Void ui_test () {
     prev_frame          = current_frame - 0.16f;
     first_counted_frame = current_frame;
 
+    // The ui thread gets the first core to itself so that frame
+    // latency doesn't depend on how busy the workers are. This is
+    // done last so that threads started by glfw or the GL driver
+    // don't inherit the pin. The topology only lists cpus in the
+    // process affinity, so cpus[0] is one we may run on, and it's
+    // on the core that .reserve_cores=1 keeps the workers off.
+    OsTopology *topo = os_get_topology();
+    if (topo->core_count > 1) os_thread_pin_self(array_get(&topo->cpus, 0).id);
+
     while(! glfwWindowShouldClose(window)) {
         current_frame = glfwGetTime();
         dt            = current_frame - prev_frame;
         prev_frame    = current_frame;
         frame_count++;
+        blog(LOG_NOTE, "Frame", "frame=%lu dt=%.3fms events=%lu", frame_count, dt * 1000, events.count);
 
         log_scope(ls, 1);
         arena_pop_all(farena);
+        assets_reload();
 
         #if 0
         if (current_frame - first_counted_frame >= 0.1) {
@@ -515,6 +691,16 @@ Void ui_test () {
     glDeleteProgram(rect_shader);
     glDeleteProgram(screen_shader);
     glfwTerminate();
+    if (watch) fs_watch_destroy(watch);
+    aio_destroy(aio);
+
+    for (U32 i = 0; i < STARTUP_FILE_COUNT; ++i) {
+        AioOp *op = &startup_files[i];
+        if (op->data.data) mem_free(op->mem, .old_ptr=op->data.data, .old_size=(op->data.count + 1));
+    }
+
+    if (pack) pack_close(pack);
+    tpool_destroy(tpool);
     arena_destroy(parena);
     arena_destroy(farena);
 }
@@ -740,6 +926,8 @@ istruct (Ui) {
     Array(UiRect) clip_stack;
     UiStyleRule *current_style_rule;
     GlyphCache *glyph_cache;
+    TPool *tpool;
+    TaskGraph *frame_graph;
 };
 
 static Void ui_tag (CString tag);
@@ -822,7 +1010,14 @@ static Void ui_init (Mem *mem, Mem *frame_mem) {
     map_init(&ui->box_cache, mem);
     map_init(&ui->pressed_keys, mem);
     array_push_lit(&ui->clip_stack, .w=win_width, .h=win_height);
-    ui->glyph_cache = glyph_cache_new(mem, 64, 16);
+    ui->glyph_cache = glyph_cache_new(mem, 64, 16, pack);
+    ui->tpool = tpool;
+
+    ui->frame_graph = frame_graph_new();
+}
+
+static Void ui_reload_font (FontSlot slot) {
+    glyph_cache_reload_font(ui->glyph_cache, slot);
 }
 
 static UiKey ui_build_key (String string) {
@@ -831,6 +1026,89 @@ static UiKey ui_build_key (String string) {
     return str_hash_seed(string, seed);
 }
 
+// The key builder is a streaming alternative to ui_build_key().
+// Instead of formatting a label into a string first, the pieces
+// of the key are hashed directly. Ints and floats are hashed as
+// raw 8 byte values:
+//
+//     UiKeyBuilder kb;
+//     ui_key_begin(&kb);
+//     ui_key_cat(&kb, "row_", row_idx, "_", x);
+//     UiBox *box = ui_box_push_key(0, ui_key_end(&kb), (String){});
+//
+// Or simply:
+//
+//     ui_box_cat(0, "row_", row_idx) { ... }
+//
+// The pieces are gathered into a small buffer and hashed in one
+// shot, and only long keys spill into the streaming XXH3 state.
+// Both give the same hash as XXH3 over the concatenated bytes,
+// so a key made of string pieces equals ui_build_key() of the
+// concatenated string.
+istruct (UiKeyBuilder) {
+    U64 seed;
+    U64 count;
+    Bool streaming;
+    U8 buf[256];
+    XXH3_state_t state;
+};
+
+static Void ui_key_begin (UiKeyBuilder *kb) {
+    UiBox *parent = array_try_get_last(&ui->box_stack);
+    kb->seed      = parent ? parent->key : 0;
+    kb->count     = 0;
+    kb->streaming = false;
+}
+
+static Void ui_key_push_bytes (UiKeyBuilder *kb, Void *data, U64 count) {
+    if ((kb->count + count) > sizeof(kb->buf)) {
+        if (! kb->streaming) {
+            XXH3_64bits_reset_withSeed(&kb->state, kb->seed);
+            kb->streaming = true;
+        }
+
+        XXH3_64bits_update(&kb->state, kb->buf, kb->count);
+        kb->count = 0;
+
+        if (count > sizeof(kb->buf)) {
+            XXH3_64bits_update(&kb->state, data, count);
+            return;
+        }
+    }
+
+    memcpy(kb->buf + kb->count, data, count);
+    kb->count += count;
+}
+
+static Void ui_key_push_str  (UiKeyBuilder *kb, String s)  { ui_key_push_bytes(kb, s.data, s.count); }
+static Void ui_key_push_cstr (UiKeyBuilder *kb, CString s) { ui_key_push_bytes(kb, s, strlen(s)); }
+static Void ui_key_push_u64  (UiKeyBuilder *kb, U64 v)     { ui_key_push_bytes(kb, &v, sizeof(v)); }
+static Void ui_key_push_i64  (UiKeyBuilder *kb, I64 v)     { ui_key_push_bytes(kb, &v, sizeof(v)); }
+static Void ui_key_push_f64  (UiKeyBuilder *kb, F64 v)     { ui_key_push_bytes(kb, &v, sizeof(v)); }
+
+static UiKey ui_key_end (UiKeyBuilder *kb) {
+    if (! kb->streaming) return str_hash_seed((String){ .data=cast(Char*, kb->buf), .count=kb->count }, kb->seed);
+    XXH3_64bits_update(&kb->state, kb->buf, kb->count);
+    return XXH3_64bits_digest(&kb->state);
+}
+
+#define ui_key_cat(KB, ...) ({ def1(ui_key_cat_kb, KB); FOR_EACH(ui_key_cat_, ui_key_cat_kb, __VA_ARGS__) })
+#define ui_key_cat_(KB, X)\
+    _Generic((X),\
+        String: ui_key_push_str,\
+        Char *: ui_key_push_cstr,\
+        I8:     ui_key_push_i64,\
+        I16:    ui_key_push_i64,\
+        I32:    ui_key_push_i64,\
+        I64:    ui_key_push_i64,\
+        U8:     ui_key_push_u64,\
+        U16:    ui_key_push_u64,\
+        U32:    ui_key_push_u64,\
+        U64:    ui_key_push_u64,\
+        F32:    ui_key_push_f64,\
+        F64:    ui_key_push_f64\
+    )(KB, X);
+
 static Void ui_push_parent (UiBox *box) { array_push(&ui->box_stack, box); }
 static Void ui_pop_parent  ()           { array_pop(&ui->box_stack); }
 static Void ui_pop_parent_ (Void *)     { array_pop(&ui->box_stack); }
@@ -841,12 +1119,14 @@ static Void ui_pop_parent_ (Void *)     { array_pop(&ui->box_stack); }
 
 // The label is copied into per-frame memory, so
 // no need to worry about lifetime issues.
-static UiBox *ui_box_push_str (UiBoxFlags flags, String label) {
-    UiKey key  = ui_build_key(label);
+//
+// The label is only used for drawing text and for
+// matching style rules, so it can be empty.
+static UiBox *ui_box_push_key (UiBoxFlags flags, UiKey key, String label) {
     UiBox *box = map_get_ptr(&ui->box_cache, key);
 
     if (box) {
-        if (box->gc_flag == ui->gc_flag) error_fmt("UiBox label hash collision: [%.*s] vs [%.*s].", STR(box->label), STR(label));
+        if (box->gc_flag == ui->gc_flag) error_fmt("UiBox key collision: [%.*s] vs [%.*s] (key=%lu).", STR(box->label), STR(label), key);
         box->parent = 0;
         box->tags.count = 0;
         box->children.count = 0;
@@ -889,6 +1169,10 @@ static UiBox *ui_box_push_str (UiBoxFlags flags, String label) {
     return box;
 }
 
+static UiBox *ui_box_push_str (UiBoxFlags flags, String label) {
+    return ui_box_push_key(flags, ui_build_key(label), label);
+}
+
 static UiBox *ui_box_push_fmt (UiBoxFlags flags, CString fmt, ...) {
     tmem_new(tm);
     AString a = astr_new(tm);
@@ -903,6 +1187,16 @@ static UiBox *ui_box_push (UiBoxFlags flags, CString label) {
 #define ui_box(...)     ui_box_push(__VA_ARGS__);     if (cleanup(ui_pop_parent_) U8 _; 1)
 #define ui_box_str(...) ui_box_push_str(__VA_ARGS__); if (cleanup(ui_pop_parent_) U8 _; 1)
 #define ui_box_fmt(...) ui_box_push_fmt(__VA_ARGS__); if (cleanup(ui_pop_parent_) U8 _; 1)
+#define ui_box_cat(...) ui_box_push_cat(__VA_ARGS__); if (cleanup(ui_pop_parent_) U8 _; 1)
+
+// Pushes a box with an empty label whose key is built
+// from the variadic args via ui_key_cat().
+#define ui_box_push_cat(FLAGS, ...) ({\
+    UiKeyBuilder _(kb);\
+    ui_key_begin(&_(kb));\
+    ui_key_cat(&_(kb), __VA_ARGS__);\
+    ui_box_push_key(FLAGS, ui_key_end(&_(kb)), (String){});\
+})
 
 static UiRect ui_push_clip_rect (UiRect rect) {
     UiRect intersection = compute_rect_intersect(rect, array_get_last(&ui->clip_stack));
@@ -1454,23 +1748,22 @@ static Void compute_positions (U64 axis) {
             }
         }
 
+        // Only touch this axis so that the axes can be laid out in parallel.
         array_iter (child, &box->children) {
-            child->rect.x = floor(child->rect.x);
-            child->rect.y = floor(child->rect.y);
-            child->rect.w = floor(child->rect.w);
-            child->rect.h = floor(child->rect.h);
+            child->rect.top_left.v[axis] = floor(child->rect.top_left.v[axis]);
+            child->rect.size[axis] = floor(child->rect.size[axis]);
         }
     }
 }
 
-static Void compute_layout () {
-    for (U64 axis = 0; axis < 2; ++axis) {
-        compute_standalone_sizes(axis);
-        compute_downward_dependent_sizes(axis);
-        compute_upward_dependent_sizes(axis);
-        fix_overflow(axis);
-        compute_positions(axis);
-    }
+// The passes for one axis only read and write the components
+// of that axis, so the two axes are independent.
+static Void compute_layout (U64 axis) {
+    compute_standalone_sizes(axis);
+    compute_downward_dependent_sizes(axis);
+    compute_upward_dependent_sizes(axis);
+    fix_overflow(axis);
+    compute_positions(axis);
 }
 
 static Void find_topmost_hovered_box (UiBox *box) {
@@ -1995,7 +2288,7 @@ static Void ui_grid_pop_ (Void *) { ui_grid_pop(); }
 // constructs super cells by defining on which basic cell they start,
 // and how many basic cells they cover.
 static UiBox *ui_grid_cell_push (F32 x, F32 y, F32 w, F32 h) {
-    UiBox *cell = ui_box_push_fmt(0, "grid_cell_%f_%f", x, y);
+    UiBox *cell = ui_box_push_cat(0, "grid_cell", x, y);
     ui_style_f32(UI_FLOAT_X, 0);
     ui_style_f32(UI_FLOAT_Y, 0);
     ui_style_vec2(UI_PADDING, vec2(8, 8));
@@ -2077,7 +2370,7 @@ static Void build_main_view () {
         }
 
         for (U64 i = 0; i < 20; ++i) {
-            ui_box_fmt(0, "box2__%i", i) {
+            ui_box_cat(0, "box2__", i) {
                 ui_tag("hbox");
                 ui_tag("item");
                 ui_slider("Slider", &n);
@@ -2323,6 +2616,33 @@ static Void find_prev_focus () {
     }
 }
 
+// =============================================================================
+// Frame graph:
+//
+// The passes after building the box tree run as a task graph:
+//
+//     style --> layout x --> hover
+//           \-> layout y -/
+//
+// Rendering stays on the main thread since it needs the gl context.
+// =============================================================================
+static TPOOL_FN(style_task)  { apply_style_rules(); }
+static TPOOL_FN(layout_task) { compute_layout(cast(U64, arg)); }
+static TPOOL_FN(hover_task)  { find_topmost_hovered_box(ui->root); }
+
+static TaskGraph *frame_graph_new () {
+    TaskGraph *g    = taskgraph_new(ui->mem, ui->tpool);
+    TaskNode *style = taskgraph_add(g, style_task, 0);
+    TaskNode *x     = taskgraph_add(g, layout_task, cast(Void*, 0));
+    TaskNode *y     = taskgraph_add(g, layout_task, cast(Void*, 1));
+    TaskNode *hover = taskgraph_add(g, hover_task, 0);
+    taskgraph_depend(g, x, style);
+    taskgraph_depend(g, y, style);
+    taskgraph_depend(g, hover, x);
+    taskgraph_depend(g, hover, y);
+    return g;
+}
+
 static Void ui_frame (F32 dt) {
     ui->dt = dt;
 
@@ -2371,8 +2691,6 @@ static Void ui_frame (F32 dt) {
         ui->gc_flag = !ui->gc_flag;
     }
 
-    apply_style_rules();
-    compute_layout();
-    find_topmost_hovered_box(ui->root);
+    taskgraph_run(ui->frame_graph);
     render_box(ui->root);
 }